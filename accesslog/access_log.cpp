@@ -0,0 +1,118 @@
+#include "access_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+
+access_log_header* g_access_log = NULL;
+static access_record* s_records = NULL;
+static size_t s_map_size = 0;
+
+static uint32_t url_hash(const char* s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for( size_t i = 0; i < len; ++i ) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+bool access_log_open(const char *path, uint32_t capacity)
+{
+    uint32_t cap = 1024;
+    while( cap < capacity && cap < ( 1u << 30 ) ) {
+        cap <<= 1;
+    }
+    size_t size = sizeof( access_log_header ) + (size_t)cap * sizeof( access_record );
+
+    int fd = open( path, O_RDWR | O_CREAT, 0644 );
+    if( fd < 0 ) {
+        EMlog(LOGLEVEL_ERROR, "access log: open %s failed: %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    bool reuse = fstat( fd, &st ) == 0 && (size_t)st.st_size == size;
+    if( !reuse && ftruncate( fd, size ) != 0 ) {
+        EMlog(LOGLEVEL_ERROR, "access log: resize %s failed: %s\n", path, strerror(errno));
+        close( fd );
+        return false;
+    }
+    void* base = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( base == MAP_FAILED ) {
+        EMlog(LOGLEVEL_ERROR, "access log: mmap %s failed: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    access_log_header* hdr = (access_log_header*)base;
+    if( !reuse || memcmp( hdr->magic, ACCESS_LOG_MAGIC, 4 ) != 0 || hdr->version != ACCESS_LOG_VERSION
+        || hdr->record_size != sizeof( access_record ) || hdr->capacity != cap ) {
+        // 新文件或者格式不同，清空重建
+        memset( base, 0, size );
+        memcpy( hdr->magic, ACCESS_LOG_MAGIC, 4 );
+        hdr->version = ACCESS_LOG_VERSION;
+        hdr->record_size = sizeof( access_record );
+        hdr->capacity = cap;
+        hdr->next = 0;
+    }
+
+    s_records = (access_record*)( (char*)base + sizeof( access_log_header ) );
+    s_map_size = size;
+    g_access_log = hdr;
+    EMlog(LOGLEVEL_INFO, "access log: %s, %u records, next %llu\n", path, cap, (unsigned long long)hdr->next);
+    return true;
+}
+
+void access_log_close()
+{
+    if( !g_access_log ) {
+        return;
+    }
+    msync( g_access_log, s_map_size, MS_ASYNC );
+    munmap( g_access_log, s_map_size );
+    g_access_log = NULL;
+    s_records = NULL;
+}
+
+void access_log_append(const sockaddr_in &addr, int method, const char *url, int status,
+                       uint64_t bytes, uint64_t latency_ns, unsigned flags)
+{
+    if( !g_access_log ) {
+        return;
+    }
+    uint64_t seq = __atomic_fetch_add( &g_access_log->next, 1, __ATOMIC_RELAXED );
+    access_record* r = &s_records[ seq & ( g_access_log->capacity - 1 ) ];
+
+    // 先把序号清零，读的一方看到不一致的序号就知道这条记录不完整
+    __atomic_store_n( &r->seq, 0, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+
+    struct timespec ts;
+    clock_gettime( CLOCK_REALTIME, &ts );
+    r->time_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    uint64_t latency_us = latency_ns / 1000;
+    r->latency_us = latency_us > 0xffffffffull ? 0xffffffffu : (uint32_t)latency_us;
+    r->client_ip = addr.sin_addr.s_addr;
+    r->client_port = addr.sin_port;
+    r->method = method;
+    r->flags = flags;
+    r->status = status;
+    size_t len = url ? strlen( url ) : 0;
+    r->url_len = len > 0xffff ? 0xffff : len;
+    r->bytes = bytes;
+    r->url_hash = url_hash( url, len );
+    size_t copy = len < sizeof( r->url ) ? len : sizeof( r->url );
+    if( copy ) {
+        memcpy( r->url, url, copy );
+    }
+    memset( r->url + copy, 0, sizeof( r->url ) - copy );
+
+    __atomic_store_n( &r->seq, seq + 1, __ATOMIC_RELEASE );
+}
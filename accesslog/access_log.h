@@ -0,0 +1,70 @@
+/*
+    二进制访问日志
+    每个请求一条定长记录，写入 mmap 的环形文件：取位置是一次原子加，写记录是普通的内存写入，
+    不经过 printf，也没有系统调用，由内核在后台把脏页写回文件。文件写满后从头覆盖最旧的记录。
+    记录最后写入序号，离线读取时序号不对的记录（正在写或者已经被覆盖）直接跳过。
+    tools/access_log_dump 把文件转换成文本或者 CSV。
+*/
+
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define ACCESS_LOG_MAGIC "WSAL"
+#define ACCESS_LOG_VERSION 1
+
+// 记录的标志位
+enum ACCESS_FLAG {
+    ACCESS_TLS = 1,         // TLS 连接
+    ACCESS_PROXY = 2,       // 转发给了后端
+    ACCESS_CORO = 4,        // 由协程处理
+    ACCESS_KEEP_ALIVE = 8,  // 响应后保持连接
+    ACCESS_H2 = 16,         // HTTP/2 的一个流
+};
+
+// 文件头，占 64 字节，之后是 capacity 条记录
+struct access_log_header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;          // 记录条数，2 的幂
+    uint64_t next;              // 下一条记录的序号，原子地递增
+    char pad[40];
+};
+
+// 一条记录，64 字节
+struct access_record
+{
+    uint64_t seq;               // 序号 + 1，最后写入，0 表示空
+    uint64_t time_ns;           // 响应发完的时间（CLOCK_REALTIME）
+    uint32_t latency_us;        // 从收到请求到响应发完
+    uint32_t client_ip;         // 网络字节序
+    uint16_t client_port;       // 网络字节序
+    uint8_t method;             // http_conn::METHOD
+    uint8_t flags;              // ACCESS_FLAG
+    uint16_t status;
+    uint16_t url_len;           // URL 的完整长度，超过 url 的部分被截断
+    uint64_t bytes;             // 发给客户端的字节数
+    uint32_t url_hash;          // 完整 URL 的 FNV-1a 哈希
+    char url[20];               // URL 的前缀，不以\0结尾
+};
+
+static_assert( sizeof( access_log_header ) == 64, "access log header must be 64 bytes" );
+static_assert( sizeof( access_record ) == 64, "access record must be 64 bytes" );
+
+// 打开（没有就创建）日志文件，capacity 向上取整到 2 的幂。已有的文件格式和容量一致时接着写
+bool access_log_open(const char* path, uint32_t capacity);
+void access_log_close();
+
+extern access_log_header* g_access_log;
+inline bool access_log_enabled() { return g_access_log != NULL; }
+
+// 追加一条记录，可以在任意线程中调用
+void access_log_append(const sockaddr_in& addr, int method, const char* url, int status,
+                       uint64_t bytes, uint64_t latency_ns, unsigned flags);
+
+#endif // ACCESS_LOG_H
@@ -0,0 +1,6 @@
+
+HEADERS += \
+    $$PWD/access_log.h
+
+SOURCES += \
+    $$PWD/access_log.cpp
@@ -0,0 +1,8 @@
+
+HEADERS += \
+    $$PWD/admin_server.h \
+    $$PWD/server_config.h
+
+SOURCES += \
+    $$PWD/admin_server.cpp \
+    $$PWD/server_config.cpp
@@ -0,0 +1,179 @@
+#include "admin_server.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "log.h"
+#include "server_config.h"
+
+//添加文件描述符到epoll中
+extern void addfd(int epollfd,int fd,bool one_shot,bool et);
+//删除文件描述符
+extern void removefd(int epollfd,int fd);
+
+admin_server::admin_server(int epollfd) : m_epollfd(epollfd), m_listenfd(-1)
+{
+    add_command( "help", "help", [this](const std::vector<std::string>&, std::string& out) {
+        for( size_t i = 0; i < m_commands.size(); ++i ) {
+            out += m_commands[i].usage + "\n";
+        }
+    } );
+    add_command( "get", "get [key]", [](const std::vector<std::string>& args, std::string& out) {
+        if( args.size() < 2 ) {
+            config_dump( out );
+            return;
+        }
+        std::string v;
+        if( config_get( args[1], v ) ) {
+            out += args[1] + " = " + v + "\n";
+        } else {
+            out += "error: unknown key " + args[1] + "\n";
+        }
+    } );
+    add_command( "set", "set key value", [](const std::vector<std::string>& args, std::string& out) {
+        std::string err;
+        if( args.size() != 3 ) {
+            out += "error: usage: set key value\n";
+        } else if( config_set( args[1], args[2], err ) ) {
+            out += "ok\n";
+        } else {
+            out += "error: " + err + "\n";
+        }
+    } );
+    add_command( "reload", "reload", [](const std::vector<std::string>&, std::string& out) {
+        out += config_reload() ? "ok\n" : "error: no config file or it has errors, see log\n";
+    } );
+}
+
+admin_server::~admin_server()
+{
+    while( !m_clients.empty() ) {
+        close_client( m_clients.begin()->first );
+    }
+    if( m_listenfd >= 0 ) {
+        removefd( m_epollfd, m_listenfd );
+        unlink( m_path.c_str() );
+    }
+}
+
+bool admin_server::open(const char *path)
+{
+    struct sockaddr_un addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    if( strlen( path ) >= sizeof( addr.sun_path ) ) {
+        EMlog(LOGLEVEL_ERROR, "admin: socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy( addr.sun_path, path );
+
+    int fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if( fd < 0 ) {
+        return false;
+    }
+    unlink( path );
+    // 创建文件时就只有属主可以读写，bind 和 chmod 之间没有空档
+    mode_t old_mask = umask( 077 );
+    int ret = bind( fd, (struct sockaddr*)&addr, sizeof( addr ) );
+    umask( old_mask );
+    if( ret != 0 || listen( fd, 16 ) != 0 ) {
+        EMlog(LOGLEVEL_ERROR, "admin: cannot listen on %s: %s\n", path, strerror(errno));
+        close( fd );
+        return false;
+    }
+    m_listenfd = fd;
+    m_path = path;
+    addfd( m_epollfd, m_listenfd, false, false );
+    EMlog(LOGLEVEL_INFO, "admin: listening on %s\n", path);
+    return true;
+}
+
+void admin_server::add_command(const char *name, const char *usage, command fn)
+{
+    entry e = { name, usage, fn };
+    m_commands.push_back( e );
+}
+
+void admin_server::handle_event(int fd, unsigned events)
+{
+    if( fd == m_listenfd ) {
+        accept_client();
+        return;
+    }
+    std::string& in = m_clients[fd];
+    char buf[ 1024 ];
+    ssize_t n;
+    while( ( n = recv( fd, buf, sizeof( buf ), 0 ) ) > 0 ) {
+        in.append( buf, n );
+    }
+    bool closed = n == 0 || ( n < 0 && errno != EAGAIN && errno != EWOULDBLOCK );
+
+    // 执行收到的每一行命令，回复很短，直接发送
+    std::string out;
+    size_t pos;
+    while( ( pos = in.find( '\n' ) ) != std::string::npos ) {
+        std::string line = in.substr( 0, pos );
+        in.erase( 0, pos + 1 );
+        execute( line, out );
+    }
+    if( in.size() > MAX_LINE ) {
+        out += "error: line too long\n";
+        closed = true;
+    }
+    if( !out.empty() && send( fd, out.data(), out.size(), MSG_NOSIGNAL ) != (ssize_t)out.size() ) {
+        EMlog(LOGLEVEL_WARN, "admin: reply to fd %d truncated\n", fd);
+    }
+    if( closed || ( events & ( EPOLLHUP | EPOLLERR ) ) ) {
+        close_client( fd );
+    }
+}
+
+void admin_server::accept_client()
+{
+    int fd = accept4( m_listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+    if( fd < 0 ) {
+        return;
+    }
+    // 回复直接发送，发送缓冲区给大一些，stats 这样较长的回复也能一次放下
+    int sndbuf = 256 * 1024;
+    setsockopt( fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof( sndbuf ) );
+    m_clients[fd] = std::string();
+    addfd( m_epollfd, fd, false, false );
+}
+
+void admin_server::close_client(int fd)
+{
+    removefd( m_epollfd, fd );      // 同时关闭fd
+    m_clients.erase( fd );
+}
+
+void admin_server::execute(const std::string &line, std::string &out)
+{
+    std::vector<std::string> args;
+    size_t i = 0;
+    while( i < line.size() ) {
+        size_t j = line.find_first_of( " \t\r", i );
+        if( j == std::string::npos ) {
+            j = line.size();
+        }
+        if( j > i ) {
+            args.push_back( line.substr( i, j - i ) );
+        }
+        i = j + 1;
+    }
+    if( args.empty() ) {
+        return;
+    }
+    for( size_t k = 0; k < m_commands.size(); ++k ) {
+        if( m_commands[k].name == args[0] ) {
+            m_commands[k].fn( args, out );
+            return;
+        }
+    }
+    out += "error: unknown command " + args[0] + ", try help\n";
+}
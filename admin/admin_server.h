@@ -0,0 +1,57 @@
+/*
+    管理 socket
+    本地的 Unix 域 socket，只有同一台机器上有权限的用户能连接（文件权限 0600）。
+    协议是按行的文本命令，每条命令回复若干行，出错的回复以 "error:" 开头，比如：
+        echo "set threads 16" | socat - UNIX-CONNECT:/tmp/webserver.sock
+    内置 help、get、set、reload，其余命令（比如 stats）由 main 注册。
+    监听和连接都在主线程的 epoll 中处理，命令也在主线程中执行。
+*/
+
+#ifndef ADMIN_SERVER_H
+#define ADMIN_SERVER_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+class admin_server
+{
+public:
+    // 命令处理函数，args[0] 是命令名，回复追加到 out
+    typedef std::function<void(const std::vector<std::string>& args, std::string& out)> command;
+
+    static const int MAX_LINE = 4096;   // 一条命令的最大长度
+
+    explicit admin_server(int epollfd);
+    ~admin_server();
+
+    // 在 path 上监听，已有的同名文件会被删除
+    bool open(const char* path);
+
+    void add_command(const char* name, const char* usage, command fn);
+
+    bool owns(int fd) const { return m_listenfd >= 0 && ( fd == m_listenfd || m_clients.count( fd ) ); }
+    void handle_event(int fd, unsigned events);
+
+private:
+    void accept_client();
+    void close_client(int fd);
+    void execute(const std::string& line, std::string& out);
+
+private:
+    struct entry
+    {
+        std::string name;
+        std::string usage;
+        command fn;
+    };
+
+    int m_epollfd;
+    int m_listenfd;
+    std::string m_path;
+    std::map<int, std::string> m_clients;   // 连接 -> 还没凑成一行的输入
+    std::vector<entry> m_commands;
+};
+
+#endif // ADMIN_SERVER_H
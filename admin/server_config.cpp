@@ -0,0 +1,229 @@
+#include "server_config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <vector>
+
+server_config g_config;
+
+static std::string s_config_file;   // 启动时读取的配置文件
+
+// 一个参数，整数和字符串二选一
+struct config_key
+{
+    const char* name;
+    int server_config::* ival;
+    std::string server_config::* sval;
+    int min, max;
+    bool live;                      // 能否在运行中修改
+    std::vector<config_hook> hooks;
+};
+
+static config_key s_keys[] = {
+    { "port", &server_config::port, NULL, 1, 65535, false, {} },
+    { "doc_root", NULL, &server_config::doc_root, 0, 0, false, {} },
+    { "admin_socket", NULL, &server_config::admin_socket, 0, 0, false, {} },
+    { "bulk_prefix", NULL, &server_config::bulk_prefix, 0, 0, false, {} },
+    { "max_fd", &server_config::max_fd, NULL, 64, 1 << 24, false, {} },
+    { "max_events", &server_config::max_events, NULL, 1, 1 << 20, false, {} },
+    { "neg_cache", &server_config::neg_cache, NULL, 0, 1 << 24, false, {} },
+    { "rate_entries", &server_config::rate_entries, NULL, 0, 1 << 24, false, {} },
+    { "io_threads", &server_config::io_threads, NULL, 0, 64, false, {} },
+    { "min_threads", &server_config::min_threads, NULL, 1, 1024, true, {} },
+    { "max_threads", &server_config::max_threads, NULL, 1, 1024, true, {} },
+    { "grow_queue", &server_config::grow_queue, NULL, 1, 1 << 24, true, {} },
+    { "grow_wait_ms", &server_config::grow_wait_ms, NULL, 0, 60000, true, {} },
+    { "idle_retire", &server_config::idle_retire, NULL, 1, 86400, true, {} },
+    { "small_kb", &server_config::small_kb, NULL, 0, 1 << 24, true, {} },
+    { "bulk_kb", &server_config::bulk_kb, NULL, 1, 1 << 24, true, {} },
+    { "weight_small", &server_config::weight_small, NULL, 1, 1000, true, {} },
+    { "weight_normal", &server_config::weight_normal, NULL, 1, 1000, true, {} },
+    { "weight_bulk", &server_config::weight_bulk, NULL, 1, 1000, true, {} },
+    { "max_queue", &server_config::max_queue, NULL, 1, 1 << 24, true, {} },
+    { "max_conns", &server_config::max_conns, NULL, 1, 1 << 24, true, {} },
+    { "idle_timeout", &server_config::idle_timeout, NULL, 1, 86400, true, {} },
+    { "header_timeout", &server_config::header_timeout, NULL, 1, 86400, true, {} },
+    { "body_timeout", &server_config::body_timeout, NULL, 1, 86400, true, {} },
+    { "timeout_shrink_pct", &server_config::timeout_shrink_pct, NULL, 0, 100, true, {} },
+    { "timeout_min_pct", &server_config::timeout_min_pct, NULL, 1, 100, true, {} },
+    { "timer_slot", &server_config::timer_slot, NULL, 1, 3600, true, {} },
+    { "log_level", &server_config::log_level, NULL, LOGLEVEL_DEBUG, LOGLEVEL_ERROR, true, {} },
+    { "tls_session_cache", &server_config::tls_session_cache, NULL, 0, 1 << 24, true, {} },
+    { "proxy_idle", &server_config::proxy_idle, NULL, 0, 4096, true, {} },
+    { "ip_rate", &server_config::ip_rate, NULL, 0, 1000000, true, {} },
+    { "ip_burst", &server_config::ip_burst, NULL, 1, 1000000, true, {} },
+    { "net_rate", &server_config::net_rate, NULL, 0, 1000000, true, {} },
+    { "net_burst", &server_config::net_burst, NULL, 1, 1000000, true, {} },
+};
+
+static config_key* find_key(const std::string& name)
+{
+    for( size_t i = 0; i < sizeof( s_keys ) / sizeof( s_keys[0] ); ++i ) {
+        if( name == s_keys[i].name ) {
+            return &s_keys[i];
+        }
+    }
+    return NULL;
+}
+
+// 日志等级可以写名字
+static bool parse_int(const config_key* k, const std::string& value, int& out)
+{
+    if( k->ival == &server_config::log_level ) {
+        for( int level = LOGLEVEL_DEBUG; level <= LOGLEVEL_ERROR; ++level ) {
+            if( strcasecmp( value.c_str(), EM_logLevelGet( level ) ) == 0 ) {
+                out = level;
+                return true;
+            }
+        }
+    }
+    char* end;
+    errno = 0;
+    long v = strtol( value.c_str(), &end, 10 );
+    if( value.empty() || *end != '\0' || errno != 0 || v < k->min || v > k->max ) {
+        return false;
+    }
+    out = (int)v;
+    return true;
+}
+
+bool config_set(const std::string &key, const std::string &value, std::string &err, bool startup)
+{
+    config_key* k = find_key( key );
+    if( !k ) {
+        err = "unknown key " + key;
+        return false;
+    }
+    if( !startup && !k->live ) {
+        err = key + " can only be set at startup";
+        return false;
+    }
+    if( k->sval ) {
+        g_config.*k->sval = value;
+        return true;
+    }
+    int v;
+    if( !parse_int( k, value, v ) ) {
+        err = "bad value for " + key + ": " + value + " (expect " + std::to_string( k->min ) + ".." + std::to_string( k->max ) + ")";
+        return false;
+    }
+    if( g_config.*k->ival == v ) {
+        return true;
+    }
+    g_config.*k->ival = v;
+    if( !startup ) {
+        EMlog(LOGLEVEL_INFO, "config: %s = %d\n", k->name, v);
+        for( size_t i = 0; i < k->hooks.size(); ++i ) {
+            k->hooks[i]( v );
+        }
+    }
+    return true;
+}
+
+bool config_get(const std::string &key, std::string &value)
+{
+    config_key* k = find_key( key );
+    if( !k ) {
+        return false;
+    }
+    if( k->sval ) {
+        value = g_config.*k->sval;
+    } else if( k->ival == &server_config::log_level ) {
+        value = EM_logLevelGet( g_config.log_level );
+    } else {
+        value = std::to_string( g_config.*k->ival );
+    }
+    return true;
+}
+
+void config_dump(std::string &out)
+{
+    for( size_t i = 0; i < sizeof( s_keys ) / sizeof( s_keys[0] ); ++i ) {
+        std::string v;
+        config_get( s_keys[i].name, v );
+        out += s_keys[i].name;
+        out += " = ";
+        out += v;
+        out += s_keys[i].live ? "\n" : "    # startup only\n";
+    }
+}
+
+void config_watch(const char *key, config_hook hook)
+{
+    config_key* k = find_key( key );
+    if( k ) {
+        k->hooks.push_back( hook );
+    }
+}
+
+// 去掉首尾空白
+static char* trim(char* s)
+{
+    while( *s == ' ' || *s == '\t' ) {
+        ++s;
+    }
+    char* e = s + strlen( s );
+    while( e > s && ( e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r' || e[-1] == '\n' ) ) {
+        --e;
+    }
+    *e = '\0';
+    return s;
+}
+
+bool config_load(const char *path, bool startup)
+{
+    FILE* fp = fopen( path, "r" );
+    if( !fp ) {
+        EMlog(LOGLEVEL_ERROR, "config: cannot open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if( startup ) {
+        s_config_file = path;
+    }
+    bool ok = true;
+    char line[ 1024 ];
+    for( int lineno = 1; fgets( line, sizeof( line ), fp ); ++lineno ) {
+        char* comment = strchr( line, '#' );
+        if( comment ) {
+            *comment = '\0';
+        }
+        char* s = trim( line );
+        if( *s == '\0' ) {
+            continue;
+        }
+        char* eq = strchr( s, '=' );
+        if( !eq ) {
+            EMlog(LOGLEVEL_ERROR, "config: %s:%d: expect key = value\n", path, lineno);
+            ok = false;
+            continue;
+        }
+        *eq = '\0';
+        std::string key = trim( s ), value = trim( eq + 1 ), err;
+        config_key* k = find_key( key );
+        if( !startup && k && !k->live ) {
+            std::string cur;
+            config_get( key, cur );
+            if( cur != value ) {
+                EMlog(LOGLEVEL_WARN, "config: %s changed, restart to apply\n", key.c_str());
+            }
+            continue;
+        }
+        if( !config_set( key, value, err, startup ) ) {
+            EMlog(LOGLEVEL_ERROR, "config: %s:%d: %s\n", path, lineno, err.c_str());
+            ok = false;
+        }
+    }
+    fclose( fp );
+    return ok;
+}
+
+bool config_reload()
+{
+    if( s_config_file.empty() ) {
+        return false;
+    }
+    return config_load( s_config_file.c_str(), false );
+}
@@ -0,0 +1,76 @@
+/*
+    运行参数
+    启动时从配置文件（-f）读取，每行一个 key = value，# 之后是注释。
+    一部分参数可以在运行中修改：管理 socket 的 set 命令，或者改了配置文件后 reload（SIGHUP）。
+    修改后通知用 config_watch 注册了的模块；其余参数只在启动时生效，重新加载时忽略。
+    g_config 只在主线程中读写，工作线程用到的参数由修改通知转存到各模块自己的变量里。
+*/
+
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+#include <functional>
+#include <string>
+
+#include "log.h"
+
+struct server_config
+{
+    // 只在启动时生效
+    int port = 0;                   // 命令行的端口号优先
+    std::string doc_root;           // 网站根目录，命令行优先
+    std::string admin_socket;       // 管理 socket 的路径，空表示不开启
+    std::string bulk_prefix;        // 这些路径前缀下的请求都算作大请求，多个用逗号分隔
+    int max_fd = 65535;             // 最大的文件描述符个数
+    int max_events = 10000;         // 一次epoll_wait最多返回的事件数
+    int neg_cache = 16384;          // 不存在的路径缓存的项数，0 表示不缓存
+    int rate_entries = 65536;       // 限速表的项数（每个 IP 和每个 /24 网段各占一项）
+    int io_threads = 2;             // 读取冷文件的线程数，0 表示不检查页缓存、直接从映射发送
+
+    // 可以在运行中修改
+    int min_threads = 4;            // 工作线程数的范围，线程池在这之间按负载伸缩
+    int max_threads = 32;
+    int grow_queue = 16;            // 没有空闲线程、队列积压到这个长度时加线程
+    int grow_wait_ms = 10;          // 没有空闲线程、任务排队超过这个时间（毫秒）时加线程
+    int idle_retire = 30;           // 线程空闲超过这个时间（秒）就退出，直到剩下 min_threads 个
+    int small_kb = 64;              // 响应体不超过这个大小（KB）的请求是小请求
+    int bulk_kb = 1024;             // 响应体达到这个大小（KB）的请求是大请求
+    int weight_small = 8;           // 线程池按这个比例从小请求、普通请求、大请求的队列中取任务
+    int weight_normal = 4;
+    int weight_bulk = 1;
+    int max_queue = 10000;          // 线程池队列的上限，满了之后新请求直接关闭连接
+    int max_conns = 65535;          // 连接数的上限，超过后新连接直接关闭
+    int idle_timeout = 15;          // 连接空闲超时：秒
+    int header_timeout = 10;        // 从连接建立或者请求开始到收完请求头的超时：秒，中途收到数据也不推迟
+    int body_timeout = 30;          // 接收请求体时两次收到数据之间的超时：秒
+    int timeout_shrink_pct = 50;    // 连接数超过上限的这个百分比后，超时时间开始缩短
+    int timeout_min_pct = 20;       // 连接数达到上限时，超时时间缩短到的百分比
+    int timer_slot = 5;             // 定时器周期：秒
+    int log_level = LOG_LEVEL;      // 日志等级
+    int tls_session_cache = 20480;  // TLS 服务端会话缓存的最大会话数
+    int proxy_idle = 32;            // 每个后端最多保留的空闲连接数
+    int ip_rate = 0;                // 每个客户端 IP 每秒的新连接加请求数，0 表示不限制
+    int ip_burst = 100;             // 每个 IP 可以突发的数量
+    int net_rate = 0;               // 每个 /24 网段每秒的新连接加请求数，0 表示不限制
+    int net_burst = 400;
+};
+
+extern server_config g_config;
+
+// 参数修改后的通知，参数是新的值
+typedef std::function<void(int value)> config_hook;
+
+// 读取配置文件。startup 为false时是重新加载，只修改能在运行中修改的参数
+bool config_load(const char* path, bool startup);
+// 重新加载启动时读取的配置文件，没有指定配置文件时返回false
+bool config_reload();
+// 修改一个参数，失败时 err 为原因
+bool config_set(const std::string& key, const std::string& value, std::string& err, bool startup = false);
+// 取得一个参数的值，没有该参数返回false
+bool config_get(const std::string& key, std::string& value);
+// 全部参数，每行 key = value，能在运行中修改的标记出来
+void config_dump(std::string& out);
+// 注册参数修改后的通知
+void config_watch(const char* key, config_hook hook);
+
+#endif // SERVER_CONFIG_H
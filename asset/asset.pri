@@ -0,0 +1,6 @@
+
+HEADERS += \
+    $$PWD/asset_pack.h
+
+SOURCES += \
+    $$PWD/asset_pack.cpp
@@ -0,0 +1,412 @@
+#include "asset_pack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+#include <string>
+#include <vector>
+
+#include "log.h"
+
+// 打包时扫描到的文件
+struct asset_file
+{
+    std::string url;        // URL 路径，去掉开头的 '/' 就是相对根目录的路径
+    long size;
+};
+
+// 扫描时的限制和统计
+struct scan_state
+{
+    std::vector<asset_file> files;
+    uint64_t packed;        // 已经收下的文件内容总大小
+    int skipped;            // 超过总大小上限没有打包的文件数
+};
+
+static uint32_t path_hash(const char* s, int len)
+{
+    uint32_t h = 2166136261u;
+    for( int i = 0; i < len; ++i ) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint64_t content_hash(const char* s, size_t len)
+{
+    uint64_t h = 14695981039346656037ull;
+    for( size_t i = 0; i < len; ++i ) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// 根据扩展名取 Content-Type
+static const char* mime_type(const std::string& url)
+{
+    static const char* types[][2] = {
+        { ".html", "text/html" },
+        { ".htm",  "text/html" },
+        { ".css",  "text/css" },
+        { ".js",   "application/javascript" },
+        { ".json", "application/json" },
+        { ".txt",  "text/plain" },
+        { ".xml",  "text/xml" },
+        { ".jpg",  "image/jpeg" },
+        { ".jpeg", "image/jpeg" },
+        { ".png",  "image/png" },
+        { ".gif",  "image/gif" },
+        { ".ico",  "image/x-icon" },
+        { ".svg",  "image/svg+xml" },
+        { ".webp", "image/webp" },
+        { ".mp4",  "video/mp4" },
+        { ".pdf",  "application/pdf" },
+    };
+    size_t dot = url.rfind( '.' );
+    if( dot != std::string::npos ) {
+        for( size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i ) {
+            if( strcasecmp( url.c_str() + dot, types[i][0] ) == 0 ) {
+                return types[i][1];
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+// 递归遍历目录，收集可以打包的文件。fd 是打开的目录，由这里关闭
+// 不跟随符号链接：链接可能指向根目录以外，也可能在目录之间形成环。
+// 这些路径不打包，请求时由 do_request 用 openat2 判断能不能访问
+static void scan_dir(int fd, const std::string& url_dir, const char* exclude_prefix, int depth, scan_state& state)
+{
+    DIR* dir = fdopendir( fd );
+    if( !dir ) {
+        EMlog(LOGLEVEL_WARN, "asset pack: cannot open dir %s/: %s\n", url_dir.c_str(), strerror(errno));
+        close( fd );
+        return;
+    }
+    struct dirent* ent;
+    while( ( ent = readdir( dir ) ) != NULL ) {
+        if( ent->d_name[0] == '.' ) {       // 跳过 . .. 和隐藏文件
+            continue;
+        }
+        std::string url = url_dir + "/" + ent->d_name;
+        struct stat st;
+        if( fstatat( dirfd( dir ), ent->d_name, &st, AT_SYMLINK_NOFOLLOW ) < 0 ) {
+            continue;
+        }
+        if( S_ISDIR( st.st_mode ) ) {
+            if( exclude_prefix && strncmp( ( url + "/" ).c_str(), exclude_prefix, strlen( exclude_prefix ) ) == 0 ) {
+                continue;
+            }
+            if( depth >= asset_pack::MAX_DEPTH ) {
+                EMlog(LOGLEVEL_WARN, "asset pack: %s is nested too deep, not packed\n", url.c_str());
+                continue;
+            }
+            int sub = openat( dirfd( dir ), ent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC );
+            if( sub >= 0 ) {
+                scan_dir( sub, url, exclude_prefix, depth + 1, state );
+            }
+        } else if( S_ISREG( st.st_mode ) && ( st.st_mode & S_IROTH ) && st.st_size <= asset_pack::MAX_ASSET_SIZE ) {
+            // 和 do_request 一样，只打包所有人可读的文件，其余交给 do_request 返回 403
+            // 总大小超过上限后的文件不打包，仍从磁盘发送
+            if( state.packed + st.st_size > (uint64_t)asset_pack::MAX_PACK_SIZE ) {
+                ++state.skipped;
+                continue;
+            }
+            state.packed += st.st_size;
+            asset_file f;
+            f.url = url;
+            f.size = st.st_size;
+            state.files.push_back( f );
+        }
+    }
+    closedir( dir );
+}
+
+// 相对根目录打开要打包的文件，路径上不允许有符号链接（扫描之后被换成链接也不行）。
+// 内核不支持 openat2 时退回 openat，只能保证最后一级不是链接
+static int open_packed(int root_fd, const char* path)
+{
+    int flags = O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK;
+    struct open_how how;
+    memset( &how, 0, sizeof( how ) );
+    how.flags = flags;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+    int fd = syscall( SYS_openat2, root_fd, path, &how, sizeof( how ) );
+    if( fd >= 0 || errno != ENOSYS ) {
+        return fd;
+    }
+    return openat( root_fd, path, flags );
+}
+
+// 把文件内容读到 buf
+static bool read_file(int root_fd, const char* path, char* buf, long size)
+{
+    int fd = open_packed( root_fd, path );
+    if( fd < 0 ) {
+        return false;
+    }
+    struct stat st;
+    if( fstat( fd, &st ) < 0 || !S_ISREG( st.st_mode ) ) {
+        close( fd );
+        return false;
+    }
+    long done = 0;
+    while( done < size ) {
+        ssize_t n = read( fd, buf + done, size - done );
+        if( n <= 0 ) {
+            close( fd );
+            return false;
+        }
+        done += n;
+    }
+    close( fd );
+    return true;
+}
+
+asset_pack::asset_pack() : m_base(NULL), m_size(0), m_mapped(false)
+{
+}
+
+asset_pack::~asset_pack()
+{
+    release();
+}
+
+void asset_pack::release()
+{
+    if( m_base ) {
+        if( m_mapped ) {
+            munmap( m_base, m_size );
+        } else {
+            free( m_base );
+        }
+    }
+    m_base = NULL;
+    m_size = 0;
+    m_mapped = false;
+}
+
+bool asset_pack::build(const char *doc_root, const char *exclude_prefix)
+{
+    int root_fd = open( doc_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    if( root_fd < 0 ) {
+        EMlog(LOGLEVEL_ERROR, "asset pack: cannot open %s: %s\n", doc_root, strerror(errno));
+        return false;
+    }
+    scan_state state;
+    state.packed = 0;
+    state.skipped = 0;
+    scan_dir( openat( root_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC ), "", exclude_prefix, 0, state );
+    if( state.skipped ) {
+        EMlog(LOGLEVEL_WARN, "asset pack: size limit %ld reached, %d files served from disk\n",
+              asset_pack::MAX_PACK_SIZE, state.skipped);
+    }
+    std::vector<asset_file>& files = state.files;
+
+    uint32_t count = files.size();
+    uint32_t bucket_count = 16;
+    while( bucket_count < count * 2 ) {
+        bucket_count <<= 1;
+    }
+
+    size_t strings_off = sizeof(asset_pack_header) + sizeof(asset_entry) * count + sizeof(uint32_t) * bucket_count;
+    size_t bodies_off = strings_off;
+    for( uint32_t i = 0; i < count; ++i ) {
+        bodies_off += files[i].url.size() + 512;      // 路径 + 响应头的上限
+    }
+    bodies_off = ( bodies_off + 63 ) & ~(size_t)63;
+    size_t total = bodies_off;
+    for( uint32_t i = 0; i < count; ++i ) {
+        total += ( files[i].size + 63 ) & ~63L;
+    }
+
+    char* base = (char*)calloc( 1, total );
+    if( !base ) {
+        close( root_fd );
+        return false;
+    }
+
+    asset_pack_header* hdr = (asset_pack_header*)base;
+    asset_entry* ents = (asset_entry*)( base + sizeof(asset_pack_header) );
+    uint32_t* bkts = (uint32_t*)( ents + count );
+    size_t str_pos = strings_off;
+    size_t body_pos = bodies_off;
+
+    for( uint32_t i = 0; i < count; ++i ) {
+        const asset_file& f = files[i];
+        asset_entry& e = ents[i];
+
+        e.body_off = body_pos;
+        e.body_len = f.size;
+        if( !read_file( root_fd, f.url.c_str() + 1, base + body_pos, f.size ) ) {
+            EMlog(LOGLEVEL_ERROR, "asset pack: read %s%s failed\n", doc_root, f.url.c_str());
+            free( base );
+            close( root_fd );
+            return false;
+        }
+        body_pos += ( f.size + 63 ) & ~63L;
+
+        e.path_off = str_pos;
+        e.path_len = f.url.size();
+        memcpy( base + str_pos, f.url.data(), f.url.size() );
+        str_pos += f.url.size();
+
+        // ETag 由内容哈希和长度组成，内容不变 ETag 就不变
+        char etag[64];
+        int etag_len = snprintf( etag, sizeof(etag), "\"%016llx-%lx\"",
+                                 (unsigned long long)content_hash( base + e.body_off, f.size ), f.size );
+        e.etag_off = str_pos;
+        e.etag_len = etag_len;
+        memcpy( base + str_pos, etag, etag_len );
+        str_pos += etag_len;
+
+        e.ok_off = str_pos;
+        e.ok_len = sprintf( base + str_pos, "HTTP/1.1 200 OK\r\nContent-Length: %ld\r\nContent-Type: %s\r\nETag: %s\r\n",
+                            f.size, mime_type( f.url ), etag );
+        str_pos += e.ok_len;
+
+        e.nm_off = str_pos;
+        e.nm_len = sprintf( base + str_pos, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n", etag );
+        str_pos += e.nm_len;
+
+        // 开放寻址，桶里存下标+1，0 表示空
+        uint32_t b = path_hash( f.url.data(), f.url.size() ) & ( bucket_count - 1 );
+        while( bkts[b] ) {
+            b = ( b + 1 ) & ( bucket_count - 1 );
+        }
+        bkts[b] = i + 1;
+    }
+
+    close( root_fd );
+
+    memcpy( hdr->magic, ASSET_PACK_MAGIC, 4 );
+    hdr->version = ASSET_PACK_VERSION;
+    hdr->count = count;
+    hdr->bucket_count = bucket_count;
+    hdr->size = total;
+
+    release();
+    m_base = base;
+    m_size = total;
+    m_mapped = false;
+    EMlog(LOGLEVEL_INFO, "asset pack: %u files from %s, %zu bytes\n", count, doc_root, total);
+    return true;
+}
+
+bool asset_pack::load(const char *path)
+{
+    int fd = open( path, O_RDONLY );
+    if( fd < 0 ) {
+        EMlog(LOGLEVEL_ERROR, "asset pack: open %s failed: %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if( fstat( fd, &st ) < 0 || st.st_size < (off_t)sizeof(asset_pack_header) ) {
+        close( fd );
+        return false;
+    }
+    // MAP_POPULATE 启动时就把内容读进内存，之后发送时不会因为缺页去读磁盘
+    char* base = (char*)mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0 );
+    close( fd );
+    if( base == MAP_FAILED ) {
+        return false;
+    }
+
+    const asset_pack_header* hdr = (const asset_pack_header*)base;
+    size_t index_end = sizeof(asset_pack_header) + sizeof(asset_entry) * (size_t)hdr->count
+                       + sizeof(uint32_t) * (size_t)hdr->bucket_count;
+    if( memcmp( hdr->magic, ASSET_PACK_MAGIC, 4 ) != 0 || hdr->version != ASSET_PACK_VERSION
+        || hdr->size != (uint64_t)st.st_size || index_end > (size_t)st.st_size
+        || hdr->bucket_count == 0 || ( hdr->bucket_count & ( hdr->bucket_count - 1 ) ) ) {
+        EMlog(LOGLEVEL_ERROR, "asset pack: %s is not a valid pack\n", path);
+        munmap( base, st.st_size );
+        return false;
+    }
+
+    // 所有偏移都要落在文件内，防止损坏的资源包导致越界访问
+    const asset_entry* ents = (const asset_entry*)( base + sizeof(asset_pack_header) );
+    for( uint32_t i = 0; i < hdr->count; ++i ) {
+        const asset_entry& e = ents[i];
+        if( (uint64_t)e.path_off + e.path_len > hdr->size || (uint64_t)e.ok_off + e.ok_len > hdr->size
+            || (uint64_t)e.nm_off + e.nm_len > hdr->size || (uint64_t)e.etag_off + e.etag_len > hdr->size
+            || e.body_off > hdr->size || e.body_len > hdr->size - e.body_off ) {
+            EMlog(LOGLEVEL_ERROR, "asset pack: %s entry %u out of range\n", path, i);
+            munmap( base, st.st_size );
+            return false;
+        }
+    }
+    // 桶里存的是下标+1，不能超过资源数量
+    const uint32_t* bkts = (const uint32_t*)( ents + hdr->count );
+    for( uint32_t b = 0; b < hdr->bucket_count; ++b ) {
+        if( bkts[b] > hdr->count ) {
+            EMlog(LOGLEVEL_ERROR, "asset pack: %s bucket %u out of range\n", path, b);
+            munmap( base, st.st_size );
+            return false;
+        }
+    }
+
+    release();
+    m_base = base;
+    m_size = st.st_size;
+    m_mapped = true;
+    EMlog(LOGLEVEL_INFO, "asset pack: loaded %u files from %s\n", hdr->count, path);
+    return true;
+}
+
+bool asset_pack::save(const char *path) const
+{
+    if( !m_base ) {
+        return false;
+    }
+    // 先写临时文件再 rename，正在运行的服务器 mmap 的旧文件不受影响
+    std::string tmp = std::string( path ) + ".tmp";
+    int fd = open( tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if( fd < 0 ) {
+        return false;
+    }
+    size_t done = 0;
+    while( done < m_size ) {
+        ssize_t n = write( fd, m_base + done, m_size - done );
+        if( n <= 0 ) {
+            close( fd );
+            unlink( tmp.c_str() );
+            return false;
+        }
+        done += n;
+    }
+    if( close( fd ) != 0 || rename( tmp.c_str(), path ) != 0 ) {
+        unlink( tmp.c_str() );
+        return false;
+    }
+    return true;
+}
+
+const asset_entry *asset_pack::find(const char *path, int len) const
+{
+    if( !m_base ) {
+        return NULL;
+    }
+    const asset_entry* ents = entries();
+    const uint32_t* bkts = buckets();
+    uint32_t mask = header()->bucket_count - 1;
+    // 最多探测一圈，桶全满（损坏的资源包）时也会结束
+    uint32_t b = path_hash( path, len ) & mask;
+    for( uint32_t n = 0; n <= mask && bkts[b]; ++n, b = ( b + 1 ) & mask ) {
+        const asset_entry* e = &ents[ bkts[b] - 1 ];
+        if( e->path_len == (uint32_t)len && memcmp( m_base + e->path_off, path, len ) == 0 ) {
+            return e;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,76 @@
+/*
+    静态资源包
+    把网站根目录下的全部文件连同预先生成好的响应头打包进一块连续内存，
+    命中时直接从内存发送，不再 stat/open/mmap。
+    资源包可以在启动时从目录生成，也可以提前生成文件，部署后整体 mmap 进来。
+
+    布局（偏移都相对资源包起始位置）：
+        asset_pack_header | asset_entry[count] | 哈希桶 uint32_t[bucket_count] | 字符串区 | 文件内容
+*/
+
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ASSET_PACK_MAGIC "WSPK"
+#define ASSET_PACK_VERSION 1
+
+struct asset_pack_header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t count;             // 资源数量
+    uint32_t bucket_count;      // 哈希桶数量，2的幂
+    uint64_t size;              // 整个资源包的大小
+};
+
+// 一个资源
+struct asset_entry
+{
+    uint32_t path_off, path_len;    // URL 路径，比如 /index.html
+    uint32_t ok_off, ok_len;        // 200 响应的状态行和固定响应头（不含 Connection、Date 和空行）
+    uint32_t nm_off, nm_len;        // 304 响应的状态行和固定响应头
+    uint32_t etag_off, etag_len;    // ETag，带引号
+    uint64_t body_off, body_len;    // 文件内容
+};
+
+class asset_pack
+{
+public:
+    static const long MAX_ASSET_SIZE = 64 * 1024 * 1024;   // 超过该大小的文件不打包，仍从磁盘发送
+    static const long MAX_PACK_SIZE = 256 * 1024 * 1024;   // 所有文件内容加起来的上限，超过后的文件仍从磁盘发送
+    static const int MAX_DEPTH = 32;                        // 目录层数的上限
+
+    asset_pack();
+    ~asset_pack();
+
+    // 遍历目录生成资源包，exclude_prefix 开头的路径（比如上传目录）不打包，符号链接不跟随
+    bool build(const char* doc_root, const char* exclude_prefix);
+    // mmap 一个提前生成的资源包文件
+    bool load(const char* path);
+    // 把资源包写入文件
+    bool save(const char* path) const;
+
+    // 查找 URL 路径，len 为路径长度（不要求以\0结尾），没有返回NULL
+    const asset_entry* find(const char* path, int len) const;
+
+    const char* at(uint64_t off) const { return m_base + off; }
+    int count() const { return m_base ? header()->count : 0; }
+    size_t size() const { return m_size; }
+
+private:
+    const asset_pack_header* header() const { return (const asset_pack_header*)m_base; }
+    const asset_entry* entries() const { return (const asset_entry*)( m_base + sizeof(asset_pack_header) ); }
+    const uint32_t* buckets() const { return (const uint32_t*)( entries() + header()->count ); }
+    // 释放当前资源包
+    void release();
+
+private:
+    char* m_base;       // 资源包起始位置
+    size_t m_size;
+    bool m_mapped;      // 是 mmap 的文件还是自己申请的内存
+};
+
+#endif // ASSET_PACK_H
@@ -0,0 +1,6 @@
+
+HEADERS += \
+    $$PWD/body_handler.h
+
+SOURCES += \
+    $$PWD/body_handler.cpp
@@ -0,0 +1,113 @@
+#include "body_handler.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <atomic>
+
+chunk_buffer_handler::~chunk_buffer_handler()
+{
+    body_chunk* tmp = m_head;
+    while( tmp ) {
+        m_head = tmp->next;
+        delete tmp;
+        tmp = m_head;
+    }
+}
+
+bool chunk_buffer_handler::on_data(const char *data, size_t len)
+{
+    if( m_size + (long)len > m_max_size ) {     // 请求体过大
+        return false;
+    }
+    m_size += len;
+
+    while( len > 0 ) {
+        if( !m_tail || m_tail->len == body_chunk::CHUNK_SIZE ) {   // 当前块已满，再取一块
+            body_chunk* chunk = new body_chunk;
+            if( m_tail ) {
+                m_tail->next = chunk;
+            } else {
+                m_head = chunk;
+            }
+            m_tail = chunk;
+        }
+        size_t n = body_chunk::CHUNK_SIZE - m_tail->len;
+        if( n > len ) {
+            n = len;
+        }
+        memcpy( m_tail->data + m_tail->len, data, n );
+        m_tail->len += n;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+file_sink_handler::file_sink_handler(int dirfd, const char *name) : m_dirfd(dirfd), m_fd(-1)
+{
+    strncpy( m_name, name, sizeof(m_name) - 1 );
+    m_name[ sizeof(m_name) - 1 ] = '\0';
+    m_tmp_name[0] = '\0';
+}
+
+file_sink_handler::~file_sink_handler()
+{
+    if( m_fd != -1 ) {
+        close( m_fd );
+    }
+    if( m_tmp_name[0] ) {       // 请求体没有收完，丢掉临时文件，目标文件保持原样
+        unlinkat( m_dirfd, m_tmp_name, 0 );
+    }
+    close( m_dirfd );
+}
+
+bool file_sink_handler::on_begin(long)
+{
+    // 临时文件名以 '.' 开头，用 O_EXCL 创建，重名时换一个
+    static std::atomic<unsigned> s_seq( 0 );
+    for( int i = 0; i < 8; ++i ) {
+        unsigned seq = s_seq.fetch_add( 1, std::memory_order_relaxed );
+        int len = snprintf( m_tmp_name, sizeof(m_tmp_name), ".%s.%x.%x", m_name, (unsigned)getpid(), seq );
+        if( len >= (int)sizeof(m_tmp_name) ) {
+            break;
+        }
+        m_fd = openat( m_dirfd, m_tmp_name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644 );
+        if( m_fd != -1 ) {
+            return true;
+        }
+        if( errno != EEXIST ) {
+            break;
+        }
+    }
+    m_tmp_name[0] = '\0';
+    return false;
+}
+
+bool file_sink_handler::on_data(const char *data, size_t len)
+{
+    while( len > 0 ) {
+        ssize_t n = write( m_fd, data, len );
+        if( n < 0 ) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool file_sink_handler::on_end()
+{
+    int ret = close( m_fd );
+    m_fd = -1;
+    if( ret != 0 || renameat( m_dirfd, m_tmp_name, m_dirfd, m_name ) != 0 ) {
+        return false;           // 临时文件由析构函数删除
+    }
+    m_tmp_name[0] = '\0';
+    return true;
+}
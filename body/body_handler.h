@@ -0,0 +1,83 @@
+/*
+    请求体处理
+    请求体不再要求整体放进读缓冲区，而是边读边交给 body_handler 增量消费
+*/
+
+#ifndef BODY_HANDLER_H
+#define BODY_HANDLER_H
+
+#include <stddef.h>
+
+#include "memorypool/mem_pool.h"
+
+// 请求体处理器接口，每个带请求体的请求创建一个，请求结束后释放
+class body_handler
+{
+public:
+    virtual ~body_handler() {}
+
+    // 请求头解析完毕，开始接收请求体。content_length 为 -1 表示 chunked 编码，长度未知
+    virtual bool on_begin(long /* content_length */) { return true; }
+    // 收到一段请求体数据（已去掉 chunked 编码的分块头）
+    virtual bool on_data(const char* data, size_t len) = 0;
+    // 请求体接收完毕
+    virtual bool on_end() { return true; }
+
+    // 可以直接 splice 的目标文件描述符，-1 表示不支持，数据只能走 on_data
+    virtual int sink_fd() { return -1; }
+};
+
+// 请求体缓存块，从内存池分配
+struct body_chunk : public pool_allocated<body_chunk>
+{
+    static const int CHUNK_SIZE = 4096;
+
+    body_chunk() : next(NULL), len(0) {}
+
+    body_chunk* next;
+    int len;
+    char data[CHUNK_SIZE];
+};
+
+// 把请求体缓存到池化的块链表中，上层处理完请求后一起释放
+class chunk_buffer_handler : public body_handler, public pool_allocated<chunk_buffer_handler>
+{
+public:
+    chunk_buffer_handler(long max_size) : m_head(NULL), m_tail(NULL), m_size(0), m_max_size(max_size) {}
+    ~chunk_buffer_handler();
+
+    bool on_data(const char* data, size_t len);
+
+    body_chunk* chunks() { return m_head; }
+    long size() { return m_size; }
+
+private:
+    body_chunk* m_head;
+    body_chunk* m_tail;
+    long m_size;            // 已缓存的字节数
+    long m_max_size;        // 最多缓存的字节数，超过则拒绝
+};
+
+// 把请求体写入文件，非 chunked 时由连接直接 splice 到文件，不经过用户态。
+// 文件相对已经打开的目录 dirfd 创建：先写同目录下的临时文件，接收完整后再 renameat 成目标文件，
+// 中途失败不会留下不完整的文件；整个过程不再按路径解析目录，目录被换成符号链接也不会写到别处
+class file_sink_handler : public body_handler, public pool_allocated<file_sink_handler>
+{
+public:
+    // dirfd 归处理器所有，由析构函数关闭；name 是目录下的文件名，不含 '/'
+    file_sink_handler(int dirfd, const char* name);
+    ~file_sink_handler();
+
+    bool on_begin(long content_length);
+    bool on_data(const char* data, size_t len);
+    bool on_end();
+    int sink_fd() { return m_fd; }
+
+private:
+    int m_dirfd;
+    char m_name[256];
+    char m_tmp_name[ 256 + 16 ];    // 临时文件，为空表示没有（还没创建或者已经改名）
+    int m_fd;
+};
+
+#endif // BODY_HANDLER_H
@@ -0,0 +1,128 @@
+#include "co_http.h"
+
+#include <string.h>
+#include <memory>
+
+#include "http_conn.h"
+#include "admin/server_config.h"
+
+static const char continue_100[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+static uint64_t now_ms()
+{
+    return trace_now() / 1000000;
+}
+
+// 按阶段和当前的连接数（协程模式下所有连接都由 reactor 处理）计算的超时时间，毫秒
+static int phase_timeout_ms(co_conn* conn, int phase)
+{
+    return phase_timeout( phase, conn->reactor()->count() ) * 1000;
+}
+
+co_task co_serve_http(co_conn *conn)
+{
+    std::unique_ptr<http_conn> req( new http_conn );
+    req->init_stream( conn->addr() );
+    req->m_co = conn;
+
+    // 和定时器链表一样分阶段计时：等请求头的截止时间从 accept（或者长连接上新请求的第一个字节）算起，
+    // 读到数据也不推迟；接收请求体和空闲等待时每次读写各自计时
+    int phase = PHASE_HEADER;
+    uint64_t header_deadline = now_ms() + phase_timeout_ms( conn, PHASE_HEADER );
+
+    for ( ;; ) {
+        // 读到一个完整的请求为止，请求体由处理器边读边消费
+        http_conn::HTTP_CODE ret = http_conn::NO_REQUEST;
+        while ( ret == http_conn::NO_REQUEST ) {
+            if ( req->m_read_idx >= http_conn::READ_BUFFER_SIZE ) {
+                co_return;                          // 请求头太长，和 read() 一样直接关闭
+            }
+            if ( phase == PHASE_HEADER ) {
+                uint64_t now = now_ms();
+                if ( now >= header_deadline ) {
+                    co_return;                      // 请求头没有按时收完
+                }
+                conn->set_timeout( header_deadline - now );
+            } else {
+                conn->set_timeout( phase_timeout_ms( conn, phase ) );
+            }
+            ssize_t n = co_await conn->read( req->m_read_buf + req->m_read_idx,
+                                             http_conn::READ_BUFFER_SIZE - req->m_read_idx );
+            if ( n <= 0 ) {
+                co_return;                          // 对方关闭、出错或者超时
+            }
+            if ( phase == PHASE_IDLE ) {            // 空闲的长连接来了新请求，从现在开始等请求头
+                phase = PHASE_HEADER;
+                header_deadline = now_ms() + phase_timeout_ms( conn, PHASE_HEADER );
+            }
+            bool first = ( req->m_read_idx == 0 );
+            if ( first && access_log_enabled() ) {
+                req->m_request_start = trace_now();
+            }
+            req->m_read_idx += n;
+            // 和 read() 一样，每个新请求按客户端地址限速，超过的回 429 后关闭连接
+            if ( first && http_conn::m_limiter && !http_conn::m_limiter->allow( conn->addr().sin_addr.s_addr ) ) {
+                req->m_linger = false;
+                ret = http_conn::TOO_MANY_REQUESTS;
+                break;
+            }
+            ret = req->process_read();
+            if ( req->m_checked_state == http_conn::CHECK_STATE_CONTENT ) {
+                phase = PHASE_BODY;
+            }
+
+            // 客户端在等我们同意后才发送请求体
+            if ( ret == http_conn::NO_REQUEST && req->m_expect_continue
+                 && req->m_checked_state == http_conn::CHECK_STATE_CONTENT ) {
+                req->m_expect_continue = false;
+                struct iovec iv = { (void*)continue_100, sizeof( continue_100 ) - 1 };
+                if ( !co_await conn->write_all( &iv, 1 ) ) {
+                    co_return;
+                }
+            }
+        }
+        if ( ret == http_conn::PROXY_REQUEST ) {
+            ret = http_conn::INTERNAL_ERROR;        // 协程处理的连接不经过反向代理
+        }
+
+        if ( !req->process_write( ret ) ) {
+            co_return;
+        }
+        phase = PHASE_IDLE;                         // 发送响应和等待下一个请求按空闲计时
+        conn->set_timeout( phase_timeout_ms( conn, PHASE_IDLE ) );
+        long bytes = 0;
+        for ( int i = 0; i < req->m_iv_count; ++i ) {
+            bytes += req->m_iv[i].iov_len;
+        }
+        bool sent = true;
+        if ( req->m_file_fd != -1 && req->m_iv_count == 2 ) {
+            // 和 write() 一样，文件映射只发确认在页缓存中的部分，冷数据交给 I/O 线程读完再发，reactor 不等磁盘
+            while ( sent && ( req->m_iv[0].iov_len > 0 || req->m_iv[1].iov_len > 0 ) ) {
+                if ( req->m_iv[1].iov_len > 0 && !req->file_window_ready() ) {
+                    co_await conn->park();          // 读完后由 on_io_done 唤醒
+                }
+                struct iovec iv[2];
+                memcpy( iv, req->m_iv, sizeof( iv ) );
+                size_t ready = req->m_ready_end - (char*)iv[1].iov_base;
+                if ( iv[1].iov_len > ready ) {
+                    iv[1].iov_len = ready;
+                }
+                size_t file_part = iv[1].iov_len;
+                sent = co_await conn->write_all( iv, 2 );
+                req->m_iv[0].iov_len = 0;
+                req->m_iv[1].iov_base = (char*)req->m_iv[1].iov_base + file_part;
+                req->m_iv[1].iov_len -= file_part;
+            }
+        } else {
+            sent = co_await conn->write_all( req->m_iv, req->m_iv_count );
+        }
+        if ( sent ) {
+            req->log_access( bytes, ACCESS_CORO | ( req->m_linger ? ACCESS_KEEP_ALIVE : 0 ) );
+        }
+        req->unmap();
+        if ( !sent || !req->m_linger ) {
+            co_return;
+        }
+        req->init();
+    }
+}
@@ -0,0 +1,15 @@
+/*
+    协程处理的 HTTP/1.1 连接
+    解析和生成响应复用 http_conn 的状态机（和 HTTP/2 的流一样不带 socket），
+    读请求、发响应、等待下一个请求都写成顺序的代码，全部在 reactor 线程中完成，不经过线程池。
+*/
+
+#ifndef CO_HTTP_H
+#define CO_HTTP_H
+
+#include "coro/co_reactor.h"
+
+// 一个连接的处理协程
+co_task co_serve_http(co_conn* conn);
+
+#endif // CO_HTTP_H
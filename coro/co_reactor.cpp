@@ -0,0 +1,226 @@
+#include "co_reactor.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <exception>
+
+#include "log.h"
+#include "socket/socket_profile.h"
+
+//添加文件描述符到epoll中
+extern void addfd(int epollfd,int fd,bool one_shot,bool et);
+// 文件描述符设置非阻塞操作
+extern void setnonblocking(int fd);
+
+// 单调时钟，毫秒
+static uint64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+co_conn::co_conn(co_reactor *reactor, int fd, const sockaddr_in &addr)
+    : m_reactor(reactor), m_fd(fd), m_addr(addr), m_timeout_ms(0), m_wait_events(0), m_timed_out(false), m_timer_set(false)
+{
+}
+
+void co_conn::wait_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    conn->m_waiter = h;
+    conn->m_wait_events = events;
+    conn->m_timed_out = false;
+    if ( timeout_ms > 0 ) {
+        conn->m_reactor->arm_timer( conn, timeout_ms );
+    }
+}
+
+co_value<ssize_t> co_conn::read(char *buf, size_t len)
+{
+    for ( ;; ) {
+        ssize_t n = recv( m_fd, buf, len, 0 );
+        if ( n >= 0 || ( errno != EAGAIN && errno != EWOULDBLOCK ) ) {
+            co_return n;
+        }
+        if ( !co_await wait( EPOLLIN ) ) {
+            errno = ETIMEDOUT;
+            co_return -1;
+        }
+    }
+}
+
+co_value<bool> co_conn::write_all(iovec *iv, int count)
+{
+    for ( ;; ) {
+        while ( count > 0 && iv->iov_len == 0 ) {   // 跳过已经发完的内存块
+            ++iv;
+            --count;
+        }
+        if ( count == 0 ) {
+            co_return true;
+        }
+        ssize_t n = writev( m_fd, iv, count );
+        if ( n < 0 ) {
+            if ( errno != EAGAIN && errno != EWOULDBLOCK ) {
+                co_return false;
+            }
+            if ( !co_await wait( EPOLLOUT ) ) {
+                co_return false;
+            }
+            continue;
+        }
+        // 更新发了一部分的内存块
+        for ( int i = 0; i < count && n > 0; ++i ) {
+            if ( (size_t)n >= iv[i].iov_len ) {
+                n -= iv[i].iov_len;
+                iv[i].iov_len = 0;
+            } else {
+                iv[i].iov_base = (char*)iv[i].iov_base + n;
+                iv[i].iov_len -= n;
+                n = 0;
+            }
+        }
+    }
+}
+
+co_reactor::co_reactor(int epollfd, int max_fd)
+    : m_epollfd(epollfd), m_max_fd(max_fd), m_count(0), m_conns(max_fd, (co_conn*)NULL), m_timerfd_deadline(0)
+{
+    m_timerfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+    if ( m_timerfd < 0 ) {
+        throw std::exception();
+    }
+    addfd( m_epollfd, m_timerfd, false, false );
+}
+
+co_reactor::~co_reactor()
+{
+    // 销毁还挂起着的协程，协程帧中的局部对象随之析构
+    for ( int fd = 0; fd < m_max_fd; ++fd ) {
+        if ( m_conns[fd] ) {
+            finish( m_conns[fd] );
+        }
+    }
+    close( m_timerfd );
+}
+
+void co_reactor::start(int fd, const sockaddr_in &addr, co_handler handler)
+{
+    if ( fd < 0 || fd >= m_max_fd ) {
+        close( fd );
+        return;
+    }
+    apply_conn_profile( fd, g_socket_profile );
+    setnonblocking( fd );
+
+    // 边沿触发，读写都关注，之后不需要再修改
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    epoll_ctl( m_epollfd, EPOLL_CTL_ADD, fd, &event );
+
+    co_conn* c = new co_conn( this, fd, addr );
+    m_conns[fd] = c;
+    ++m_count;
+    c->m_task = handler( c ).release();
+    c->m_waiter = c->m_task;
+    resume( c );
+}
+
+void co_reactor::handle_event(int fd, unsigned events)
+{
+    co_conn* c = m_conns[fd];
+    // 没有在等 socket 的协程（比如正在 sleep_for）忽略这次通知，数据留在 socket 里，下次读写时会直接取到
+    if ( !c->m_waiter || !c->m_wait_events ) {
+        return;
+    }
+    if ( events & ( c->m_wait_events | EPOLLERR | EPOLLHUP | EPOLLRDHUP ) ) {
+        cancel_timer( c );
+        resume( c );
+    }
+}
+
+void co_reactor::wake(co_conn *c)
+{
+    // 在等 socket 或者 sleep_for 的协程不受影响
+    if ( c->m_waiter && !c->m_wait_events && !c->m_timer_set ) {
+        resume( c );
+    }
+}
+
+void co_reactor::on_timer()
+{
+    uint64_t expirations;
+    while ( ::read( m_timerfd, &expirations, sizeof( expirations ) ) > 0 ) {
+    }
+    m_timerfd_deadline = 0;
+
+    uint64_t now = now_ms();
+    while ( !m_timers.empty() && m_timers.begin()->first <= now ) {
+        co_conn* c = m_timers.begin()->second;
+        cancel_timer( c );
+        c->m_timed_out = true;
+        resume( c );
+    }
+    update_timerfd();
+}
+
+void co_reactor::resume(co_conn *c)
+{
+    std::coroutine_handle<> h = c->m_waiter;
+    c->m_waiter = nullptr;
+    c->m_wait_events = 0;
+    h.resume();
+    if ( c->m_task.done() ) {
+        finish( c );
+    } else {
+        update_timerfd();
+    }
+}
+
+void co_reactor::finish(co_conn *c)
+{
+    cancel_timer( c );
+    c->m_task.destroy();
+    epoll_ctl( m_epollfd, EPOLL_CTL_DEL, c->m_fd, 0 );
+    close( c->m_fd );
+    m_conns[ c->m_fd ] = NULL;
+    --m_count;
+    EMlog(LOGLEVEL_INFO, "coroutine conn fd %d closed, rest %d\n", c->m_fd, m_count);
+    delete c;
+}
+
+void co_reactor::arm_timer(co_conn *c, int ms)
+{
+    cancel_timer( c );
+    c->m_timer = m_timers.insert( std::make_pair( now_ms() + ms, c ) );
+    c->m_timer_set = true;
+}
+
+void co_reactor::cancel_timer(co_conn *c)
+{
+    if ( c->m_timer_set ) {
+        m_timers.erase( c->m_timer );
+        c->m_timer_set = false;
+    }
+}
+
+void co_reactor::update_timerfd()
+{
+    uint64_t deadline = m_timers.empty() ? 0 : m_timers.begin()->first;
+    if ( deadline == m_timerfd_deadline ) {
+        return;
+    }
+    // 没有等待中的超时时 it_value 为0，关掉 timerfd
+    struct itimerspec its;
+    memset( &its, 0, sizeof( its ) );
+    its.it_value.tv_sec = deadline / 1000;
+    its.it_value.tv_nsec = ( deadline % 1000 ) * 1000000;
+    timerfd_settime( m_timerfd, TFD_TIMER_ABSTIME, &its, NULL );
+    m_timerfd_deadline = deadline;
+}
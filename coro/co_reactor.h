@@ -0,0 +1,130 @@
+/*
+    协程 I/O 层
+    连接交给 co_reactor 后由一个协程处理，读写在 socket 暂时不可用时挂起协程，
+    epoll 报告就绪后由主线程的事件循环直接恢复，不经过线程池。
+    socket 以边沿触发同时关注读和写，只注册一次，不需要 EPOLLONESHOT 重新注册。
+    等待超时和 sleep_for 共用一个 timerfd，按最早的截止时间设置。
+*/
+
+#ifndef CO_REACTOR_H
+#define CO_REACTOR_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <coroutine>
+#include <map>
+#include <vector>
+
+#include "coro/co_task.h"
+#include "memorypool/mem_pool.h"
+
+class co_reactor;
+
+// 协程处理的一个连接
+class co_conn : public pool_allocated<co_conn>
+{
+    friend class co_reactor;
+public:
+    // 等待 socket 就绪或者超时
+    struct wait_awaiter
+    {
+        co_conn* conn;
+        unsigned events;    // 0 表示只等超时
+        int timeout_ms;     // 0 表示不超时
+
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> h);
+        // 返回false表示超时
+        bool await_resume() const { return !conn->m_timed_out; }
+    };
+
+    struct sleep_awaiter : public wait_awaiter
+    {
+        void await_resume() const {}
+    };
+
+    int fd() const { return m_fd; }
+    const sockaddr_in& addr() const { return m_addr; }
+    co_reactor* reactor() const { return m_reactor; }
+    // 读写等待的超时时间：毫秒，0 表示不超时
+    void set_timeout(int ms) { m_timeout_ms = ms; }
+
+    // 读到数据返回字节数，对方关闭返回0，出错或者超时返回-1（超时时errno为ETIMEDOUT）
+    co_value<ssize_t> read(char* buf, size_t len);
+    // 把 iv 中的数据全部发完返回true，出错或者超时返回false。iv 会被修改
+    co_value<bool> write_all(struct iovec* iv, int count);
+    // 挂起 ms 毫秒
+    sleep_awaiter sleep_for(int ms) { return sleep_awaiter{ { this, 0, ms } }; }
+    // 挂起到 co_reactor::wake 唤醒为止（比如等 I/O 线程把冷文件读进页缓存），不关注 socket，也不超时
+    wait_awaiter park() { return wait_awaiter{ this, 0, 0 }; }
+
+private:
+    co_conn(co_reactor* reactor, int fd, const sockaddr_in& addr);
+
+    wait_awaiter wait(unsigned events) { return wait_awaiter{ this, events, m_timeout_ms }; }
+
+private:
+    co_reactor* m_reactor;
+    int m_fd;
+    sockaddr_in m_addr;
+    int m_timeout_ms;
+
+    std::coroutine_handle<> m_task;     // 连接的处理协程
+    std::coroutine_handle<> m_waiter;   // 正在等待的协程（可能是 read 这样的子协程），没有等待时为空
+    unsigned m_wait_events;
+    bool m_timed_out;
+
+    bool m_timer_set;
+    std::multimap<uint64_t, co_conn*>::iterator m_timer;
+};
+
+// 连接的处理函数
+typedef co_task (*co_handler)(co_conn* conn);
+
+// 每个 reactor 一个，只在 reactor 线程（主线程）中调用
+class co_reactor
+{
+    friend class co_conn;
+public:
+    co_reactor(int epollfd, int max_fd);
+    ~co_reactor();
+
+    // 接管一个新连接，启动处理协程。协程结束后关闭连接
+    void start(int fd, const sockaddr_in& addr, co_handler handler);
+
+    bool owns(int fd) const { return fd >= 0 && fd < m_max_fd && m_conns[fd]; }
+    // 连接上的 epoll 事件
+    void handle_event(int fd, unsigned events);
+
+    // 唤醒 park 中的协程
+    void wake(co_conn* c);
+
+    int timer_fd() const { return m_timerfd; }
+    // timerfd 到期，恢复超时的协程
+    void on_timer();
+
+    int count() const { return m_count; }
+
+private:
+    // 恢复等待中的协程，处理协程结束后关闭连接
+    void resume(co_conn* c);
+    void finish(co_conn* c);
+
+    void arm_timer(co_conn* c, int ms);
+    void cancel_timer(co_conn* c);
+    // 按最早的截止时间设置 timerfd
+    void update_timerfd();
+
+private:
+    int m_epollfd;
+    int m_max_fd;
+    int m_timerfd;
+    int m_count;
+    std::vector<co_conn*> m_conns;                  // fd -> 连接
+    std::multimap<uint64_t, co_conn*> m_timers;     // 截止时间（毫秒，单调时钟）-> 连接
+    uint64_t m_timerfd_deadline;                    // timerfd 当前设置的截止时间，0 表示没有设置
+};
+
+#endif // CO_REACTOR_H
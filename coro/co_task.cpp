@@ -0,0 +1,40 @@
+#include "co_task.h"
+
+#include "log.h"
+#include "memorypool/mem_pool.h"
+
+// 协程帧按大小分档，每档一个内存池
+template<size_t N>
+struct co_frame_block
+{
+    alignas( __STDCPP_DEFAULT_NEW_ALIGNMENT__ ) char data[ N ];
+};
+
+void* co_frame_alloc(size_t size)
+{
+    if ( size <= 256 ) return mem_pool< co_frame_block<256> >::alloc();
+    if ( size <= 512 ) return mem_pool< co_frame_block<512> >::alloc();
+    if ( size <= 1024 ) return mem_pool< co_frame_block<1024> >::alloc();
+    if ( size <= 2048 ) return mem_pool< co_frame_block<2048> >::alloc();
+    return ::operator new( size );
+}
+
+void co_frame_free(void* p, size_t size)
+{
+    if ( size <= 256 ) mem_pool< co_frame_block<256> >::free( p );
+    else if ( size <= 512 ) mem_pool< co_frame_block<512> >::free( p );
+    else if ( size <= 1024 ) mem_pool< co_frame_block<1024> >::free( p );
+    else if ( size <= 2048 ) mem_pool< co_frame_block<2048> >::free( p );
+    else ::operator delete( p );
+}
+
+void co_task::promise_type::unhandled_exception()
+{
+    try {
+        std::rethrow_exception( std::current_exception() );
+    } catch ( const std::exception& e ) {
+        EMlog(LOGLEVEL_ERROR, "coroutine handler failed: %s\n", e.what());
+    } catch ( ... ) {
+        EMlog(LOGLEVEL_ERROR, "coroutine handler failed.\n");
+    }
+}
@@ -0,0 +1,103 @@
+/*
+    协程的返回类型
+    co_task：连接的处理函数，由 co_reactor 启动和恢复，结束后由 co_reactor 销毁并关闭连接。
+    co_value<T>：可以被 co_await 的子协程（比如 co_conn::read），结束时直接切回等待它的协程，不经过 reactor。
+    协程帧按大小分档从内存池分配，连接频繁建立和关闭时不调用 malloc/free。
+*/
+
+#ifndef CO_TASK_H
+#define CO_TASK_H
+
+#include <stddef.h>
+#include <coroutine>
+#include <exception>
+
+// 协程帧的分配，超过最大一档的直接用 operator new
+void* co_frame_alloc(size_t size);
+void co_frame_free(void* p, size_t size);
+
+// promise 继承它，协程帧从内存池中分配
+struct co_frame_allocated
+{
+    static void* operator new(size_t size) { return co_frame_alloc( size ); }
+    static void operator delete(void* p, size_t size) { co_frame_free( p, size ); }
+};
+
+class co_task
+{
+public:
+    struct promise_type : public co_frame_allocated
+    {
+        co_task get_return_object() { return co_task( std::coroutine_handle<promise_type>::from_promise( *this ) ); }
+        // 创建后先挂起，由 reactor 记下句柄后再开始运行
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        // 结束后挂起，reactor 看到 done() 后销毁
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        // 处理函数抛出的异常只记录日志，连接随之关闭
+        void unhandled_exception();
+    };
+
+    explicit co_task(std::coroutine_handle<promise_type> h) : m_handle( h ) {}
+    co_task(co_task&& other) : m_handle( other.m_handle ) { other.m_handle = nullptr; }
+    co_task(const co_task&) = delete;
+    co_task& operator=(const co_task&) = delete;
+    ~co_task() { if ( m_handle ) m_handle.destroy(); }
+
+    // 把协程交给调用者管理
+    std::coroutine_handle<> release() { std::coroutine_handle<> h = m_handle; m_handle = nullptr; return h; }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template<typename T>
+class co_value
+{
+public:
+    struct promise_type : public co_frame_allocated
+    {
+        T value{};
+        std::coroutine_handle<> continuation;       // 等待结果的协程
+        std::exception_ptr error;
+
+        co_value get_return_object() { return co_value( std::coroutine_handle<promise_type>::from_promise( *this ) ); }
+        // 在被 co_await 时才开始运行
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        // 结束时切回等待者
+        struct final_awaiter
+        {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept { return h.promise().continuation; }
+            void await_resume() noexcept {}
+        };
+        final_awaiter final_suspend() noexcept { return {}; }
+        void return_value(T v) { value = v; }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    explicit co_value(std::coroutine_handle<promise_type> h) : m_handle( h ) {}
+    co_value(co_value&& other) : m_handle( other.m_handle ) { other.m_handle = nullptr; }
+    co_value(const co_value&) = delete;
+    co_value& operator=(const co_value&) = delete;
+    ~co_value() { if ( m_handle ) m_handle.destroy(); }
+
+    bool await_ready() const { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller)
+    {
+        m_handle.promise().continuation = caller;
+        return m_handle;
+    }
+    T await_resume()
+    {
+        if ( m_handle.promise().error ) {
+            std::rethrow_exception( m_handle.promise().error );
+        }
+        return m_handle.promise().value;
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+#endif // CO_TASK_H
@@ -0,0 +1,10 @@
+
+HEADERS += \
+    $$PWD/co_task.h \
+    $$PWD/co_reactor.h \
+    $$PWD/co_http.h
+
+SOURCES += \
+    $$PWD/co_task.cpp \
+    $$PWD/co_reactor.cpp \
+    $$PWD/co_http.cpp
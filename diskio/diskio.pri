@@ -0,0 +1,6 @@
+
+HEADERS += \
+    $$PWD/io_pool.h
+
+SOURCES += \
+    $$PWD/io_pool.cpp
@@ -0,0 +1,187 @@
+#include "io_pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <exception>
+
+#include "log.h"
+
+//添加文件描述符到epoll中
+extern void addfd(int epollfd,int fd,bool one_shot,bool et);
+//删除文件描述符
+extern void removefd(int epollfd,int fd);
+
+io_pool::io_pool(int epollfd, int threads, done_fn done)
+    : m_epollfd(epollfd), m_done(done), m_lock( "io queue" ), m_queuestat( 0, "io sem" ), m_stop(false), m_vec( WINDOW / 4096 + 2 ), m_probe( WINDOW ),
+      m_checks(0), m_cold(0), m_probe_hits(0), m_bytes(0)
+{
+    m_wakefd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if( m_wakefd < 0 ) {
+        throw std::exception();
+    }
+    for( int i = 0; i < threads; ++i ) {
+        pthread_t tid;
+        if( pthread_create( &tid, NULL, worker, this ) != 0 ) {
+            break;
+        }
+        m_threads.push_back( tid );
+    }
+    if( m_threads.empty() ) {
+        close( m_wakefd );
+        throw std::exception();
+    }
+    addfd( m_epollfd, m_wakefd, false, false );
+}
+
+io_pool::~io_pool()
+{
+    m_lock.lock();
+    m_stop = true;
+    m_lock.unlock();
+    for( size_t i = 0; i < m_threads.size(); ++i ) {
+        m_queuestat.post();
+    }
+    for( size_t i = 0; i < m_threads.size(); ++i ) {
+        pthread_join( m_threads[i], NULL );
+    }
+    // 没读的和读完没回调的都不再处理
+    for( std::list<job>::iterator it = m_queue.begin(); it != m_queue.end(); ++it ) {
+        close( it->fd );
+    }
+    removefd( m_epollfd, m_wakefd );
+}
+
+bool io_pool::resident(int fd, off_t off, const char *addr, size_t len)
+{
+    ++m_checks;
+    long page = sysconf( _SC_PAGESIZE );
+    uintptr_t begin = (uintptr_t)addr & ~( page - 1 );
+    uintptr_t end = (uintptr_t)addr + len;
+    size_t pages = ( end - begin + page - 1 ) / page;
+    if( pages > m_vec.size() ) {
+        m_vec.resize( pages );
+    }
+    size_t first_missing = pages;
+    if( mincore( (void*)begin, end - begin, m_vec.data() ) == 0 ) {
+        for( size_t i = 0; i < pages; ++i ) {
+            if( !( m_vec[i] & 1 ) ) {
+                first_missing = i;
+                break;
+            }
+        }
+        if( first_missing == pages ) {
+            return true;
+        }
+    } else {
+        first_missing = 0;
+    }
+
+    // 从第一个不在的页开始，不等待磁盘地读一遍，读全了说明都在页缓存中
+    size_t skip = first_missing ? begin + first_missing * page - (uintptr_t)addr : 0;
+    size_t want = len - skip;
+    if( want > m_probe.size() ) {
+        m_probe.resize( want );
+    }
+    struct iovec iv = { m_probe.data(), want };
+    ssize_t n = preadv2( fd, &iv, 1, off + skip, RWF_NOWAIT );
+    if( n == (ssize_t)want ) {
+        ++m_probe_hits;
+        return true;
+    }
+    ++m_cold;
+    return false;
+}
+
+bool io_pool::submit(int fd, off_t off, size_t len, void *owner, unsigned generation)
+{
+    job j = { fcntl( fd, F_DUPFD_CLOEXEC, 0 ), off, len, owner, generation };
+    if( j.fd < 0 ) {
+        return false;
+    }
+    m_lock.lock();
+    m_queue.push_back( j );
+    m_lock.unlock();
+    m_queuestat.post();
+    return true;
+}
+
+void io_pool::on_wakeup()
+{
+    uint64_t cnt;
+    if( read( m_wakefd, &cnt, sizeof(cnt) ) < 0 && errno != EAGAIN ) {
+        EMlog(LOGLEVEL_WARN, "io pool wakeup read failed: %s\n", strerror(errno));
+    }
+
+    std::list<job> finished;
+    m_lock.lock();
+    finished.swap( m_finished );
+    m_lock.unlock();
+
+    for( std::list<job>::iterator it = finished.begin(); it != finished.end(); ++it ) {
+        m_done( it->owner, it->generation );
+    }
+}
+
+void *io_pool::worker(void *arg)
+{
+    io_pool* pool = (io_pool*)arg;
+    pool->run();
+    return pool;
+}
+
+void io_pool::run()
+{
+    std::vector<char> buf( WINDOW );
+    while( true ) {
+        m_queuestat.wait();
+        m_lock.lock();
+        if( m_stop ) {
+            m_lock.unlock();
+            break;
+        }
+        if( m_queue.empty() ) {
+            m_lock.unlock();
+            continue;
+        }
+        job j = m_queue.front();
+        m_queue.pop_front();
+        m_lock.unlock();
+
+        // 先让内核对整个范围发起预读，再同步读一遍，读完时数据都在页缓存中了
+        posix_fadvise( j.fd, j.off, j.len, POSIX_FADV_WILLNEED );
+        size_t done = 0;
+        while( done < j.len ) {
+            size_t n = j.len - done < buf.size() ? j.len - done : buf.size();
+            ssize_t ret = pread( j.fd, buf.data(), n, j.off + done );
+            if( ret <= 0 ) {
+                if( ret < 0 && errno == EINTR ) {
+                    continue;
+                }
+                break;          // 出错或者文件被截短，交给发送时处理
+            }
+            done += ret;
+        }
+        close( j.fd );
+        m_bytes.fetch_add( done, std::memory_order_relaxed );
+
+        m_lock.lock();
+        m_finished.push_back( j );
+        m_lock.unlock();
+        uint64_t one = 1;
+        if( write( m_wakefd, &one, sizeof(one) ) < 0 ) {
+            EMlog(LOGLEVEL_WARN, "io pool wakeup failed: %s\n", strerror(errno));
+        }
+    }
+}
+
+void io_pool::report() const
+{
+    EMlog(LOGLEVEL_INFO, "io pool: %ld windows checked, %ld cold (%ld bytes read), %ld found cached by RWF_NOWAIT\n",
+          m_checks, m_cold, bytes_read(), m_probe_hits);
+}
@@ -0,0 +1,85 @@
+/*
+    冷文件的磁盘读取
+    响应从文件的 mmap 发送时，writev 碰到不在页缓存中的页会同步读盘，主线程在这期间处理不了任何连接。
+    主线程每次从映射发送前先检查接下来一个窗口（WINDOW）的页是否都在页缓存中：
+        先用 mincore 看映射的页；有不在的，再用 preadv2(RWF_NOWAIT) 读一遍确认（对不属于自己的文件，
+        mincore 只报告本进程已经映射过的页，页缓存中有但还没映射的也会报告为不在）。
+    确认是冷数据就交给 I/O 线程用普通的 pread 读进页缓存，连接暂停发送；读完后通过 eventfd 唤醒主线程，
+    主线程回调 done，连接重新注册 EPOLLOUT 继续发送，这时 writev 只会遇到页缓存命中的缺页。
+*/
+
+#ifndef IO_POOL_H
+#define IO_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <atomic>
+#include <list>
+#include <vector>
+
+#include "locker.h"
+
+class io_pool
+{
+public:
+    static const size_t WINDOW = 256 * 1024;    // 一次检查和预读的大小
+
+    // 读完后在主线程中回调，owner 和 generation 是提交时传入的
+    typedef void (*done_fn)(void* owner, unsigned generation);
+
+    io_pool(int epollfd, int threads, done_fn done);
+    ~io_pool();
+
+    // 主线程调用：映射 addr 处的 len 字节（对应文件 fd 的 off 处）是否都在页缓存中
+    bool resident(int fd, off_t off, const char* addr, size_t len);
+    // 把文件 fd 的 [off, off+len) 读进页缓存，完成后回调 done(owner, generation)。fd 会被复制，调用者可以随时关闭
+    bool submit(int fd, off_t off, size_t len, void* owner, unsigned generation);
+
+    int wakeup_fd() const { return m_wakefd; }
+    // 主线程被唤醒，回调完成的读取
+    void on_wakeup();
+
+    // 输出冷热统计
+    void report() const;
+    long checks() const { return m_checks; }
+    long cold() const { return m_cold; }
+    long probe_hits() const { return m_probe_hits; }
+    long bytes_read() const { return m_bytes.load( std::memory_order_relaxed ); }
+
+private:
+    struct job
+    {
+        int fd;
+        off_t off;
+        size_t len;
+        void* owner;
+        unsigned generation;
+    };
+
+    static void* worker(void* arg);
+    void run();
+
+private:
+    int m_epollfd;
+    int m_wakefd;
+    done_fn m_done;
+    std::vector<pthread_t> m_threads;
+
+    std::list<job> m_queue;         // 待读取
+    std::list<job> m_finished;      // 读完、等主线程回调
+    locker m_lock;
+    sem m_queuestat;
+    bool m_stop;
+
+    std::vector<unsigned char> m_vec;   // mincore 的结果，只在主线程中使用
+    std::vector<char> m_probe;          // preadv2 的缓冲区，只在主线程中使用
+
+    // 统计，前三个只在主线程中修改
+    long m_checks;                  // 检查的窗口数
+    long m_cold;                    // 交给 I/O 线程的窗口数
+    long m_probe_hits;              // mincore 报告不在、preadv2 确认在页缓存中的窗口数
+    std::atomic<long> m_bytes;      // I/O 线程读取的字节数
+};
+
+#endif // IO_POOL_H
@@ -0,0 +1,8 @@
+
+HEADERS += \
+    $$PWD/hpack.h \
+    $$PWD/h2_session.h
+
+SOURCES += \
+    $$PWD/hpack.cpp \
+    $$PWD/h2_session.cpp
@@ -0,0 +1,795 @@
+#include "h2_session.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "http_conn.h"
+
+const char h2_session::PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+// 帧标志
+enum { FLAG_END_STREAM = 0x1, FLAG_ACK = 0x1, FLAG_END_HEADERS = 0x4, FLAG_PADDED = 0x8, FLAG_PRIORITY = 0x20 };
+
+// SETTINGS 参数
+enum { SETTINGS_HEADER_TABLE_SIZE = 1, SETTINGS_ENABLE_PUSH, SETTINGS_MAX_CONCURRENT_STREAMS,
+       SETTINGS_INITIAL_WINDOW_SIZE, SETTINGS_MAX_FRAME_SIZE, SETTINGS_MAX_HEADER_LIST_SIZE };
+
+static uint32_t read_u32(const unsigned char* p)
+{
+    return ( (uint32_t)p[0] << 24 ) | ( (uint32_t)p[1] << 16 ) | ( (uint32_t)p[2] << 8 ) | p[3];
+}
+
+static void write_frame_header(char* p, uint8_t type, uint8_t flags, uint32_t stream_id, uint32_t len)
+{
+    p[0] = ( len >> 16 ) & 0xff;
+    p[1] = ( len >> 8 ) & 0xff;
+    p[2] = len & 0xff;
+    p[3] = type;
+    p[4] = flags;
+    p[5] = ( stream_id >> 24 ) & 0x7f;
+    p[6] = ( stream_id >> 16 ) & 0xff;
+    p[7] = ( stream_id >> 8 ) & 0xff;
+    p[8] = stream_id & 0xff;
+}
+
+// HTTP2-Settings 是 base64url 编码（不带填充）的 SETTINGS 帧负载
+static bool base64url_decode(const char* s, std::string& out)
+{
+    uint32_t acc = 0;
+    int bits = 0;
+    for( ; *s && *s != '=' && !isspace( (unsigned char)*s ); ++s ) {
+        int v;
+        char c = *s;
+        if( c >= 'A' && c <= 'Z' ) v = c - 'A';
+        else if( c >= 'a' && c <= 'z' ) v = c - 'a' + 26;
+        else if( c >= '0' && c <= '9' ) v = c - '0' + 52;
+        else if( c == '-' || c == '+' ) v = 62;
+        else if( c == '_' || c == '/' ) v = 63;
+        else return false;
+        acc = ( acc << 6 ) | v;
+        bits += 6;
+        if( bits >= 8 ) {
+            bits -= 8;
+            out.push_back( (char)( ( acc >> bits ) & 0xff ) );
+        }
+    }
+    return true;
+}
+
+h2_stream::h2_stream(uint32_t id, int32_t window)
+    : id(id), end_stream(false), send_window(window), req(NULL), body_iv_count(0), body_iv_idx(0),
+      start(access_log_enabled() ? trace_now() : 0), sent(0)
+{
+}
+
+h2_stream::~h2_stream()
+{
+    delete req;         // 析构时释放 mmap 的文件
+}
+
+h2_session::h2_session(http_conn *conn)
+    : m_conn(conn), m_preface_left(PREFACE_LEN), m_header_stream(0), m_header_end_stream(false), m_header_new(false),
+      m_last_stream_id(0), m_goaway(false), m_send_window(DEFAULT_WINDOW), m_peer_initial_window(DEFAULT_WINDOW),
+      m_peer_max_frame(MAX_FRAME_SIZE), m_iov_idx(0)
+{
+    queue_settings();
+}
+
+h2_session::~h2_session()
+{
+    for( std::map<uint32_t, h2_stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it ) {
+        delete it->second;
+    }
+    for( size_t i = 0; i < m_closing.size(); ++i ) {
+        delete m_closing[i];
+    }
+}
+
+int h2_session::check_preface(const char *data, int len)
+{
+    int n = len < PREFACE_LEN ? len : PREFACE_LEN;
+    if( memcmp( data, PREFACE, n ) != 0 ) {
+        return -1;
+    }
+    return n == PREFACE_LEN ? 1 : 0;
+}
+
+bool h2_session::upgrade(const char *settings_b64, const std::vector<hpack_header> &request)
+{
+    // 101 要在服务端的 SETTINGS 之前发出
+    m_out.insert( 0, "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n" );
+
+    // 101 就是对这些设置的确认，不再回 SETTINGS ACK
+    std::string payload;
+    if( !base64url_decode( settings_b64, payload ) || payload.size() % 6 != 0
+        || apply_settings( (const unsigned char*)payload.data(), payload.size() ) != H2_NO_ERROR ) {
+        return false;
+    }
+
+    // 升级前的请求是流1，客户端那边已经发完了
+    h2_stream* s = new h2_stream( 1, m_peer_initial_window );
+    s->headers = request;
+    s->end_stream = true;
+    m_streams[1] = s;
+    m_last_stream_id = 1;
+    respond( s );
+    return true;
+}
+
+bool h2_session::on_data(const char *data, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)data;
+
+    if( m_preface_left > 0 ) {
+        size_t n = len < (size_t)m_preface_left ? len : m_preface_left;
+        if( memcmp( p, PREFACE + PREFACE_LEN - m_preface_left, n ) != 0 ) {
+            return connection_error( H2_PROTOCOL_ERROR );
+        }
+        p += n;
+        len -= n;
+        m_preface_left -= n;
+    }
+
+    while( len > 0 ) {
+        if( !m_partial.empty() || len < (size_t)FRAME_HEADER_LEN ) {
+            // 上次剩下了半个帧，先凑够帧头，再凑够负载
+            if( m_partial.size() < (size_t)FRAME_HEADER_LEN ) {
+                size_t n = FRAME_HEADER_LEN - m_partial.size();
+                n = n < len ? n : len;
+                m_partial.append( (const char*)p, n );
+                p += n;
+                len -= n;
+                if( m_partial.size() < (size_t)FRAME_HEADER_LEN ) {
+                    break;
+                }
+            }
+            const unsigned char* h = (const unsigned char*)m_partial.data();
+            uint32_t flen = ( h[0] << 16 ) | ( h[1] << 8 ) | h[2];
+            if( flen > MAX_FRAME_SIZE ) {
+                return connection_error( H2_FRAME_SIZE_ERROR );
+            }
+            size_t n = FRAME_HEADER_LEN + flen - m_partial.size();
+            n = n < len ? n : len;
+            m_partial.append( (const char*)p, n );
+            p += n;
+            len -= n;
+            if( m_partial.size() < FRAME_HEADER_LEN + flen ) {
+                break;
+            }
+            std::string frame;
+            frame.swap( m_partial );
+            h = (const unsigned char*)frame.data();
+            if( !on_frame( h[3], h[4], read_u32( h + 5 ) & 0x7fffffff, h + FRAME_HEADER_LEN, flen ) ) {
+                return false;
+            }
+            continue;
+        }
+
+        // 完整的帧直接在读缓冲区里处理
+        uint32_t flen = ( p[0] << 16 ) | ( p[1] << 8 ) | p[2];
+        if( flen > MAX_FRAME_SIZE ) {
+            return connection_error( H2_FRAME_SIZE_ERROR );
+        }
+        if( len < FRAME_HEADER_LEN + flen ) {
+            m_partial.assign( (const char*)p, len );
+            break;
+        }
+        if( !on_frame( p[3], p[4], read_u32( p + 5 ) & 0x7fffffff, p + FRAME_HEADER_LEN, flen ) ) {
+            return false;
+        }
+        p += FRAME_HEADER_LEN + flen;
+        len -= FRAME_HEADER_LEN + flen;
+    }
+    return true;
+}
+
+bool h2_session::on_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const unsigned char *payload, uint32_t len)
+{
+    // 头部块必须连续，中间不能插入其他帧
+    if( m_header_stream && type != H2_CONTINUATION ) {
+        return connection_error( H2_PROTOCOL_ERROR );
+    }
+
+    switch( type ) {
+        case H2_DATA:
+            return on_data_frame( flags, stream_id, payload, len );
+        case H2_HEADERS:
+            return on_headers( flags, stream_id, payload, len );
+        case H2_PRIORITY:
+            // 不按优先级调度，所有流轮流发送
+            if( stream_id == 0 ) {
+                return connection_error( H2_PROTOCOL_ERROR );
+            }
+            return true;
+        case H2_RST_STREAM:
+        {
+            if( stream_id == 0 ) {
+                return connection_error( H2_PROTOCOL_ERROR );
+            }
+            if( len != 4 ) {
+                return connection_error( H2_FRAME_SIZE_ERROR );
+            }
+            std::map<uint32_t, h2_stream*>::iterator it = m_streams.find( stream_id );
+            if( it != m_streams.end() ) {
+                close_stream( it->second );
+            }
+            return true;
+        }
+        case H2_SETTINGS:
+            return on_settings( flags, stream_id, payload, len );
+        case H2_PING:
+            if( stream_id != 0 ) {
+                return connection_error( H2_PROTOCOL_ERROR );
+            }
+            if( len != 8 ) {
+                return connection_error( H2_FRAME_SIZE_ERROR );
+            }
+            if( !( flags & FLAG_ACK ) ) {
+                queue_frame_header( H2_PING, FLAG_ACK, 0, 8 );
+                m_out.append( (const char*)payload, 8 );
+            }
+            return true;
+        case H2_GOAWAY:
+            // 客户端不再发起新的流，已有的流继续完成，之后由客户端关闭连接
+            if( stream_id != 0 ) {
+                return connection_error( H2_PROTOCOL_ERROR );
+            }
+            return true;
+        case H2_WINDOW_UPDATE:
+            return on_window_update( stream_id, payload, len );
+        case H2_CONTINUATION:
+            if( !m_header_stream || stream_id != m_header_stream ) {
+                return connection_error( H2_PROTOCOL_ERROR );
+            }
+            m_header_block.append( (const char*)payload, len );
+            if( m_header_block.size() > MAX_HEADER_BLOCK ) {
+                return connection_error( H2_ENHANCE_YOUR_CALM );
+            }
+            if( flags & FLAG_END_HEADERS ) {
+                return on_header_block_end();
+            }
+            return true;
+        case H2_PUSH_PROMISE:       // 客户端不能推送
+            return connection_error( H2_PROTOCOL_ERROR );
+        default:                    // 未知类型的帧忽略
+            return true;
+    }
+}
+
+bool h2_session::on_headers(uint8_t flags, uint32_t stream_id, const unsigned char *payload, uint32_t len)
+{
+    if( stream_id == 0 || !( stream_id & 1 ) ) {
+        return connection_error( H2_PROTOCOL_ERROR );
+    }
+    uint32_t pos = 0, pad = 0;
+    if( flags & FLAG_PADDED ) {
+        if( len < 1 ) {
+            return connection_error( H2_FRAME_SIZE_ERROR );
+        }
+        pad = payload[0];
+        pos = 1;
+    }
+    if( flags & FLAG_PRIORITY ) {
+        pos += 5;
+    }
+    if( pos + pad > len ) {
+        return connection_error( H2_PROTOCOL_ERROR );
+    }
+
+    m_header_new = stream_id > m_last_stream_id;
+    if( m_header_new ) {
+        m_last_stream_id = stream_id;
+    }
+    m_header_stream = stream_id;
+    m_header_end_stream = flags & FLAG_END_STREAM;
+    m_header_block.assign( (const char*)payload + pos, len - pos - pad );
+    if( flags & FLAG_END_HEADERS ) {
+        return on_header_block_end();
+    }
+    return true;
+}
+
+bool h2_session::on_header_block_end()
+{
+    uint32_t id = m_header_stream;
+    m_header_stream = 0;
+
+    // 即使要拒绝这个流，也必须解码，否则动态表和客户端不一致
+    std::vector<hpack_header> headers;
+    bool ok = m_decoder.decode( (const unsigned char*)m_header_block.data(), m_header_block.size(), headers );
+    m_header_block.clear();
+    if( !ok ) {
+        return connection_error( H2_COMPRESSION_ERROR );
+    }
+
+    std::map<uint32_t, h2_stream*>::iterator it = m_streams.find( id );
+    if( !m_header_new ) {
+        // 已有的流上的第二个头部块只能是请求体之后的 trailer
+        if( it == m_streams.end() ) {
+            return connection_error( H2_STREAM_CLOSED );
+        }
+        h2_stream* s = it->second;
+        if( !m_header_end_stream || s->end_stream ) {
+            return connection_error( H2_PROTOCOL_ERROR );
+        }
+        s->end_stream = true;
+        respond( s );
+        return true;
+    }
+
+    if( m_goaway || m_streams.size() >= MAX_STREAMS ) {
+        queue_rst_stream( id, H2_REFUSED_STREAM );
+        return true;
+    }
+    h2_stream* s = new h2_stream( id, m_peer_initial_window );
+    s->headers.swap( headers );
+    s->end_stream = m_header_end_stream;
+    m_streams[id] = s;
+    if( s->end_stream ) {
+        respond( s );
+    }
+    return true;
+}
+
+bool h2_session::on_data_frame(uint8_t flags, uint32_t stream_id, const unsigned char *payload, uint32_t len)
+{
+    if( stream_id == 0 ) {
+        return connection_error( H2_PROTOCOL_ERROR );
+    }
+    uint32_t pos = 0, pad = 0;
+    if( flags & FLAG_PADDED ) {
+        if( len < 1 ) {
+            return connection_error( H2_FRAME_SIZE_ERROR );
+        }
+        pad = payload[0];
+        pos = 1;
+    }
+    if( pos + pad > len ) {
+        return connection_error( H2_PROTOCOL_ERROR );
+    }
+
+    // 流量控制：数据（包括填充）收下后马上归还连接级窗口，请求体大小另有上限
+    if( len > 0 ) {
+        queue_window_update( 0, len );
+    }
+
+    std::map<uint32_t, h2_stream*>::iterator it = m_streams.find( stream_id );
+    if( it == m_streams.end() || it->second->end_stream ) {
+        if( stream_id > m_last_stream_id ) {    // 还没打开的流
+            return connection_error( H2_PROTOCOL_ERROR );
+        }
+        queue_rst_stream( stream_id, H2_STREAM_CLOSED );
+        return true;
+    }
+
+    h2_stream* s = it->second;
+    uint32_t n = len - pos - pad;
+    if( s->body.size() + n > (size_t)http_conn::MAX_BUFFERED_BODY ) {
+        queue_rst_stream( stream_id, H2_REFUSED_STREAM );
+        close_stream( s );
+        return true;
+    }
+    s->body.append( (const char*)payload + pos, n );
+
+    if( flags & FLAG_END_STREAM ) {
+        s->end_stream = true;
+        respond( s );
+    } else if( len > 0 ) {
+        queue_window_update( stream_id, len );
+    }
+    return true;
+}
+
+uint32_t h2_session::apply_settings(const unsigned char *payload, uint32_t len)
+{
+    for( uint32_t i = 0; i + 6 <= len; i += 6 ) {
+        uint16_t id = ( payload[i] << 8 ) | payload[i + 1];
+        uint32_t value = read_u32( payload + i + 2 );
+        switch( id ) {
+            case SETTINGS_ENABLE_PUSH:
+                if( value > 1 ) {
+                    return H2_PROTOCOL_ERROR;
+                }
+                break;
+            case SETTINGS_INITIAL_WINDOW_SIZE:
+            {
+                if( value > 0x7fffffff ) {
+                    return H2_FLOW_CONTROL_ERROR;
+                }
+                // 已有流的发送窗口一起调整
+                int64_t delta = (int64_t)value - m_peer_initial_window;
+                for( std::map<uint32_t, h2_stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it ) {
+                    int64_t w = it->second->send_window + delta;
+                    if( w > 0x7fffffff ) {
+                        return H2_FLOW_CONTROL_ERROR;
+                    }
+                    it->second->send_window = (int32_t)w;
+                }
+                m_peer_initial_window = (int32_t)value;
+                break;
+            }
+            case SETTINGS_MAX_FRAME_SIZE:
+                if( value < MAX_FRAME_SIZE || value > 0xffffff ) {
+                    return H2_PROTOCOL_ERROR;
+                }
+                m_peer_max_frame = value;
+                break;
+            default:        // 编码器不用动态表，HEADER_TABLE_SIZE 不影响我们；其余参数和服务端无关
+                break;
+        }
+    }
+    return H2_NO_ERROR;
+}
+
+bool h2_session::on_settings(uint8_t flags, uint32_t stream_id, const unsigned char *payload, uint32_t len)
+{
+    if( stream_id != 0 ) {
+        return connection_error( H2_PROTOCOL_ERROR );
+    }
+    if( flags & FLAG_ACK ) {
+        return len == 0 ? true : connection_error( H2_FRAME_SIZE_ERROR );
+    }
+    if( len % 6 != 0 ) {
+        return connection_error( H2_FRAME_SIZE_ERROR );
+    }
+    uint32_t err = apply_settings( payload, len );
+    if( err != H2_NO_ERROR ) {
+        return connection_error( err );
+    }
+    queue_frame_header( H2_SETTINGS, FLAG_ACK, 0, 0 );
+    return true;
+}
+
+bool h2_session::on_window_update(uint32_t stream_id, const unsigned char *payload, uint32_t len)
+{
+    if( len != 4 ) {
+        return connection_error( H2_FRAME_SIZE_ERROR );
+    }
+    uint32_t inc = read_u32( payload ) & 0x7fffffff;
+    if( stream_id == 0 ) {
+        if( inc == 0 || (int64_t)m_send_window + inc > 0x7fffffff ) {
+            return connection_error( inc == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR );
+        }
+        m_send_window += inc;
+        return true;
+    }
+
+    std::map<uint32_t, h2_stream*>::iterator it = m_streams.find( stream_id );
+    if( it == m_streams.end() ) {
+        return true;        // 流已经结束，迟到的窗口更新忽略
+    }
+    h2_stream* s = it->second;
+    if( inc == 0 || (int64_t)s->send_window + inc > 0x7fffffff ) {
+        queue_rst_stream( stream_id, inc == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR );
+        close_stream( s );
+        return true;
+    }
+    s->send_window += inc;
+    return true;
+}
+
+// 把流的请求头还原成 HTTP/1.1 请求，交给 http_conn 生成响应，再把响应转换成 HEADERS 帧和待发送的响应体
+void h2_session::respond(h2_stream *s)
+{
+    std::string method, path, authority, cookie, fields;
+    for( size_t i = 0; i < s->headers.size(); ++i ) {
+        const hpack_header& h = s->headers[i];
+        if( h.name == ":method" ) {
+            method = h.value;
+        } else if( h.name == ":path" ) {
+            path = h.value;
+        } else if( h.name == ":authority" ) {
+            authority = h.value;
+        } else if( h.name == "cookie" ) {
+            // HTTP/2 的 cookie 可以拆成多个头部，合并回一个
+            cookie.append( cookie.empty() ? "" : "; " ).append( h.value );
+        } else if( h.name[0] == ':' || h.name == "connection" || h.name == "keep-alive" || h.name == "upgrade"
+                   || h.name == "transfer-encoding" || h.name == "content-length" || h.name == "expect"
+                   || h.name == "te" || h.name == "http2-settings" || h.name == "proxy-connection"
+                   || ( h.name == "host" && !authority.empty() ) ) {
+            continue;       // 伪头部和连接管理相关的头部由我们生成
+        } else {
+            fields.append( h.name ).append( ": " ).append( h.value ).append( "\r\n" );
+        }
+    }
+    if( method.empty() || path.empty() ) {
+        queue_rst_stream( s->id, H2_PROTOCOL_ERROR );
+        close_stream( s );
+        return;
+    }
+
+    std::string request;
+    request.reserve( 256 + fields.size() + s->body.size() );
+    request.append( method ).append( " " ).append( path ).append( " HTTP/1.1\r\n" );
+    if( !authority.empty() ) {
+        request.append( "Host: " ).append( authority ).append( "\r\n" );
+    }
+    request.append( fields );
+    if( !cookie.empty() ) {
+        request.append( "Cookie: " ).append( cookie ).append( "\r\n" );
+    }
+    if( !s->body.empty() || method == "POST" || method == "PUT" ) {
+        char line[64];
+        snprintf( line, sizeof(line), "Content-Length: %zu\r\n", s->body.size() );
+        request.append( line );
+    }
+    request.append( "\r\n" ).append( s->body );
+    std::string().swap( s->body );
+
+    s->req = new http_conn;
+    s->req->init_stream( m_conn->m_address );
+    // 每个流都是一个新请求，按客户端地址限速，超过的回 429。流1的令牌在连接第一次读数据时已经取过
+    bool limited = http_conn::m_limiter && s->id != 1
+                   && !http_conn::m_limiter->allow( m_conn->m_address.sin_addr.s_addr );
+    s->req->m_request_start = s->start;
+    s->req->m_trace.begin();
+    if( !( limited ? s->req->process_write( http_conn::TOO_MANY_REQUESTS ) : s->req->process_stream( request ) ) ) {
+        queue_rst_stream( s->id, H2_INTERNAL_ERROR );
+        close_stream( s );
+        return;
+    }
+
+    // 在 iovec 中找到响应头的结尾，之后的部分都是响应体
+    std::string head;
+    int i = 0;
+    size_t body_off = 0;
+    for( ; i < s->req->m_iv_count; ++i ) {
+        size_t before = head.size();
+        head.append( (const char*)s->req->m_iv[i].iov_base, s->req->m_iv[i].iov_len );
+        size_t end = head.find( "\r\n\r\n", before > 3 ? before - 3 : 0 );
+        if( end != std::string::npos ) {
+            body_off = end + 4 - before;
+            head.resize( end + 2 );
+            break;
+        }
+    }
+    if( i == s->req->m_iv_count ) {
+        queue_rst_stream( s->id, H2_INTERNAL_ERROR );
+        close_stream( s );
+        return;
+    }
+    for( ; i < s->req->m_iv_count; ++i, body_off = 0 ) {
+        size_t len = s->req->m_iv[i].iov_len - body_off;
+        if( len > 0 ) {
+            s->body_iv[ s->body_iv_count ].iov_base = (char*)s->req->m_iv[i].iov_base + body_off;
+            s->body_iv[ s->body_iv_count ].iov_len = len;
+            ++s->body_iv_count;
+        }
+    }
+
+    // 状态行 + 响应头 -> HPACK，名字转成小写，去掉 HTTP/2 不允许的连接管理头部
+    std::string block;
+    hpack_encode_status( block, atoi( head.c_str() + 9 ) );
+    size_t pos = head.find( "\r\n" ) + 2;
+    while( pos < head.size() ) {
+        size_t eol = head.find( "\r\n", pos );
+        size_t colon = head.find( ':', pos );
+        if( colon != std::string::npos && colon < eol ) {
+            char name[64];
+            size_t name_len = colon - pos < sizeof(name) ? colon - pos : sizeof(name);
+            for( size_t k = 0; k < name_len; ++k ) {
+                name[k] = tolower( (unsigned char)head[ pos + k ] );
+            }
+            size_t v = colon + 1;
+            while( v < eol && head[v] == ' ' ) {
+                ++v;
+            }
+            std::string lname( name, name_len );
+            if( lname != "connection" && lname != "keep-alive" && lname != "transfer-encoding" && lname != "upgrade" ) {
+                hpack_encode_header( block, name, name_len, head.data() + v, eol - v );
+            }
+        }
+        pos = eol + 2;
+    }
+
+    // 头部块超过对方的最大帧长时拆成 HEADERS + CONTINUATION
+    bool has_body = s->has_data();
+    size_t off = 0;
+    do {
+        size_t n = block.size() - off;
+        n = n < m_peer_max_frame ? n : m_peer_max_frame;
+        bool last = ( off + n == block.size() );
+        uint8_t flags = last ? FLAG_END_HEADERS : 0;
+        if( off == 0 && !has_body ) {
+            flags |= FLAG_END_STREAM;
+        }
+        queue_frame_header( off == 0 ? H2_HEADERS : H2_CONTINUATION, flags, s->id, n );
+        m_out.append( block, off, n );
+        off += n;
+    } while( off < block.size() );
+    s->sent = block.size();
+    s->req->m_trace.mark( TP_PROCESS_END );
+
+    if( has_body ) {
+        m_sending.push_back( s );
+    } else {
+        end_stream( s );
+        close_stream( s );
+    }
+}
+
+void h2_session::end_stream(h2_stream *s)
+{
+    http_conn* req = s->req;
+    req->m_trace.mark( TP_WRITE_END );
+    trace_commit( req->m_trace, m_conn->m_sockfd, req->m_url );
+    req->log_access( s->sent, ACCESS_H2 | ACCESS_KEEP_ALIVE | ( m_conn->m_ssl ? ACCESS_TLS : 0 ) );
+}
+
+void h2_session::close_stream(h2_stream *s)
+{
+    m_streams.erase( s->id );
+    m_sending.remove( s );
+    if( m_iov_idx < m_iov.size() ) {
+        m_closing.push_back( s );       // 正在发送的批次可能还引用着它的响应体
+    } else {
+        delete s;
+    }
+}
+
+bool h2_session::build_batch()
+{
+    m_iov.clear();
+    m_iov_idx = 0;
+    m_batch_out.clear();
+    m_batch_out.swap( m_out );
+    if( !m_batch_out.empty() ) {
+        struct iovec v = { (void*)m_batch_out.data(), m_batch_out.size() };
+        m_iov.push_back( v );
+    }
+
+    // 有数据的流轮流发一帧，直到攒够一批或者窗口用完
+    int frames = 0;
+    bool progress = true;
+    while( progress && frames < MAX_BATCH_FRAMES && m_send_window > 0 && !m_sending.empty() ) {
+        progress = false;
+        std::list<h2_stream*>::iterator it = m_sending.begin();
+        while( it != m_sending.end() && frames < MAX_BATCH_FRAMES && m_send_window > 0 ) {
+            h2_stream* s = *it;
+            if( s->send_window <= 0 ) {
+                ++it;
+                continue;
+            }
+            struct iovec& v = s->body_iv[ s->body_iv_idx ];
+            size_t n = v.iov_len;
+            n = n < m_peer_max_frame ? n : m_peer_max_frame;
+            n = n < (size_t)s->send_window ? n : s->send_window;
+            n = n < (size_t)m_send_window ? n : m_send_window;
+            bool last = ( n == v.iov_len && s->body_iv_idx == s->body_iv_count - 1 );
+
+            write_frame_header( m_data_heads[frames], H2_DATA, last ? FLAG_END_STREAM : 0, s->id, n );
+            struct iovec head = { m_data_heads[frames], FRAME_HEADER_LEN };
+            struct iovec payload = { v.iov_base, n };
+            m_iov.push_back( head );
+            m_iov.push_back( payload );
+            ++frames;
+            progress = true;
+
+            v.iov_base = (char*)v.iov_base + n;
+            v.iov_len -= n;
+            if( v.iov_len == 0 ) {
+                ++s->body_iv_idx;
+            }
+            s->send_window -= n;
+            m_send_window -= n;
+            s->sent += n;
+
+            ++it;
+            if( !s->has_data() ) {
+                end_stream( s );
+                close_stream( s );      // 响应体在这一批里，释放推迟到发送完
+            }
+        }
+    }
+    // 下一批从另一个流开始
+    if( m_sending.size() > 1 ) {
+        m_sending.splice( m_sending.end(), m_sending, m_sending.begin() );
+    }
+    return !m_iov.empty();
+}
+
+bool h2_session::flush()
+{
+    while( true ) {
+        if( m_iov_idx >= m_iov.size() ) {
+            // 上一批发完了，它引用的流可以释放了
+            for( size_t i = 0; i < m_closing.size(); ++i ) {
+                delete m_closing[i];
+            }
+            m_closing.clear();
+            m_iov.clear();
+            m_iov_idx = 0;
+            if( !build_batch() ) {
+                return true;
+            }
+        }
+
+        int cnt = m_iov.size() - m_iov_idx;
+        cnt = cnt < IOV_MAX ? cnt : IOV_MAX;
+        ssize_t n = m_conn->sock_writev( &m_iov[ m_iov_idx ], cnt );
+        if( n < 0 ) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        while( n > 0 && m_iov_idx < m_iov.size() ) {
+            struct iovec& v = m_iov[ m_iov_idx ];
+            if( (size_t)n >= v.iov_len ) {
+                n -= v.iov_len;
+                ++m_iov_idx;
+            } else {
+                v.iov_base = (char*)v.iov_base + n;
+                v.iov_len -= n;
+                n = 0;
+            }
+        }
+    }
+}
+
+bool h2_session::want_write() const
+{
+    if( m_iov_idx < m_iov.size() || !m_out.empty() ) {
+        return true;
+    }
+    if( m_send_window <= 0 ) {
+        return false;
+    }
+    for( std::list<h2_stream*>::const_iterator it = m_sending.begin(); it != m_sending.end(); ++it ) {
+        if( (*it)->send_window > 0 ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void h2_session::queue_frame_header(uint8_t type, uint8_t flags, uint32_t stream_id, uint32_t len)
+{
+    char h[ FRAME_HEADER_LEN ];
+    write_frame_header( h, type, flags, stream_id, len );
+    m_out.append( h, FRAME_HEADER_LEN );
+}
+
+void h2_session::queue_settings()
+{
+    unsigned char p[6];
+    p[0] = 0;
+    p[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    p[2] = ( MAX_STREAMS >> 24 ) & 0xff;
+    p[3] = ( MAX_STREAMS >> 16 ) & 0xff;
+    p[4] = ( MAX_STREAMS >> 8 ) & 0xff;
+    p[5] = MAX_STREAMS & 0xff;
+    queue_frame_header( H2_SETTINGS, 0, 0, sizeof(p) );
+    m_out.append( (const char*)p, sizeof(p) );
+}
+
+void h2_session::queue_window_update(uint32_t stream_id, uint32_t increment)
+{
+    unsigned char p[4] = { (unsigned char)( ( increment >> 24 ) & 0x7f ), (unsigned char)( ( increment >> 16 ) & 0xff ),
+                           (unsigned char)( ( increment >> 8 ) & 0xff ), (unsigned char)( increment & 0xff ) };
+    queue_frame_header( H2_WINDOW_UPDATE, 0, stream_id, sizeof(p) );
+    m_out.append( (const char*)p, sizeof(p) );
+}
+
+void h2_session::queue_rst_stream(uint32_t stream_id, uint32_t error)
+{
+    unsigned char p[4] = { (unsigned char)( error >> 24 ), (unsigned char)( error >> 16 ),
+                           (unsigned char)( error >> 8 ), (unsigned char)error };
+    queue_frame_header( H2_RST_STREAM, 0, stream_id, sizeof(p) );
+    m_out.append( (const char*)p, sizeof(p) );
+}
+
+bool h2_session::connection_error(uint32_t error)
+{
+    if( !m_goaway ) {
+        unsigned char p[8] = { (unsigned char)( ( m_last_stream_id >> 24 ) & 0x7f ), (unsigned char)( m_last_stream_id >> 16 ),
+                               (unsigned char)( m_last_stream_id >> 8 ), (unsigned char)m_last_stream_id,
+                               (unsigned char)( error >> 24 ), (unsigned char)( error >> 16 ),
+                               (unsigned char)( error >> 8 ), (unsigned char)error };
+        queue_frame_header( H2_GOAWAY, 0, 0, sizeof(p) );
+        m_out.append( (const char*)p, sizeof(p) );
+        m_goaway = true;
+    }
+    EMlog(LOGLEVEL_WARN, "HTTP/2 connection error %u\n", error);
+    return false;
+}
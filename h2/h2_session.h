@@ -0,0 +1,138 @@
+/*
+    HTTP/2（h2c，明文）
+    一个 h2_session 挂在一个 http_conn 上，负责分帧、HPACK、流的多路复用和流量控制。
+    每个流的请求还原成 HTTP/1.1 的请求交给一个不带 socket 的 http_conn，复用 do_request/process_write
+    生成的响应：响应头转换成 HEADERS 帧，响应体（写缓冲区、mmap 的文件、资源包）直接作为 DATA 帧的负载发送。
+    多个帧攒在一起用一次 writev 发出。
+*/
+
+#ifndef H2_SESSION_H
+#define H2_SESSION_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "h2/hpack.h"
+#include "memorypool/mem_pool.h"
+
+class http_conn;
+
+// 帧类型
+enum H2_FRAME_TYPE { H2_DATA = 0, H2_HEADERS, H2_PRIORITY, H2_RST_STREAM, H2_SETTINGS, H2_PUSH_PROMISE,
+                     H2_PING, H2_GOAWAY, H2_WINDOW_UPDATE, H2_CONTINUATION };
+
+// 错误码
+enum H2_ERROR { H2_NO_ERROR = 0, H2_PROTOCOL_ERROR, H2_INTERNAL_ERROR, H2_FLOW_CONTROL_ERROR, H2_SETTINGS_TIMEOUT,
+                H2_STREAM_CLOSED, H2_FRAME_SIZE_ERROR, H2_REFUSED_STREAM, H2_CANCEL, H2_COMPRESSION_ERROR,
+                H2_CONNECT_ERROR, H2_ENHANCE_YOUR_CALM };
+
+// 一个流
+struct h2_stream : public pool_allocated<h2_stream>
+{
+    uint32_t id;
+    bool end_stream;                    // 客户端已经发完（END_STREAM）
+    std::vector<hpack_header> headers;  // 请求头
+    std::string body;                   // 请求体
+    int32_t send_window;                // 我们还能在这个流上发送的字节数
+
+    http_conn* req;                     // 生成响应的 http_conn，响应体的内存归它所有
+    struct iovec body_iv[3];            // 还没发送的响应体
+    int body_iv_count;
+    int body_iv_idx;
+    uint64_t start;                     // 流打开的时间，访问日志的耗时从这里算起
+    long sent;                          // 已经放入发送队列的头部块和 DATA 负载字节数
+
+    h2_stream(uint32_t id, int32_t window);
+    ~h2_stream();
+    bool has_data() const { return body_iv_idx < body_iv_count; }
+};
+
+class h2_session
+{
+public:
+    static const char PREFACE[];                    // 客户端连接序言
+    static const int PREFACE_LEN = 24;
+    static const int FRAME_HEADER_LEN = 9;
+    static const uint32_t MAX_FRAME_SIZE = 16384;   // 我们接收的最大帧，也是默认值
+    static const uint32_t MAX_STREAMS = 100;        // SETTINGS_MAX_CONCURRENT_STREAMS
+    static const int32_t DEFAULT_WINDOW = 65535;
+    static const int MAX_BATCH_FRAMES = 32;         // 一次 writev 最多攒的 DATA 帧数
+    static const size_t MAX_HEADER_BLOCK = 65536;   // HEADERS + CONTINUATION 的总长度上限
+
+    explicit h2_session(http_conn* conn);
+    ~h2_session();
+
+    // 客户端的数据是否是 HTTP/2 的连接序言：是返回1，还不够判断返回0，不是返回-1
+    static int check_preface(const char* data, int len);
+
+    // 从 HTTP/1.1 升级（Upgrade: h2c）：发送 101，应用 HTTP2-Settings，升级前的请求作为流1
+    bool upgrade(const char* settings_b64, const std::vector<hpack_header>& request);
+
+    // 处理收到的数据。返回false表示连接级错误，GOAWAY 已放入发送队列，发送后应关闭连接
+    bool on_data(const char* data, size_t len);
+
+    // 尽量发送待发送的帧，socket 写满时返回true并等待下一次可写，出错返回false
+    bool flush();
+    // 是否还有能发送的数据（需要关注 EPOLLOUT）
+    bool want_write() const;
+
+private:
+    // 处理一个完整的帧
+    bool on_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const unsigned char* payload, uint32_t len);
+    bool on_headers(uint8_t flags, uint32_t stream_id, const unsigned char* payload, uint32_t len);
+    bool on_header_block_end();
+    bool on_data_frame(uint8_t flags, uint32_t stream_id, const unsigned char* payload, uint32_t len);
+    // 应用 SETTINGS 参数，返回错误码
+    uint32_t apply_settings(const unsigned char* payload, uint32_t len);
+    bool on_settings(uint8_t flags, uint32_t stream_id, const unsigned char* payload, uint32_t len);
+    bool on_window_update(uint32_t stream_id, const unsigned char* payload, uint32_t len);
+
+    // 请求完整，生成响应
+    void respond(h2_stream* s);
+    // 响应的最后一帧（END_STREAM）已经放入发送队列：记录访问日志和分阶段跟踪
+    void end_stream(h2_stream* s);
+    // 关闭流，响应体还在发送批次中时推迟释放
+    void close_stream(h2_stream* s);
+
+    // 生成下一批要发送的帧
+    bool build_batch();
+
+    void queue_frame_header(uint8_t type, uint8_t flags, uint32_t stream_id, uint32_t len);
+    void queue_settings();
+    void queue_window_update(uint32_t stream_id, uint32_t increment);
+    void queue_rst_stream(uint32_t stream_id, uint32_t error);
+    bool connection_error(uint32_t error);
+
+private:
+    http_conn* m_conn;
+    int m_preface_left;                 // 还没收到的连接序言字节数
+    std::string m_partial;              // 跨越多次读取的不完整帧
+
+    hpack_decoder m_decoder;
+    std::string m_header_block;         // HEADERS + CONTINUATION 拼起来的头部块
+    uint32_t m_header_stream;           // 正在接收头部块的流，0 表示没有
+    bool m_header_end_stream;
+    bool m_header_new;                  // 头部块打开的是新的流
+
+    std::map<uint32_t, h2_stream*> m_streams;
+    std::list<h2_stream*> m_sending;    // 有响应体要发送的流，轮流发送
+    std::vector<h2_stream*> m_closing;  // 已关闭、但响应体还在发送批次中的流
+    uint32_t m_last_stream_id;
+    bool m_goaway;                      // 已经发送 GOAWAY
+
+    int32_t m_send_window;              // 连接级发送窗口
+    int32_t m_peer_initial_window;      // 对方的 SETTINGS_INITIAL_WINDOW_SIZE
+    uint32_t m_peer_max_frame;          // 对方的 SETTINGS_MAX_FRAME_SIZE
+
+    std::string m_out;                  // 待发送的控制帧和 HEADERS 帧
+    std::string m_batch_out;            // 正在发送的批次中的控制帧
+    char m_data_heads[ MAX_BATCH_FRAMES ][ FRAME_HEADER_LEN ];  // 正在发送的批次中 DATA 帧的帧头
+    std::vector<struct iovec> m_iov;    // 正在发送的批次
+    size_t m_iov_idx;
+};
+
+#endif // H2_SESSION_H
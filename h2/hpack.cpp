@@ -0,0 +1,416 @@
+#include "hpack.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// 静态表（RFC 7541 附录 A），下标从1开始
+static const char* static_table[][2] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+static const uint32_t STATIC_TABLE_SIZE = sizeof(static_table) / sizeof(static_table[0]);
+
+// Huffman 编码表（RFC 7541 附录 B），最后一项是 EOS
+static const struct { uint32_t code; int bits; } huffman_codes[257] = {
+    { 0x00001ff8, 13 }, { 0x007fffd8, 23 }, { 0x0fffffe2, 28 }, { 0x0fffffe3, 28 },
+    { 0x0fffffe4, 28 }, { 0x0fffffe5, 28 }, { 0x0fffffe6, 28 }, { 0x0fffffe7, 28 },
+    { 0x0fffffe8, 28 }, { 0x00ffffea, 24 }, { 0x3ffffffc, 30 }, { 0x0fffffe9, 28 },
+    { 0x0fffffea, 28 }, { 0x3ffffffd, 30 }, { 0x0fffffeb, 28 }, { 0x0fffffec, 28 },
+    { 0x0fffffed, 28 }, { 0x0fffffee, 28 }, { 0x0fffffef, 28 }, { 0x0ffffff0, 28 },
+    { 0x0ffffff1, 28 }, { 0x0ffffff2, 28 }, { 0x3ffffffe, 30 }, { 0x0ffffff3, 28 },
+    { 0x0ffffff4, 28 }, { 0x0ffffff5, 28 }, { 0x0ffffff6, 28 }, { 0x0ffffff7, 28 },
+    { 0x0ffffff8, 28 }, { 0x0ffffff9, 28 }, { 0x0ffffffa, 28 }, { 0x0ffffffb, 28 },
+    { 0x00000014,  6 }, { 0x000003f8, 10 }, { 0x000003f9, 10 }, { 0x00000ffa, 12 },
+    { 0x00001ff9, 13 }, { 0x00000015,  6 }, { 0x000000f8,  8 }, { 0x000007fa, 11 },
+    { 0x000003fa, 10 }, { 0x000003fb, 10 }, { 0x000000f9,  8 }, { 0x000007fb, 11 },
+    { 0x000000fa,  8 }, { 0x00000016,  6 }, { 0x00000017,  6 }, { 0x00000018,  6 },
+    { 0x00000000,  5 }, { 0x00000001,  5 }, { 0x00000002,  5 }, { 0x00000019,  6 },
+    { 0x0000001a,  6 }, { 0x0000001b,  6 }, { 0x0000001c,  6 }, { 0x0000001d,  6 },
+    { 0x0000001e,  6 }, { 0x0000001f,  6 }, { 0x0000005c,  7 }, { 0x000000fb,  8 },
+    { 0x00007ffc, 15 }, { 0x00000020,  6 }, { 0x00000ffb, 12 }, { 0x000003fc, 10 },
+    { 0x00001ffa, 13 }, { 0x00000021,  6 }, { 0x0000005d,  7 }, { 0x0000005e,  7 },
+    { 0x0000005f,  7 }, { 0x00000060,  7 }, { 0x00000061,  7 }, { 0x00000062,  7 },
+    { 0x00000063,  7 }, { 0x00000064,  7 }, { 0x00000065,  7 }, { 0x00000066,  7 },
+    { 0x00000067,  7 }, { 0x00000068,  7 }, { 0x00000069,  7 }, { 0x0000006a,  7 },
+    { 0x0000006b,  7 }, { 0x0000006c,  7 }, { 0x0000006d,  7 }, { 0x0000006e,  7 },
+    { 0x0000006f,  7 }, { 0x00000070,  7 }, { 0x00000071,  7 }, { 0x00000072,  7 },
+    { 0x000000fc,  8 }, { 0x00000073,  7 }, { 0x000000fd,  8 }, { 0x00001ffb, 13 },
+    { 0x0007fff0, 19 }, { 0x00001ffc, 13 }, { 0x00003ffc, 14 }, { 0x00000022,  6 },
+    { 0x00007ffd, 15 }, { 0x00000003,  5 }, { 0x00000023,  6 }, { 0x00000004,  5 },
+    { 0x00000024,  6 }, { 0x00000005,  5 }, { 0x00000025,  6 }, { 0x00000026,  6 },
+    { 0x00000027,  6 }, { 0x00000006,  5 }, { 0x00000074,  7 }, { 0x00000075,  7 },
+    { 0x00000028,  6 }, { 0x00000029,  6 }, { 0x0000002a,  6 }, { 0x00000007,  5 },
+    { 0x0000002b,  6 }, { 0x00000076,  7 }, { 0x0000002c,  6 }, { 0x00000008,  5 },
+    { 0x00000009,  5 }, { 0x0000002d,  6 }, { 0x00000077,  7 }, { 0x00000078,  7 },
+    { 0x00000079,  7 }, { 0x0000007a,  7 }, { 0x0000007b,  7 }, { 0x00007ffe, 15 },
+    { 0x000007fc, 11 }, { 0x00003ffd, 14 }, { 0x00001ffd, 13 }, { 0x0ffffffc, 28 },
+    { 0x000fffe6, 20 }, { 0x003fffd2, 22 }, { 0x000fffe7, 20 }, { 0x000fffe8, 20 },
+    { 0x003fffd3, 22 }, { 0x003fffd4, 22 }, { 0x003fffd5, 22 }, { 0x007fffd9, 23 },
+    { 0x003fffd6, 22 }, { 0x007fffda, 23 }, { 0x007fffdb, 23 }, { 0x007fffdc, 23 },
+    { 0x007fffdd, 23 }, { 0x007fffde, 23 }, { 0x00ffffeb, 24 }, { 0x007fffdf, 23 },
+    { 0x00ffffec, 24 }, { 0x00ffffed, 24 }, { 0x003fffd7, 22 }, { 0x007fffe0, 23 },
+    { 0x00ffffee, 24 }, { 0x007fffe1, 23 }, { 0x007fffe2, 23 }, { 0x007fffe3, 23 },
+    { 0x007fffe4, 23 }, { 0x001fffdc, 21 }, { 0x003fffd8, 22 }, { 0x007fffe5, 23 },
+    { 0x003fffd9, 22 }, { 0x007fffe6, 23 }, { 0x007fffe7, 23 }, { 0x00ffffef, 24 },
+    { 0x003fffda, 22 }, { 0x001fffdd, 21 }, { 0x000fffe9, 20 }, { 0x003fffdb, 22 },
+    { 0x003fffdc, 22 }, { 0x007fffe8, 23 }, { 0x007fffe9, 23 }, { 0x001fffde, 21 },
+    { 0x007fffea, 23 }, { 0x003fffdd, 22 }, { 0x003fffde, 22 }, { 0x00fffff0, 24 },
+    { 0x001fffdf, 21 }, { 0x003fffdf, 22 }, { 0x007fffeb, 23 }, { 0x007fffec, 23 },
+    { 0x001fffe0, 21 }, { 0x001fffe1, 21 }, { 0x003fffe0, 22 }, { 0x001fffe2, 21 },
+    { 0x007fffed, 23 }, { 0x003fffe1, 22 }, { 0x007fffee, 23 }, { 0x007fffef, 23 },
+    { 0x000fffea, 20 }, { 0x003fffe2, 22 }, { 0x003fffe3, 22 }, { 0x003fffe4, 22 },
+    { 0x007ffff0, 23 }, { 0x003fffe5, 22 }, { 0x003fffe6, 22 }, { 0x007ffff1, 23 },
+    { 0x03ffffe0, 26 }, { 0x03ffffe1, 26 }, { 0x000fffeb, 20 }, { 0x0007fff1, 19 },
+    { 0x003fffe7, 22 }, { 0x007ffff2, 23 }, { 0x003fffe8, 22 }, { 0x01ffffec, 25 },
+    { 0x03ffffe2, 26 }, { 0x03ffffe3, 26 }, { 0x03ffffe4, 26 }, { 0x07ffffde, 27 },
+    { 0x07ffffdf, 27 }, { 0x03ffffe5, 26 }, { 0x00fffff1, 24 }, { 0x01ffffed, 25 },
+    { 0x0007fff2, 19 }, { 0x001fffe3, 21 }, { 0x03ffffe6, 26 }, { 0x07ffffe0, 27 },
+    { 0x07ffffe1, 27 }, { 0x03ffffe7, 26 }, { 0x07ffffe2, 27 }, { 0x00fffff2, 24 },
+    { 0x001fffe4, 21 }, { 0x001fffe5, 21 }, { 0x03ffffe8, 26 }, { 0x03ffffe9, 26 },
+    { 0x0ffffffd, 28 }, { 0x07ffffe3, 27 }, { 0x07ffffe4, 27 }, { 0x07ffffe5, 27 },
+    { 0x000fffec, 20 }, { 0x00fffff3, 24 }, { 0x000fffed, 20 }, { 0x001fffe6, 21 },
+    { 0x003fffe9, 22 }, { 0x001fffe7, 21 }, { 0x001fffe8, 21 }, { 0x007ffff3, 23 },
+    { 0x003fffea, 22 }, { 0x003fffeb, 22 }, { 0x01ffffee, 25 }, { 0x01ffffef, 25 },
+    { 0x00fffff4, 24 }, { 0x00fffff5, 24 }, { 0x03ffffea, 26 }, { 0x007ffff4, 23 },
+    { 0x03ffffeb, 26 }, { 0x07ffffe6, 27 }, { 0x03ffffec, 26 }, { 0x03ffffed, 26 },
+    { 0x07ffffe7, 27 }, { 0x07ffffe8, 27 }, { 0x07ffffe9, 27 }, { 0x07ffffea, 27 },
+    { 0x07ffffeb, 27 }, { 0x0ffffffe, 28 }, { 0x07ffffec, 27 }, { 0x07ffffed, 27 },
+    { 0x07ffffee, 27 }, { 0x07ffffef, 27 }, { 0x07fffff0, 27 }, { 0x03ffffee, 26 },
+    { 0x3fffffff, 30 },
+};
+
+// Huffman 解码树，第一次使用时由编码表生成
+struct huffman_node
+{
+    short child[2];     // 子节点下标，0 表示没有
+    short sym;          // 叶子节点的符号，-1 表示内部节点
+};
+
+struct huffman_tree
+{
+    huffman_node nodes[ 2 * 257 ];
+    int count;
+
+    huffman_tree() : count( 1 )
+    {
+        memset( nodes, 0, sizeof(nodes) );
+        nodes[0].sym = -1;
+        for( int s = 0; s < 257; ++s ) {
+            int n = 0;
+            for( int b = huffman_codes[s].bits - 1; b >= 0; --b ) {
+                int bit = ( huffman_codes[s].code >> b ) & 1;
+                if( !nodes[n].child[bit] ) {
+                    nodes[count].sym = -1;
+                    nodes[n].child[bit] = count++;
+                }
+                n = nodes[n].child[bit];
+            }
+            nodes[n].sym = s;
+        }
+    }
+};
+
+bool hpack_huffman_decode(const unsigned char *p, size_t len, std::string &out)
+{
+    static const huffman_tree tree;     // C++11 起局部静态变量的初始化是线程安全的
+
+    int n = 0;
+    int depth = 0;          // 当前符号已经读了几位
+    bool all_ones = true;   // 当前符号已读的位是否全是1（只有这样才能是结尾的填充）
+    for( size_t i = 0; i < len; ++i ) {
+        for( int b = 7; b >= 0; --b ) {
+            int bit = ( p[i] >> b ) & 1;
+            n = tree.nodes[n].child[bit];
+            if( !n ) {
+                return false;
+            }
+            ++depth;
+            all_ones = all_ones && bit;
+            if( tree.nodes[n].sym >= 0 ) {
+                if( tree.nodes[n].sym == 256 ) {    // 不允许出现 EOS
+                    return false;
+                }
+                out.push_back( (char)tree.nodes[n].sym );
+                n = 0;
+                depth = 0;
+                all_ones = true;
+            }
+        }
+    }
+    // 结尾的填充最多7位，且必须是 EOS 的前缀（全1）
+    return depth <= 7 && all_ones;
+}
+
+size_t hpack_decode_int(const unsigned char *p, size_t len, int prefix_bits, uint32_t &value)
+{
+    if( len == 0 ) {
+        return 0;
+    }
+    uint32_t max_prefix = ( 1u << prefix_bits ) - 1;
+    value = p[0] & max_prefix;
+    if( value < max_prefix ) {
+        return 1;
+    }
+    int shift = 0;
+    for( size_t i = 1; i < len; ++i ) {
+        if( shift > 28 ) {          // 超出32位
+            return 0;
+        }
+        uint64_t v = value + ( (uint64_t)( p[i] & 0x7f ) << shift );
+        if( v > 0xffffffffu ) {
+            return 0;
+        }
+        value = (uint32_t)v;
+        shift += 7;
+        if( !( p[i] & 0x80 ) ) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// 解码一个字符串，返回消耗的字节数，出错返回0
+static size_t decode_string(const unsigned char* p, size_t len, std::string& out)
+{
+    uint32_t slen;
+    size_t used = hpack_decode_int( p, len, 7, slen );
+    if( !used || slen > len - used ) {
+        return 0;
+    }
+    out.clear();
+    if( p[0] & 0x80 ) {
+        if( !hpack_huffman_decode( p + used, slen, out ) ) {
+            return 0;
+        }
+    } else {
+        out.assign( (const char*)p + used, slen );
+    }
+    return used + slen;
+}
+
+hpack_decoder::hpack_decoder() : m_size(0), m_max_size(DEFAULT_TABLE_SIZE)
+{
+}
+
+bool hpack_decoder::lookup(uint32_t index, std::string *name, std::string *value) const
+{
+    if( index == 0 ) {
+        return false;
+    }
+    if( index <= STATIC_TABLE_SIZE ) {
+        name->assign( static_table[ index - 1 ][0] );
+        if( value ) {
+            value->assign( static_table[ index - 1 ][1] );
+        }
+        return true;
+    }
+    index -= STATIC_TABLE_SIZE + 1;
+    if( index >= m_table.size() ) {
+        return false;
+    }
+    *name = m_table[index].name;
+    if( value ) {
+        *value = m_table[index].value;
+    }
+    return true;
+}
+
+void hpack_decoder::evict()
+{
+    while( m_size > m_max_size && !m_table.empty() ) {
+        m_size -= m_table.back().name.size() + m_table.back().value.size() + 32;
+        m_table.pop_back();
+    }
+}
+
+void hpack_decoder::insert(const std::string &name, const std::string &value)
+{
+    size_t sz = name.size() + value.size() + 32;
+    // 先腾出空间再插入；比整个表还大时表被清空，不插入
+    while( !m_table.empty() && m_size + sz > m_max_size ) {
+        m_size -= m_table.back().name.size() + m_table.back().value.size() + 32;
+        m_table.pop_back();
+    }
+    if( sz > m_max_size ) {
+        return;
+    }
+    hpack_header h;
+    h.name = name;
+    h.value = value;
+    m_table.push_front( h );
+    m_size += sz;
+}
+
+bool hpack_decoder::decode(const unsigned char *p, size_t len, std::vector<hpack_header> &headers)
+{
+    size_t pos = 0;
+    bool fields_seen = false;       // 大小更新只能出现在头部块开头
+    while( pos < len ) {
+        unsigned char c = p[pos];
+        uint32_t index;
+        size_t used;
+        hpack_header h;
+
+        if( c & 0x80 ) {
+            // 1xxxxxxx 已索引的头部
+            used = hpack_decode_int( p + pos, len - pos, 7, index );
+            if( !used || !lookup( index, &h.name, &h.value ) ) {
+                return false;
+            }
+            pos += used;
+        } else if( ( c & 0xe0 ) == 0x20 ) {
+            // 001xxxxx 动态表大小更新
+            used = hpack_decode_int( p + pos, len - pos, 5, index );
+            if( !used || fields_seen || index > DEFAULT_TABLE_SIZE ) {
+                return false;
+            }
+            m_max_size = index;
+            evict();
+            pos += used;
+            continue;
+        } else {
+            // 01xxxxxx 加入动态表；0000xxxx 不加入；0001xxxx 永不加入
+            bool incremental = ( c & 0xc0 ) == 0x40;
+            used = hpack_decode_int( p + pos, len - pos, incremental ? 6 : 4, index );
+            if( !used ) {
+                return false;
+            }
+            pos += used;
+            if( index ) {
+                if( !lookup( index, &h.name, NULL ) ) {
+                    return false;
+                }
+            } else {
+                used = decode_string( p + pos, len - pos, h.name );
+                if( !used ) {
+                    return false;
+                }
+                pos += used;
+            }
+            used = decode_string( p + pos, len - pos, h.value );
+            if( !used ) {
+                return false;
+            }
+            pos += used;
+            if( incremental ) {
+                insert( h.name, h.value );
+            }
+        }
+        fields_seen = true;
+        headers.push_back( h );
+    }
+    return true;
+}
+
+// 编码整数，first 为第一个字节中前缀之外的标志位
+static void encode_int(std::string& out, unsigned char first, int prefix_bits, uint32_t value)
+{
+    uint32_t max_prefix = ( 1u << prefix_bits ) - 1;
+    if( value < max_prefix ) {
+        out.push_back( (char)( first | value ) );
+        return;
+    }
+    out.push_back( (char)( first | max_prefix ) );
+    value -= max_prefix;
+    while( value >= 128 ) {
+        out.push_back( (char)( ( value & 0x7f ) | 0x80 ) );
+        value >>= 7;
+    }
+    out.push_back( (char)value );
+}
+
+static void encode_string(std::string& out, const char* s, size_t len)
+{
+    encode_int( out, 0x00, 7, len );
+    out.append( s, len );
+}
+
+void hpack_encode_status(std::string &out, int status)
+{
+    // 静态表中带值的 :status：8~14
+    static const int indexed[] = { 200, 204, 206, 304, 400, 404, 500 };
+    for( int i = 0; i < 7; ++i ) {
+        if( indexed[i] == status ) {
+            encode_int( out, 0x80, 7, 8 + i );
+            return;
+        }
+    }
+    char buf[8];
+    snprintf( buf, sizeof(buf), "%03d", status % 1000 );
+    encode_int( out, 0x00, 4, 8 );          // 不加入动态表，名字用静态表的 :status
+    encode_string( out, buf, 3 );
+}
+
+void hpack_encode_header(std::string &out, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    // 不加入动态表的字面量，名字在静态表中就用下标
+    for( uint32_t i = 14; i < STATIC_TABLE_SIZE; ++i ) {    // 前14项是伪头部
+        if( strlen( static_table[i][0] ) == name_len && memcmp( static_table[i][0], name, name_len ) == 0 ) {
+            encode_int( out, 0x00, 4, i + 1 );
+            encode_string( out, value, value_len );
+            return;
+        }
+    }
+    out.push_back( 0x00 );
+    encode_string( out, name, name_len );
+    encode_string( out, value, value_len );
+}
@@ -0,0 +1,53 @@
+/*
+    HPACK 头部压缩（RFC 7541）
+    解码器支持静态表、动态表和 Huffman 编码；
+    编码器不使用动态表，能用静态表的名字就用下标，值以原文发送，响应头本来就很少
+*/
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+struct hpack_header
+{
+    std::string name;
+    std::string value;
+};
+
+class hpack_decoder
+{
+public:
+    static const size_t DEFAULT_TABLE_SIZE = 4096;  // SETTINGS_HEADER_TABLE_SIZE 的默认值，我们不修改
+
+    hpack_decoder();
+
+    // 解码一个完整的头部块，追加到 headers。出错（COMPRESSION_ERROR）返回false，之后该连接不能再用
+    bool decode(const unsigned char* p, size_t len, std::vector<hpack_header>& headers);
+
+private:
+    // 取下标对应的表项，1~61 为静态表，之后是动态表（最新的在前）
+    bool lookup(uint32_t index, std::string* name, std::string* value) const;
+    void insert(const std::string& name, const std::string& value);
+    void evict();
+
+private:
+    std::deque<hpack_header> m_table;   // 动态表
+    size_t m_size;                      // 动态表当前大小（每项 name + value + 32）
+    size_t m_max_size;                  // 动态表大小上限，由编码方通过 size update 调整
+};
+
+// 编码响应头，追加到 out
+void hpack_encode_status(std::string& out, int status);
+void hpack_encode_header(std::string& out, const char* name, size_t name_len, const char* value, size_t value_len);
+
+// 解码前缀为 prefix_bits 位的整数，返回消耗的字节数，出错返回0
+size_t hpack_decode_int(const unsigned char* p, size_t len, int prefix_bits, uint32_t& value);
+// Huffman 解码，出错返回false
+bool hpack_huffman_decode(const unsigned char* p, size_t len, std::string& out);
+
+#endif // HPACK_H
@@ -0,0 +1,3 @@
+
+HEADERS += \
+    $$PWD/header_table.h
@@ -0,0 +1,225 @@
+/*
+    请求头的查找表
+    已知的请求头名字在编译期生成完美哈希，解析时只需要算一次哈希、比较一次名字；
+    解析出的请求头以 偏移/长度 的形式指向读缓冲区，不拷贝、不分配内存
+*/
+
+#ifndef HEADER_TABLE_H
+#define HEADER_TABLE_H
+
+#include <strings.h>
+
+// 已知的请求头，新增时在 known_header_names 中按相同顺序补上名字
+enum HEADER_ID {
+    HDR_UNKNOWN = -1,
+    HDR_CONNECTION = 0,
+    HDR_CONTENT_LENGTH,
+    HDR_HOST,
+    HDR_TRANSFER_ENCODING,
+    HDR_EXPECT,
+    HDR_CONTENT_TYPE,
+    HDR_USER_AGENT,
+    HDR_ACCEPT,
+    HDR_ACCEPT_ENCODING,
+    HDR_ACCEPT_LANGUAGE,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_RANGE,
+    HDR_UPGRADE,
+    HDR_COOKIE,
+    HDR_REFERER,
+    HDR_AUTHORIZATION,
+    HDR_CACHE_CONTROL,
+    HDR_COUNT
+};
+
+constexpr const char* known_header_names[HDR_COUNT] = {
+    "Connection",
+    "Content-Length",
+    "Host",
+    "Transfer-Encoding",
+    "Expect",
+    "Content-Type",
+    "User-Agent",
+    "Accept",
+    "Accept-Encoding",
+    "Accept-Language",
+    "If-None-Match",
+    "If-Modified-Since",
+    "Range",
+    "Upgrade",
+    "Cookie",
+    "Referer",
+    "Authorization",
+    "Cache-Control",
+};
+
+constexpr int header_name_len(const char* s)
+{
+    int len = 0;
+    while( s[len] ) {
+        ++len;
+    }
+    return len;
+}
+
+// 忽略大小写的 FNV-1a 哈希，seed 用来寻找没有冲突的完美哈希
+constexpr unsigned header_hash(const char* s, int len, unsigned seed)
+{
+    unsigned h = 2166136261u ^ seed;
+    for( int i = 0; i < len; ++i ) {
+        char c = s[i];
+        if( c >= 'A' && c <= 'Z' ) {
+            c += 'a' - 'A';
+        }
+        h ^= (unsigned char)c;
+        h *= 16777619u;
+    }
+    return h ^ ( h >> 15 );
+}
+
+const int HEADER_SLOTS = 64;    // 哈希槽的数量，必须是2的幂
+
+// 在编译期找一个让所有已知请求头落到不同槽里的 seed
+constexpr bool header_seed_ok(unsigned seed)
+{
+    bool used[HEADER_SLOTS] = {};
+    for( int i = 0; i < HDR_COUNT; ++i ) {
+        const char* name = known_header_names[i];
+        unsigned slot = header_hash( name, header_name_len( name ), seed ) & ( HEADER_SLOTS - 1 );
+        if( used[slot] ) {
+            return false;
+        }
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr unsigned header_find_seed()
+{
+    for( unsigned seed = 0; seed < 10000; ++seed ) {
+        if( header_seed_ok( seed ) ) {
+            return seed;
+        }
+    }
+    return ~0u;
+}
+
+constexpr unsigned HEADER_SEED = header_find_seed();
+static_assert( HEADER_SEED != ~0u, "no perfect hash seed for known headers, enlarge HEADER_SLOTS" );
+
+// 槽 -> 请求头编号
+struct header_slot_table
+{
+    signed char id[HEADER_SLOTS];
+    unsigned char len[HDR_COUNT];
+};
+
+constexpr header_slot_table header_build_slots()
+{
+    header_slot_table t = {};
+    for( int i = 0; i < HEADER_SLOTS; ++i ) {
+        t.id[i] = HDR_UNKNOWN;
+    }
+    for( int i = 0; i < HDR_COUNT; ++i ) {
+        const char* name = known_header_names[i];
+        int len = header_name_len( name );
+        t.id[ header_hash( name, len, HEADER_SEED ) & ( HEADER_SLOTS - 1 ) ] = i;
+        t.len[i] = len;
+    }
+    return t;
+}
+
+inline constexpr header_slot_table header_slots = header_build_slots();
+
+// 根据请求头名字查编号，名字不需要以\0结尾
+inline HEADER_ID header_lookup(const char* name, int len)
+{
+    int id = header_slots.id[ header_hash( name, len, HEADER_SEED ) & ( HEADER_SLOTS - 1 ) ];
+    if( id == HDR_UNKNOWN || header_slots.len[id] != len || strncasecmp( name, known_header_names[id], len ) != 0 ) {
+        return HDR_UNKNOWN;
+    }
+    return (HEADER_ID)id;
+}
+
+// 读缓冲区中的一段数据
+struct header_view
+{
+    unsigned short off;     // 相对读缓冲区起始位置的偏移
+    unsigned short len;
+};
+
+// 一个请求的全部请求头，容量固定
+class header_table
+{
+public:
+    static const int MAX_HEADERS = 32;     // 一个请求最多保存的请求头数量
+
+    struct entry
+    {
+        HEADER_ID id;
+        header_view name;
+        header_view value;
+    };
+
+    header_table() { clear(); }
+
+    void clear()
+    {
+        m_count = 0;
+        for( int i = 0; i < HDR_COUNT; ++i ) {
+            m_known[i] = -1;
+        }
+    }
+
+    // 记录一个请求头，表满了返回false。同名的已知请求头以第一个为准
+    bool add(HEADER_ID id, int name_off, int name_len, int value_off, int value_len)
+    {
+        if( m_count >= MAX_HEADERS ) {
+            return false;
+        }
+        entry& e = m_entries[m_count];
+        e.id = id;
+        e.name.off = name_off;
+        e.name.len = name_len;
+        e.value.off = value_off;
+        e.value.len = value_len;
+        if( id != HDR_UNKNOWN && m_known[id] == -1 ) {
+            m_known[id] = m_count;
+        }
+        ++m_count;
+        return true;
+    }
+
+    // 已知请求头 O(1) 查找，没有返回NULL
+    const entry* get(HEADER_ID id) const
+    {
+        return m_known[id] == -1 ? 0 : &m_entries[ m_known[id] ];
+    }
+
+    // 其它请求头按名字顺序查找
+    const entry* find(const char* base, const char* name, int len) const
+    {
+        HEADER_ID id = header_lookup( name, len );
+        if( id != HDR_UNKNOWN ) {
+            return get( id );
+        }
+        for( int i = 0; i < m_count; ++i ) {
+            const entry& e = m_entries[i];
+            if( e.id == HDR_UNKNOWN && e.name.len == len && strncasecmp( base + e.name.off, name, len ) == 0 ) {
+                return &e;
+            }
+        }
+        return 0;
+    }
+
+    int count() const { return m_count; }
+    const entry& at(int i) const { return m_entries[i]; }
+
+private:
+    entry m_entries[MAX_HEADERS];
+    signed char m_known[HDR_COUNT];     // 已知请求头在 m_entries 中的下标，-1 表示没有
+    int m_count;
+};
+
+#endif // HEADER_TABLE_H
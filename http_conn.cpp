@@ -1,4 +1,10 @@
 #include "http_conn.h"
+#include "admin/server_config.h"
+#include "coro/co_reactor.h"
+
+#include <ctype.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
 
 // 类中静态成员需要外部定义
 int http_conn::m_epollfd = -1;
@@ -8,6 +14,8 @@ sort_timer_lst http_conn::m_timer_lst;
 
 // 定义HTTP响应的一些状态信息
 const char* ok_200_title = "OK";
+const char* ok_201_title = "Created";
+const char* ok_201_form = "The request body has been stored.\n";
 const char* error_400_title = "Bad Request";
 const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
 const char* error_403_title = "Forbidden";
@@ -16,9 +24,142 @@ const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+const char* error_429_title = "Too Many Requests";
+const char* error_429_form = "You have sent too many requests. Please slow down.\n";
+
+// 预先生成的固定响应（错误页和 201）。除了 Date 全部在启动后第一次用到时生成，之后只读，
+// 所有连接直接从这里发送，不再格式化、也不复制到写缓冲区
+struct canned_response
+{
+    http_conn::HTTP_CODE code;
+    std::string head[2];        // 状态行 + Content-Length + Content-Type + Connection，下标为是否保持连接
+    std::string tail;           // 空行 + 响应体
+};
+
+static const int CANNED_COUNT = 6;
+
+static const canned_response* build_canned()
+{
+    static const struct {
+        http_conn::HTTP_CODE code;
+        int status;
+        const char* title;
+        const char* form;
+        const char* extra;      // 额外的响应头
+    } defs[ CANNED_COUNT ] = {
+        { http_conn::INTERNAL_ERROR, 500, error_500_title, error_500_form, "" },
+        { http_conn::BAD_REQUEST, 400, error_400_title, error_400_form, "" },
+        { http_conn::NO_RESOURCE, 404, error_404_title, error_404_form, "" },
+        { http_conn::FORBIDDEN_REQUEST, 403, error_403_title, error_403_form, "" },
+        { http_conn::CREATED_REQUEST, 201, ok_201_title, ok_201_form, "" },
+        { http_conn::TOO_MANY_REQUESTS, 429, error_429_title, error_429_form, "Retry-After: 1\r\n" },
+    };
+    canned_response* table = new canned_response[ CANNED_COUNT ];
+    for ( int i = 0; i < CANNED_COUNT; ++i ) {
+        char buf[ 256 ];
+        table[i].code = defs[i].code;
+        for ( int linger = 0; linger < 2; ++linger ) {
+            snprintf( buf, sizeof( buf ), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\nContent-Type:text/html\r\n%sConnection: %s\r\n",
+                      defs[i].status, defs[i].title, strlen( defs[i].form ), defs[i].extra, linger ? "keep-alive" : "close" );
+            table[i].head[ linger ] = buf;
+        }
+        table[i].tail = std::string( "\r\n" ) + defs[i].form;
+    }
+    return table;
+}
+
+static const canned_response* find_canned(http_conn::HTTP_CODE code)
+{
+    static const canned_response* table = build_canned();     // 局部静态变量的初始化是线程安全的
+    for ( int i = 0; i < CANNED_COUNT; ++i ) {
+        if ( table[i].code == code ) {
+            return &table[i];
+        }
+    }
+    return NULL;
+}
 
-// 网站的根目录
-const char * doc_root = "/run/media/root/study/C++work/webserver/resources";
+// 处理结果对应的状态码
+static int response_status(http_conn::HTTP_CODE code)
+{
+    switch ( code ) {
+    case http_conn::FILE_REQUEST:
+    case http_conn::ASSET_REQUEST:
+        return 200;
+    case http_conn::CREATED_REQUEST:
+        return 201;
+    case http_conn::NOT_MODIFIED:
+        return 304;
+    case http_conn::BAD_REQUEST:
+        return 400;
+    case http_conn::FORBIDDEN_REQUEST:
+        return 403;
+    case http_conn::NO_RESOURCE:
+        return 404;
+    case http_conn::TOO_MANY_REQUESTS:
+        return 429;
+    default:
+        return 500;
+    }
+}
+
+// 反向代理，没有配置转发规则时为空
+proxy_pool* http_conn::m_proxy_pool = NULL;
+
+// TLS，没有配置证书时为空
+tls_context* http_conn::m_tls = NULL;
+io_pool* http_conn::m_io_pool = NULL;
+neg_cache* http_conn::m_neg_cache = NULL;
+int http_conn::m_root_fd = -1;
+rate_limiter* http_conn::m_limiter = NULL;
+
+// 网站的根目录，可以在启动参数中指定
+const char * http_conn::m_doc_root = "./resources";
+// 静态资源包
+asset_pack http_conn::m_asset_pack;
+// PUT 上传只允许写入网站根目录下的这个子目录
+const char * upload_prefix = "/upload/";
+
+static int normalize_url(char* url);
+static int open_dir_beneath(int dirfd, const char* path);
+
+// 默认的请求体处理器：PUT 写入 upload 目录下的文件，其余方法的请求体缓存到池化的块中
+static body_handler* default_body_hook(http_conn::METHOD method, const char* url, long)
+{
+    // 在副本上规范化（解码 %XX、去掉 . 和 ..、去掉查询串），请求行里的 URL 留给 do_request
+    char path[ http_conn::FILENAME_LEN ];
+    int len = -1;
+    if( strlen( url ) < sizeof(path) ) {
+        strcpy( path, url );
+        len = normalize_url( path );
+    }
+
+    // 转发给后端的请求体先缓存，再随请求一起发出。和 do_request 一样按规范的路径匹配转发规则
+    if( method != http_conn::PUT
+        || ( len >= 0 && http_conn::m_proxy_pool && http_conn::m_proxy_pool->match( path, len ) ) ) {
+        return new chunk_buffer_handler( http_conn::MAX_BUFFERED_BODY );
+    }
+    if( len < 0 ) {
+        return NULL;
+    }
+    path[ len ] = '\0';
+    // 只能写 upload 目录下的文件，最后一段为空（目录本身）的不行
+    size_t prefix_len = strlen( upload_prefix );
+    if( (size_t)len <= prefix_len || strncmp( path, upload_prefix, prefix_len ) != 0 || path[ len - 1 ] == '/' ) {
+        return NULL;
+    }
+
+    // 目录相对根目录打开，不允许经过符号链接，之后文件都相对这个目录创建
+    char* name = strrchr( path, '/' );
+    *name++ = '\0';
+    int dirfd = open_dir_beneath( http_conn::m_root_fd, path + 1 );
+    if( dirfd < 0 ) {
+        return NULL;
+    }
+    return new file_sink_handler( dirfd, name );
+}
+
+http_conn::body_hook http_conn::m_body_hook = default_body_hook;
 
 //设置文件描述符非阻塞
 void setnonblocking(int fd)
@@ -71,13 +212,17 @@ void modfd(int epollfd,int fd,int ev)
 }
 
 http_conn::http_conn()
+    : m_generation(0), m_in_process(false), m_close_pending(false), m_buffers(NULL), m_read_buf(NULL), m_write_buf(NULL), m_body_handler(NULL), m_file_address(0), m_file_fd(-1), m_ready_end(NULL), m_co(NULL), m_proxy(NULL), m_h2(NULL), m_ssl(NULL), m_tls_ready(false), m_request_start(0), m_status(0), m_last_size(0)
 {
-
+    m_splice_pipe[0] = m_splice_pipe[1] = -1;
 }
 
 http_conn::~http_conn()
 {
-
+    delete m_h2;
+    release_body();
+    unmap();
+    release_buffers();
 }
 
 //有线程池的工作线程调用，这是处理HTTP请求的入口函数
@@ -85,37 +230,88 @@ void http_conn::process()       // 线程池中线程的业务处理
 {
     EMlog(LOGLEVEL_DEBUG, "=======parse request, create response.=======\n");
 
+    // TLS 握手的密钥交换比较耗时，放在工作线程中做
+    if(m_ssl && !m_tls_ready){
+        if(!do_handshake()){
+            defer_close();
+        }
+        return;
+    }
+
+    // 连接的第一个请求以 HTTP/2 连接序言开头（prior knowledge），切换到 HTTP/2
+    if(!m_h2 && m_checked_idx==0 && m_read_idx>0){
+        int preface=h2_session::check_preface(m_read_buf,m_read_idx);
+        if(preface==0){                     // 还不能判断，继续接收
+            modfd(m_epollfd,m_sockfd,EPOLLIN);
+            return;
+        }
+        if(preface>0){
+            m_h2=new h2_session(this);
+        }
+    }
+    if(m_h2){
+        process_h2();
+        return;
+    }
+
+    m_trace.mark_worker();
+
     //解析HTTP请求
     EMlog(LOGLEVEL_DEBUG,"=============process_reading=============\n");
     HTTP_CODE read_ret=process_read();
+    // 已经解密的数据可能还留在SSL中，socket不会再触发EPOLLIN，先读出来继续解析
+    while(read_ret==NO_REQUEST && m_ssl && SSL_pending(m_ssl)>0 && m_read_idx<READ_BUFFER_SIZE && recv_buf()){
+        read_ret=process_read();
+    }
     EMlog(LOGLEVEL_INFO,"========PROCESS_READ HTTP_CODE : %d========\n", read_ret);
     if(read_ret==NO_REQUEST){               //请求不完整
         modfd(m_epollfd,m_sockfd,EPOLLIN);  // 继续监听EPOLLIN （| EPOLLONESHOT）
         return ;                            // 返回，线程空闲
     }
+    // 转发给后端的请求按 HTTP/1.1 转发，不升级
+    if(read_ret!=BAD_REQUEST && read_ret!=PROXY_REQUEST && upgrade_h2c()){
+        return;                             // 之后这个连接上都是 HTTP/2
+    }
+    if(read_ret==PROXY_REQUEST){
+        if(start_proxy()){
+            return;                         // 响应由主线程从后端转发，这里不能再访问连接
+        }
+        read_ret=INTERNAL_ERROR;
+    }
 
 //    printf("parse request,create response\n");
 
     //生成响应
     EMlog(LOGLEVEL_DEBUG,"=============process_writting=============\n");
     bool write_ret = process_write( read_ret );
+    m_trace.mark(TP_PROCESS_END);
     if ( !write_ret ) {
-        close_conn();
-        if(timer) m_timer_lst.del_timer(timer);  // 移除其对应的定时器
+        defer_close();
+        return;
     }
     // 重置EPOLLONESHOT
     modfd( m_epollfd, m_sockfd, EPOLLOUT);
 
 }
 
-void http_conn::init(int sockfd, const sockaddr_in &addr)
+bool http_conn::init(int sockfd, const sockaddr_in &addr)
 {
     m_sockfd=sockfd;        // 套接字
     m_address=addr;         // 客户端地址
 
-    //设置端口复用
-    int reuse=1;
-    setsockopt(m_sockfd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
+    m_corked=false;
+    // 设置连接的socket调优参数（TCP_NODELAY、缓冲区大小等）
+    apply_conn_profile(m_sockfd,g_socket_profile);
+
+    m_close_pending=false;
+    m_tls_ready=false;
+    m_ssl = m_tls ? m_tls->new_ssl(m_sockfd) : NULL;
+    if(m_tls && !m_ssl){    // 启用了 TLS 就不能退回明文，交给调用者关闭连接
+        EMlog(LOGLEVEL_WARN, "create SSL for sock_fd %d failed, close it.\n", sockfd);
+        m_sockfd=-1;
+        return false;
+    }
+    m_last_size=0;
 
     //添加到epoll对象中
     addfd(m_epollfd,m_sockfd,true,ET);
@@ -126,19 +322,38 @@ void http_conn::init(int sockfd, const sockaddr_in &addr)
     EMlog(LOGLEVEL_INFO, "The No.%d user. sock_fd = %d, ip = %s.\n", m_user_count, sockfd, str);
 
     init();
+    m_trace.on_accept();
 
     // 创建定时器，设置其回调函数与超时时间，然后绑定定时器与用户数据，最后将定时器添加到链表timer_lst中
+    // 新连接先等请求头（TLS 握手也算在内）
     util_timer* new_timer = new util_timer;
     new_timer->user_data = this;
-    time_t curr_time = time(NULL);
-    new_timer->exprie = curr_time + 3 * TIMESLOT;
+    new_timer->phase = PHASE_HEADER;
+    new_timer->start = time(NULL);
+    new_timer->exprie = new_timer->start + phase_timeout(PHASE_HEADER, m_user_count);
     this->timer = new_timer;
     m_timer_lst.add_timer(new_timer);
+    return true;
 }
 
 void http_conn::close_conn()
 {
+    if(m_proxy){                            // 放弃正在转发的请求
+        m_proxy_pool->abort(m_proxy);
+        m_proxy=NULL;
+    }
+    if(m_h2){                               // 释放所有流
+        delete m_h2;
+        m_h2=NULL;
+    }
+    if(m_ssl){
+        tls_close(m_ssl);
+        m_ssl=NULL;
+    }
+    release_body();         // 没收完的上传马上删掉临时文件，不等 fd 被复用
+    release_buffers();
     if(m_sockfd!=-1){
+        m_generation.fetch_add(1,std::memory_order_release);   // 还在线程池队列中的任务作废
         m_user_count--;     //关闭一个连接，总用户数-1
         EMlog(LOGLEVEL_INFO, "closing fd: %d, rest user num :%d\n", m_sockfd, m_user_count);
         removefd(m_epollfd,m_sockfd);
@@ -146,26 +361,115 @@ void http_conn::close_conn()
     }
 }
 
-//循环的读取客户数据，直到无数据刻度或者对方关闭连接
-bool http_conn::read()
+// 和 expire() 配对：各自先写自己的标记再读对方的，两边都用顺序一致的原子操作，
+// 至少有一边能看到另一边，不会出现工作线程在处理、主线程同时释放连接的情况
+bool http_conn::enter(unsigned generation)
+{
+    m_in_process.store( true, std::memory_order_seq_cst );
+    if( m_generation.load( std::memory_order_seq_cst ) != generation ) {
+        m_in_process.store( false, std::memory_order_release );
+        return false;
+    }
+    return true;
+}
+
+bool http_conn::expire()
+{
+    m_generation.fetch_add( 1, std::memory_order_seq_cst );
+    return !m_in_process.load( std::memory_order_seq_cst );
+}
+
+void http_conn::arm_timer(int phase)
 {
     if(timer) {             // 更新超时时间
-        time_t curr_time = time( NULL );
-        timer->exprie = curr_time + 3 * TIMESLOT;
+        timer->phase = phase;
+        timer->start = time( NULL );
+        timer->exprie = timer->start + phase_timeout( phase, m_user_count );
         m_timer_lst.adjust_timer( timer );
     }
+}
+
+// 有数据收发时推迟超时时间
+void http_conn::refresh_timer()
+{
+    arm_timer( PHASE_IDLE );
+}
+
+//循环的读取客户数据，直到无数据刻度或者对方关闭连接
+bool http_conn::read()
+{
+    if ( m_h2 ) {
+        arm_timer( PHASE_IDLE );            // 多路复用的连接上请求交错，只按空闲计时
+    } else if ( m_checked_state == CHECK_STATE_CONTENT ) {
+        arm_timer( PHASE_BODY );
+    } else if ( timer && timer->phase != PHASE_HEADER ) {
+        arm_timer( PHASE_HEADER );          // 空闲的长连接来了新请求，从现在开始等请求头
+    }
+    // 已经在等请求头的不推迟
+
+    if(!m_buffers){                         // 空闲的长连接来了新请求，重新取得缓冲区
+        attach_buffers();
+    }
 
     if(m_read_idx>=READ_BUFFER_SIZE){       // 超过缓冲区大小
         return false;
     }
 
+    // 请求体直接splice到文件时，数据留在socket里，由工作线程搬运
+    if(m_checked_state==CHECK_STATE_CONTENT && !m_chunked && !m_ssl && m_body_handler && m_body_handler->sink_fd()!=-1){
+        return true;
+    }
+
+    // TLS 握手还没完成，交给工作线程继续握手
+    if(m_ssl && !m_tls_ready){
+        return true;
+    }
+
+    // 新请求的第一次读，决定是否跟踪这个请求
+    bool first=(m_read_idx==0 && m_checked_state==CHECK_STATE_REQUESTLINE && !m_h2);
+    if(first){
+        m_trace.begin();
+        if(access_log_enabled()){
+            m_request_start=trace_now();
+        }
+    }
+
+    if(!recv_buf()){
+        return false;
+    }
+    m_trace.mark(TP_READ_END);
+
+    // 新请求先按客户端地址限速，超过的直接回 429 后关闭连接，不进线程池
+    if(first && m_read_idx>0 && m_limiter && !m_limiter->allow(m_address.sin_addr.s_addr)){
+        m_limited=true;
+        m_linger=false;
+        if(!process_write(TOO_MANY_REQUESTS)){
+            return false;
+        }
+        modfd(m_epollfd,m_sockfd,EPOLLOUT);
+        return true;
+    }
+
+//    printf("读取到了数据：\n %s\n",m_read_buf);
+
+    ++m_request_count;
+
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d read done. request cnt = %d\n", m_sockfd, m_request_count);    // 全部读取完毕
+
+    return true;
+}
+
+bool http_conn::recv_buf()
+{
     //读取到的字节
     int byetes_read=0;
     //一次性读完是这个函数能一次性读完，读是在while里循环读的，并不是调用一次recv就全部读到了，所以要用idx记录赏赐读到的位置
     // m_sock_fd已设置非阻塞
-    while(true){
+    // 缓冲区满了就先交给工作线程处理，请求体会被消费掉腾出空间，EPOLLONESHOT重新注册后还会再触发
+    while(m_read_idx<READ_BUFFER_SIZE){
         // 从m_read_buf + m_read_idx索引出开始保存数据，大小是READ_BUFFER_SIZE - m_read_idx
-        byetes_read=recv(m_sockfd,m_read_buf+m_read_idx,READ_BUFFER_SIZE-m_read_idx,0);
+        byetes_read=m_ssl ? tls_recv(m_ssl,m_read_buf+m_read_idx,READ_BUFFER_SIZE-m_read_idx)
+                          : recv(m_sockfd,m_read_buf+m_read_idx,READ_BUFFER_SIZE-m_read_idx,0);
         if(byetes_read==-1){
             if(errno==EAGAIN||errno==EWOULDBLOCK){
                 //没有数据
@@ -178,13 +482,30 @@ bool http_conn::read()
         }
         m_read_idx+=byetes_read;
     }
+    return true;
+}
 
-//    printf("读取到了数据：\n %s\n",m_read_buf);
-
-    ++m_request_count;
-
-    EMlog(LOGLEVEL_INFO, "sock_fd = %d read done. request cnt = %d\n", m_sockfd, m_request_count);    // 全部读取完毕
+ssize_t http_conn::sock_writev(const iovec *iv, int count)
+{
+    return m_ssl ? tls_writev( m_ssl, iv, count ) : writev( m_sockfd, iv, count );
+}
 
+bool http_conn::do_handshake()
+{
+    bool want_write = false;
+    int ret = tls_handshake( m_ssl, want_write );
+    if ( ret < 0 ) {
+        return false;
+    }
+    if ( ret == 0 ) {
+        modfd( m_epollfd, m_sockfd, want_write ? EPOLLOUT : EPOLLIN );
+        return true;
+    }
+    m_tls_ready = true;
+    EMlog(LOGLEVEL_DEBUG, "sock_fd = %d TLS handshake done, %s, resumed: %d, ktls send: %d\n",
+          m_sockfd, SSL_get_version( m_ssl ), SSL_session_reused( m_ssl ), tls_ktls_send( m_ssl ));
+    // 重新注册EPOLLIN，握手后已经到达的请求数据会立即触发
+    modfd( m_epollfd, m_sockfd, EPOLLIN );
     return true;
 }
 
@@ -192,10 +513,26 @@ bool http_conn::write()
 {
     int temp = 0;
 
-    if(timer) {             // 更新超时时间
-        time_t curr_time = time( NULL );
-        timer->exprie = curr_time + 3 * TIMESLOT;
-        m_timer_lst.adjust_timer( timer );
+    if ( m_close_pending ) {    // 工作线程要求关闭，返回false由主线程关闭连接、删除定时器
+        return false;
+    }
+
+    if ( m_ssl && !m_tls_ready ) {     // 握手时socket写满了，密钥已经算完，剩下的在这里发完
+        return do_handshake();      // 握手还在等请求头的超时内
+    }
+    refresh_timer();
+
+    if ( m_proxy ) {        // 正在转发后端的响应，客户端可写了继续转发
+        m_proxy_pool->on_client_writable( m_proxy );
+        return true;
+    }
+
+    if ( m_h2 ) {           // HTTP/2 继续发送排队的帧
+        if ( !m_h2->flush() ) {
+            return false;
+        }
+        modfd( m_epollfd, m_sockfd, EPOLLIN | ( m_h2->want_write() ? (int)EPOLLOUT : 0 ) );
+        return true;
     }
 
 //    bytes_have_send = 0;    // 已经发送的字节
@@ -210,13 +547,37 @@ bool http_conn::write()
         return true;
     }
 
+    m_trace.mark_write();
+
+    // 大响应可能要分多次writev才能发完，先塞住，避免响应头或者结尾单独成为一个小报文段
+    if ( bytes_to_send > WRITE_BUFFER_SIZE && g_socket_profile.cork && !m_corked ) {
+        set_cork( m_sockfd, true );
+        m_corked = true;
+    }
+
     while(1) {
-        // 分散写  m_write_buf + m_file_address
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        // 从文件映射发送的部分只发确认在页缓存中的，冷数据等I/O线程读完再发，不在主线程中等磁盘
+        struct iovec iv[ 3 ];
+        const struct iovec* out = m_iv;
+        if ( m_file_fd != -1 && m_iv_count == 2 && m_iv[ 1 ].iov_len > 0 ) {
+            if ( !file_window_ready() ) {
+                return true;                // 读完后由 on_io_done 重新注册 EPOLLOUT
+            }
+            memcpy( iv, m_iv, sizeof( iv ) );
+            size_t ready = m_ready_end - (char*)iv[ 1 ].iov_base;
+            if ( iv[ 1 ].iov_len > ready ) {
+                iv[ 1 ].iov_len = ready;
+            }
+            out = iv;
+        }
+
+        // 分散写  m_write_buf + m_file_address（或者资源包中的响应头和文件内容）
+        temp = sock_writev(out, m_iv_count);
         if ( temp <= -1 ) {
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if( errno == EAGAIN ) {
+                ++m_trace.eagain;
                 modfd( m_epollfd, m_sockfd, EPOLLOUT );
                 return true;
             }
@@ -226,22 +587,35 @@ bool http_conn::write()
         bytes_to_send -= temp;
         bytes_have_send += temp;
 
-        if (bytes_have_send >= m_iv[0].iov_len){    // 发完头部了
-            m_iv[0].iov_len = 0;                    // 更新两个发送内存块的信息
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);    // 已经发了部分的响应体数据
-            m_iv[1].iov_len = bytes_to_send;
-        }else{                                      // 还没发完头部
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - temp;
+        // 依次跳过已经发完的内存块，更新发了一部分的内存块
+        for ( int i = 0; i < m_iv_count && temp > 0; ++i ) {
+            if ( (size_t)temp >= m_iv[i].iov_len ) {
+                temp -= m_iv[i].iov_len;
+                m_iv[i].iov_len = 0;
+            } else {
+                m_iv[i].iov_base = (char*)m_iv[i].iov_base + temp;
+                m_iv[i].iov_len -= temp;
+                temp = 0;
+            }
         }
 
         if ( bytes_to_send <= 0 ) {
             // 发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
             // 没有数据要发送了
+            m_trace.mark(TP_WRITE_END);
+            trace_commit(m_trace, m_sockfd, m_url);
+            log_access( bytes_have_send, m_linger ? ACCESS_KEEP_ALIVE : 0 );
             unmap();
+            if ( m_corked ) {       // 拔掉塞子，剩下不满一个报文段的数据立即发出
+                set_cork( m_sockfd, false );
+                m_corked = false;
+            }
             modfd( m_epollfd, m_sockfd, EPOLLIN );
             if(m_linger) {
                 init();
+                if ( !m_h2 ) {              // 等待下一个请求期间不占用缓冲区
+                    release_buffers();
+                }
 //                modfd( m_epollfd, m_sockfd, EPOLLIN );
                 return true;
             } else {
@@ -253,9 +627,129 @@ bool http_conn::write()
     return true;
 }
 
+void http_conn::defer_close()
+{
+    m_close_pending = true;
+    modfd( m_epollfd, m_sockfd, EPOLLOUT );
+}
+
+void http_conn::process_h2()
+{
+    bool ok = m_h2->on_data( m_read_buf, m_read_idx );
+    m_read_idx = 0;
+    // 出错时 GOAWAY 也要尽量发出去再关闭
+    if ( !m_h2->flush() || !ok ) {
+        defer_close();
+        return;
+    }
+    // 同时关注可读：发送等待窗口更新时，WINDOW_UPDATE 要能读进来
+    modfd( m_epollfd, m_sockfd, EPOLLIN | ( m_h2->want_write() ? (int)EPOLLOUT : 0 ) );
+}
+
+bool http_conn::upgrade_h2c()
+{
+    // 只升级没有请求体的请求，带请求体的请求在 HTTP/1.1 下完成
+    const char* upgrade = get_header( HDR_UPGRADE );
+    const char* settings = get_header( "HTTP2-Settings" );
+    if ( m_h2 || !upgrade || !settings || !strcasestr( upgrade, "h2c" ) || m_content_length > 0 || m_chunked ) {
+        return false;
+    }
+
+    // 升级前的请求作为流1重新生成响应
+    static const char* methods[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT" };
+    std::vector<hpack_header> request;
+    hpack_header h;
+    h.name = ":method";
+    h.value = methods[ m_method ];
+    request.push_back( h );
+    h.name = ":path";
+    h.value = m_url;
+    request.push_back( h );
+    for ( int i = 0; i < m_headers.count(); ++i ) {
+        const header_table::entry& e = m_headers.at( i );
+        if ( e.id == HDR_CONNECTION || e.id == HDR_UPGRADE ) {
+            continue;
+        }
+        h.name.assign( m_read_buf + e.name.off, e.name.len );
+        for ( size_t k = 0; k < h.name.size(); ++k ) {
+            h.name[k] = tolower( (unsigned char)h.name[k] );
+        }
+        h.value.assign( m_read_buf + e.value.off, e.value.len );
+        request.push_back( h );
+    }
+    unmap();
+    m_asset = NULL;
+
+    m_h2 = new h2_session( this );
+    if ( !m_h2->upgrade( settings, request ) ) {
+        defer_close();
+        return true;
+    }
+    // 请求之后已经收到的数据（客户端连接序言）交给 HTTP/2 处理
+    memmove( m_read_buf, m_read_buf + m_checked_idx, m_read_idx - m_checked_idx );
+    m_read_idx -= m_checked_idx;
+    process_h2();
+    return true;
+}
+
+void http_conn::send_canned(int fd, HTTP_CODE code)
+{
+    const canned_response* c = find_canned( code );
+    struct iovec iv[ 2 ];
+    iv[ 0 ].iov_base = (void*)c->head[ 0 ].data();
+    iv[ 0 ].iov_len = c->head[ 0 ].size();
+    iv[ 1 ].iov_base = (void*)c->tail.data();
+    iv[ 1 ].iov_len = c->tail.size();
+    struct msghdr msg;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = iv;
+    msg.msg_iovlen = 2;
+    // 新连接的发送缓冲区是空的，一次就能写完；写不完也不等
+    sendmsg( fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL );
+}
+
+void http_conn::init_stream(const sockaddr_in &addr)
+{
+    m_sockfd = -1;
+    m_address = addr;       // 所在连接的客户端地址，用于访问限制和访问日志
+    m_ssl = NULL;
+    m_tls_ready = false;
+    m_corked = false;
+    timer = NULL;
+    attach_buffers();
+    init();
+}
+
+bool http_conn::process_stream(const std::string &request)
+{
+    // 请求体较大时读缓冲区装不下，边填边解析，解析请求体时会腾出空间
+    size_t pos = 0;
+    HTTP_CODE ret = NO_REQUEST;
+    while ( ret == NO_REQUEST && pos < request.size() ) {
+        size_t n = request.size() - pos;
+        if ( n > (size_t)( READ_BUFFER_SIZE - m_read_idx ) ) {
+            n = READ_BUFFER_SIZE - m_read_idx;
+        }
+        if ( n == 0 ) {         // 请求头太长
+            break;
+        }
+        memcpy( m_read_buf + m_read_idx, request.data() + pos, n );
+        m_read_idx += n;
+        pos += n;
+        ret = process_read();
+    }
+    if ( ret == NO_REQUEST ) {
+        ret = BAD_REQUEST;
+    } else if ( ret == PROXY_REQUEST ) {
+        ret = INTERNAL_ERROR;   // HTTP/2 的流不经过反向代理
+    }
+    return process_write( ret );
+}
+
 void http_conn::init()
 {
     m_checked_state=CHECK_STATE_REQUESTLINE;    //初始化状态为解析请求首行
+    m_limited=false;
     m_checked_idx=0;
     m_start_line=0;
     m_read_idx=0;
@@ -266,17 +760,50 @@ void http_conn::init()
 
     m_method=GET;   // 默认请求方式为GET
     m_url=0;
+    m_path_len=0;
     m_version=0;
     m_content_length = 0;
+    m_has_content_length = false;
+    m_chunked = false;
+    m_expect_continue = false;
     m_host = 0;
+    m_asset = NULL;
     m_linger=false; //默认不保持链接  Connection : keep-alive保持连接
+    m_headers.clear();
+    m_trace.sampled = false;
+
+    release_body();
+    m_body_received = 0;
+    m_body_start = 0;
+    m_chunk_state = CHUNK_SIZE;
+    m_chunk_left = 0;
 
+    if(!m_buffers){     // 空闲连接没有缓冲区
+        return;
+    }
 //    bzero(m_read_buf,READ_BUFFER_SIZE);         // 清空读缓存
     memset(m_read_buf,'\0',READ_BUFFER_SIZE);
 //    bzero(m_write_buf, WRITE_BUFFER_SIZE);      // 清空写缓存
     memset(m_write_buf,'\0',WRITE_BUFFER_SIZE);
-//    bzero(m_real_file, FILENAME_LEN);           // 清空文件路径
-    memset(m_real_file,'\0', FILENAME_LEN);
+}
+
+void http_conn::attach_buffers()
+{
+    if ( m_buffers ) {
+        return;
+    }
+    m_buffers = new buffers;
+    m_read_buf = m_buffers->read_buf;
+    m_write_buf = m_buffers->write_buf;
+    memset( m_read_buf, '\0', READ_BUFFER_SIZE );
+    memset( m_write_buf, '\0', WRITE_BUFFER_SIZE );
+}
+
+void http_conn::release_buffers()
+{
+    delete m_buffers;
+    m_buffers = NULL;
+    m_read_buf = m_write_buf = NULL;
 }
 
 //主状态机
@@ -298,7 +825,9 @@ http_conn::HTTP_CODE http_conn::process_read()
         m_start_line=m_checked_idx; // 更新下一行的起始位置
 
 //        printf("got 1 http line: %s\n",text);
-        EMlog(LOGLEVEL_DEBUG, ">>>>>> %s\n", text);
+        if(m_checked_state!=CHECK_STATE_CONTENT){   // 请求体不一定以\0结尾，不打印
+            EMlog(LOGLEVEL_DEBUG, ">>>>>> %s\n", text);
+        }
 
         switch(m_checked_state){
             case CHECK_STATE_REQUESTLINE:
@@ -315,19 +844,29 @@ http_conn::HTTP_CODE http_conn::process_read()
                 if(ret==BAD_REQUEST){
                     return BAD_REQUEST;
                 }else if(ret==GET_REQUEST){
-                    return do_request();        // 解析具体的请求信息
+                    m_trace.mark(TP_REQUEST_BEGIN);
+                    ret=do_request();           // 解析具体的请求信息
+                    m_trace.mark(TP_REQUEST_END);
+                    return ret;
+                }else if(ret!=NO_REQUEST){
+                    m_linger=false;             // 请求体被拒绝（403/500），没有读，不能再解析下一个请求
+                    return ret;
                 }
                 break;
             }
             case CHECK_STATE_CONTENT:
             {
-                ret=parse_request_content(text);
+                ret=parse_request_content();
                 if(ret==GET_REQUEST){
-                    return do_request();        // 解析具体的请求信息
+                    m_trace.mark(TP_REQUEST_BEGIN);
+                    ret=do_request();           // 解析具体的请求信息
+                    m_trace.mark(TP_REQUEST_END);
+                    return ret;
+                }else if(ret!=NO_REQUEST){
+                    m_linger=false;             // 请求体没读完，剩下的数据无法再当作下一个请求解析
+                    return ret;
                 }
-                line_status=LINE_OPEN;
-
-                break;
+                return NO_REQUEST;              // 请求体不完整，继续接收
             }
             default:
                 return INTERNAL_ERROR;          //内部错误
@@ -339,40 +878,56 @@ http_conn::HTTP_CODE http_conn::process_read()
 // 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
 bool http_conn::process_write(HTTP_CODE ret)
 {
+    m_status = response_status( ret );
+    m_last_size = 0;
     switch (ret)
     {
     case INTERNAL_ERROR:
-        add_status_line( 500, error_500_title );
-        add_headers( strlen( error_500_form ) ,time(NULL));
-        if ( ! add_content( error_500_form ) ) {
-                return false;
-        }
-        break;
     case BAD_REQUEST:
-        add_status_line( 400, error_400_title );
-        add_headers( strlen( error_400_form ) ,time(NULL));
-        if ( ! add_content( error_400_form ) ) {
-                return false;
-        }
-        break;
     case NO_RESOURCE:
-        add_status_line( 404, error_404_title );
-        add_headers( strlen( error_404_form ) ,time(NULL));
-        if ( ! add_content( error_404_form ) ) {
-                return false;
-        }
-        break;
     case FORBIDDEN_REQUEST:
-        add_status_line( 403, error_403_title );
-        add_headers(strlen( error_403_form),time(NULL));
-        if ( ! add_content( error_403_form ) ) {
-                return false;
+    case CREATED_REQUEST:
+    case TOO_MANY_REQUESTS:
+    {
+        // 预先生成的响应头和响应体直接发送，写缓冲区里只有 Date
+        const canned_response* c = find_canned( ret );
+        if ( !add_date( time( NULL ) ) ) {
+            return false;
         }
-        break;
+        const std::string& head = c->head[ m_linger ? 1 : 0 ];
+        m_iv[ 0 ].iov_base = (void*)head.data();
+        m_iv[ 0 ].iov_len = head.size();
+        m_iv[ 1 ].iov_base = m_write_buf;
+        m_iv[ 1 ].iov_len = m_write_idx;
+        m_iv[ 2 ].iov_base = (void*)c->tail.data();
+        m_iv[ 2 ].iov_len = c->tail.size();
+        m_iv_count = 3;
+        bytes_to_send = m_iv[ 0 ].iov_len + m_iv[ 1 ].iov_len + m_iv[ 2 ].iov_len;
+        return true;
+    }
+    case ASSET_REQUEST:
+    case NOT_MODIFIED:
+    {
+        // 状态行和固定的响应头在资源包里已经生成好了，这里只补上随请求变化的部分
+        if ( !add_linger() || !add_date( time( NULL ) ) || !add_blank_line() ) {
+            return false;
+        }
+        bool not_modified = ( ret == NOT_MODIFIED );
+        m_iv[ 0 ].iov_base = (void*)m_asset_pack.at( not_modified ? m_asset->nm_off : m_asset->ok_off );
+        m_iv[ 0 ].iov_len = not_modified ? m_asset->nm_len : m_asset->ok_len;
+        m_iv[ 1 ].iov_base = m_write_buf;
+        m_iv[ 1 ].iov_len = m_write_idx;
+        m_iv[ 2 ].iov_base = (void*)m_asset_pack.at( m_asset->body_off );
+        m_iv[ 2 ].iov_len = not_modified ? 0 : m_asset->body_len;
+        m_iv_count = not_modified ? 2 : 3;
+        m_last_size = m_iv[ 2 ].iov_len;
+        bytes_to_send = m_iv[ 0 ].iov_len + m_iv[ 1 ].iov_len + m_iv[ 2 ].iov_len;
+        return true;
+    }
     case FILE_REQUEST:
         add_status_line(200, ok_200_title );
         add_headers(m_file_stat.st_size,time(NULL));
-        EMlog(LOGLEVEL_DEBUG, "<<<<<<< %s", m_file_address);
+        EMlog(LOGLEVEL_DEBUG, "<<<<<<< %s", m_url);
         // 封装m_iv
         m_iv[ 0 ].iov_base = m_write_buf;
         m_iv[ 0 ].iov_len = m_write_idx;
@@ -380,6 +935,7 @@ bool http_conn::process_write(HTTP_CODE ret)
         m_iv[ 1 ].iov_len = m_file_stat.st_size;
         m_iv_count = 2; // 两块内存
         bytes_to_send = m_write_idx + m_file_stat.st_size;  // 响应头的大小 + 文件的大小
+        m_last_size = m_file_stat.st_size;
         return true;
     default:
         return false;
@@ -388,6 +944,7 @@ bool http_conn::process_write(HTTP_CODE ret)
     m_iv[ 0 ].iov_base = m_write_buf;
     m_iv[ 0 ].iov_len = m_write_idx;
     m_iv_count = 1;
+    bytes_to_send = m_write_idx;
     return true;
 }
 
@@ -403,6 +960,10 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     char * method=text;
     if(strcasecmp(method,"GET")==0){    // 忽略大小写比较
         m_method=GET;
+    }else if(strcasecmp(method,"POST")==0){
+        m_method=POST;
+    }else if(strcasecmp(method,"PUT")==0){
+        m_method=PUT;
     }else{
         return BAD_REQUEST;
     }
@@ -445,50 +1006,288 @@ http_conn::HTTP_CODE http_conn::parse_request_headers(char *text)
     // 遇到空行，表示头部字段解析完毕
     if( text[0] == '\0' ) {
         // 如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体，
-        // 状态机转移到CHECK_STATE_CONTENT状态
-        if ( m_content_length != 0 ) {      // 请求体有内容
-                m_checked_state = CHECK_STATE_CONTENT;
-                return NO_REQUEST;
+        // 状态机转移到CHECK_STATE_CONTENT状态。PUT 即使请求体为空也要创建文件
+        // 同时带 Content-Length 和 chunked 的请求边界有歧义，直接拒绝
+        if ( m_chunked && m_has_content_length ) {
+            return BAD_REQUEST;
+        }
+        if ( m_chunked || m_content_length != 0 || m_method == PUT ) {
+                return begin_body();
         }
         // 否则说明我们已经得到了一个完整的HTTP请求
         return GET_REQUEST;
-    } else if ( strncasecmp( text, "Connection:", 11 ) == 0 ) {
-        // 处理Connection 头部字段  Connection: keep-alive
-        text += 11;
-        text += strspn( text, " \t" );      // 检索字符串 str1 中第一个不在字符串 str2 中出现的字符下标。
-        if ( strcasecmp( text, "keep-alive" ) == 0 ) {
+    }
+
+    // 名字: 值
+    char* colon = strchr( text, ':' );
+    if ( !colon || colon == text ) {
+        return BAD_REQUEST;
+    }
+    int name_len = colon - text;
+    char* value = colon + 1;
+    value += strspn( value, " \t" );       // 检索字符串 str1 中第一个不在字符串 str2 中出现的字符下标。
+    int value_len = strlen( value );
+    while ( value_len > 0 && ( value[ value_len - 1 ] == ' ' || value[ value_len - 1 ] == '\t' ) ) {
+        value[ --value_len ] = '\0';        // 去掉值末尾的空白，值仍然以\0结尾
+    }
+
+    // 请求头只记录在读缓冲区中的位置，不拷贝
+    HEADER_ID id = header_lookup( text, name_len );
+    if ( !m_headers.add( id, text - m_read_buf, name_len, value - m_read_buf, value_len ) ) {
+        return BAD_REQUEST;                 // 请求头太多
+    }
+
+    switch ( id ) {
+        case HDR_CONNECTION:
+            // 处理Connection 头部字段  Connection: keep-alive
+            if ( strcasecmp( value, "keep-alive" ) == 0 ) {
                 m_linger = true;
+            }
+            break;
+        case HDR_CONTENT_LENGTH: {
+            // 处理Content-Length头部字段：只能是十进制数字，重复出现时必须一致，
+            // 否则前后两级对请求边界的理解可能不同（请求走私）
+            long length = 0;
+            if ( value_len == 0 || value_len > 18 || (int)strspn( value, "0123456789" ) != value_len ) {
+                return BAD_REQUEST;
+            }
+            for ( int i = 0; i < value_len; ++i ) {
+                length = length * 10 + ( value[i] - '0' );
+            }
+            if ( m_has_content_length && length != m_content_length ) {
+                return BAD_REQUEST;
+            }
+            m_content_length = length;
+            m_has_content_length = true;
+            break;
         }
-    } else if ( strncasecmp( text, "Content-Length:", 15 ) == 0 ) {
-        // 处理Content-Length头部字段
-        text += 15;
-        text += strspn( text, " \t" );
-        m_content_length = atol(text);
-    } else if ( strncasecmp( text, "Host:", 5 ) == 0 ) {
-        // 处理Host头部字段
-        text += 5;
-        text += strspn( text, " \t" );
-        m_host = text;
-    } else {
-//        printf( "oop! unknow header %s\n", text );
-        #ifdef COUT_OPEN
-            EMlog(LOGLEVEL_DEBUG,"oop! unknow header: %s\n", text );
-        #endif
+        case HDR_TRANSFER_ENCODING:
+            // 处理Transfer-Encoding头部字段，只支持chunked
+            if ( strcasecmp( value, "chunked" ) != 0 ) {
+                return BAD_REQUEST;
+            }
+            m_chunked = true;
+            break;
+        case HDR_EXPECT:
+            // 处理Expect头部字段  Expect: 100-continue
+            m_expect_continue = ( strcasecmp( value, "100-continue" ) == 0 );
+            break;
+        case HDR_HOST:
+            // 处理Host头部字段
+            m_host = value;
+            break;
+        default:
+            break;      // 其它请求头留在表里，由需要的地方查询
     }
     return NO_REQUEST;
 }
 
-// 我们没有真正解析HTTP请求的消息体，只是判断它是否被完整的读入了
-http_conn::HTTP_CODE http_conn::parse_request_content(char *text)
+const char *http_conn::get_header(HEADER_ID id) const
 {
-    if ( m_read_idx >= ( m_content_length + m_checked_idx ) )   // 读到的数据长度 大于 已解析长度（请求行+头部+空行）+请求体长度
-    {   // 数据被完整读取
-        text[ m_content_length ] = '\0';        // 标志结束
-        return GET_REQUEST;
+    const header_table::entry* e = m_headers.get( id );
+    return e ? m_read_buf + e->value.off : NULL;
+}
+
+const char *http_conn::get_header(const char *name) const
+{
+    const header_table::entry* e = m_headers.find( m_read_buf, name, strlen( name ) );
+    return e ? m_read_buf + e->value.off : NULL;
+}
+
+// 开始接收请求体：创建请求体处理器，状态机转移到CHECK_STATE_CONTENT状态
+http_conn::HTTP_CODE http_conn::begin_body()
+{
+    m_body_handler = m_body_hook( m_method, m_url, m_chunked ? -1 : m_content_length );
+    if ( !m_body_handler ) {
+        return FORBIDDEN_REQUEST;
+    }
+    if ( !m_body_handler->on_begin( m_chunked ? -1 : m_content_length ) ) {
+        return INTERNAL_ERROR;
+    }
+
+    if ( m_expect_continue ) {
+        // 客户端在等我们同意后才发送请求体，这一行很短，直接发送
+        const char* resp = "HTTP/1.1 100 Continue\r\n\r\n";
+        if ( m_ssl ) {
+            tls_send( m_ssl, resp, strlen( resp ) );
+        } else if ( m_sockfd != -1 ) {      // 没有socket时由调用者发送
+            send( m_sockfd, resp, strlen( resp ), 0 );
+        }
+    }
+
+    m_body_received = 0;
+    m_chunk_state = CHUNK_SIZE;
+    m_body_start = m_checked_idx;
+    m_checked_state = CHECK_STATE_CONTENT;
+    return NO_REQUEST;
+}
+
+// 请求体接收完毕
+http_conn::HTTP_CODE http_conn::end_body()
+{
+    if ( !m_body_handler->on_end() ) {
+        return INTERNAL_ERROR;
+    }
+    return GET_REQUEST;
+}
+
+// 解析HTTP请求的消息体。请求体不需要一次性放进读缓冲区：
+// 读到多少就交给请求体处理器多少，然后把缓冲区腾出来继续接收
+http_conn::HTTP_CODE http_conn::parse_request_content()
+{
+    if ( !m_chunked ) {
+        long n = m_read_idx - m_checked_idx;
+        if ( n > m_content_length - m_body_received ) {
+            n = m_content_length - m_body_received;
+        }
+        if ( n > 0 && !m_body_handler->on_data( m_read_buf + m_checked_idx, n ) ) {
+            return INTERNAL_ERROR;
+        }
+        m_checked_idx += n;
+        m_start_line = m_checked_idx;
+        m_body_received += n;
+
+        if ( m_body_received < m_content_length ) {
+            compact_read_buf();
+            int fd = ( m_ssl || m_sockfd == -1 ) ? -1 : m_body_handler->sink_fd();
+            if ( fd != -1 ) {       // 剩下的数据不经过用户态，直接从socket搬到文件（TLS 的数据要先解密，HTTP/2 的流没有socket，都不能splice）
+                HTTP_CODE ret = splice_body( fd );
+                if ( ret != GET_REQUEST ) {
+                    return ret;
+                }
+            } else {
+                return NO_REQUEST;
+            }
+        }
+        return end_body();
+    }
+
+    // Transfer-Encoding: chunked
+    //   分块大小(十六进制)[;扩展]\r\n 分块数据\r\n ... 0\r\n [trailer]\r\n
+    while ( true ) {
+        if ( m_chunk_state == CHUNK_DATA ) {
+            long n = m_read_idx - m_checked_idx;
+            if ( n > m_chunk_left ) {
+                n = m_chunk_left;
+            }
+            if ( n > 0 && !m_body_handler->on_data( m_read_buf + m_checked_idx, n ) ) {
+                return INTERNAL_ERROR;
+            }
+            m_checked_idx += n;
+            m_start_line = m_checked_idx;
+            m_body_received += n;
+            m_chunk_left -= n;
+            if ( m_chunk_left > 0 ) {
+                break;              // 分块数据不完整
+            }
+            m_chunk_state = CHUNK_DATA_END;
+            continue;
+        }
+
+        LINE_STATUS line_status = parse_line();
+        if ( line_status == LINE_OPEN ) {
+            break;
+        } else if ( line_status == LINE_BAD ) {
+            return BAD_REQUEST;
+        }
+        char* text = get_line();
+        m_start_line = m_checked_idx;
+
+        switch ( m_chunk_state ) {
+            case CHUNK_SIZE:
+            {
+                char* end = NULL;
+                m_chunk_left = strtol( text, &end, 16 );
+                if ( end == text || m_chunk_left < 0 || ( *end != '\0' && *end != ';' && *end != ' ' ) ) {
+                    return BAD_REQUEST;
+                }
+                m_chunk_state = ( m_chunk_left == 0 ) ? CHUNK_TRAILER : CHUNK_DATA;
+                break;
+            }
+            case CHUNK_DATA_END:
+            {
+                if ( text[0] != '\0' ) {
+                    return BAD_REQUEST;
+                }
+                m_chunk_state = CHUNK_SIZE;
+                break;
+            }
+            case CHUNK_TRAILER:
+            {
+                if ( text[0] == '\0' ) {   // 空行，请求体结束
+                    return end_body();
+                }
+                break;                      // 忽略trailer头部
+            }
+            default:
+                return INTERNAL_ERROR;
+        }
     }
+
+    compact_read_buf();
     return NO_REQUEST;
 }
 
+// 循环把socket中的请求体splice到fd，直到读完或者socket暂时没有数据
+http_conn::HTTP_CODE http_conn::splice_body(int fd)
+{
+    if ( m_splice_pipe[0] == -1 && pipe2( m_splice_pipe, O_NONBLOCK ) < 0 ) {
+        m_splice_pipe[0] = m_splice_pipe[1] = -1;
+        return INTERNAL_ERROR;
+    }
+
+    while ( m_body_received < m_content_length ) {
+        ssize_t n = splice( m_sockfd, NULL, m_splice_pipe[1], NULL, m_content_length - m_body_received,
+                            SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+        if ( n == 0 ) {             // 对方关闭连接，请求体不完整
+            return BAD_REQUEST;
+        } else if ( n < 0 ) {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                return NO_REQUEST;  // 等待下一次EPOLLIN
+            }
+            return INTERNAL_ERROR;
+        }
+
+        // 管道中的数据全部搬到目标fd
+        while ( n > 0 ) {
+            ssize_t m = splice( m_splice_pipe[0], NULL, fd, NULL, n, SPLICE_F_MOVE );
+            if ( m <= 0 ) {
+                return INTERNAL_ERROR;
+            }
+            n -= m;
+            m_body_received += m;
+        }
+    }
+    return GET_REQUEST;
+}
+
+// 请求头之前的内容保持不动，m_url、m_host 等指针仍然有效
+void http_conn::compact_read_buf()
+{
+    int shift = m_start_line - m_body_start;
+    if ( shift <= 0 ) {
+        return;
+    }
+    memmove( m_read_buf + m_body_start, m_read_buf + m_start_line, m_read_idx - m_start_line );
+    m_checked_idx -= shift;
+    m_read_idx -= shift;
+    m_start_line = m_body_start;
+    m_read_buf[ m_read_idx ] = '\0';
+}
+
+void http_conn::release_body()
+{
+    if ( m_body_handler ) {
+        delete m_body_handler;
+        m_body_handler = NULL;
+    }
+    if ( m_splice_pipe[0] != -1 ) {
+        close( m_splice_pipe[0] );
+        close( m_splice_pipe[1] );
+        m_splice_pipe[0] = m_splice_pipe[1] = -1;
+    }
+}
+
 //解析一行，判断依据/r/n
 http_conn::LINE_STATUS http_conn::parse_line()
 {
@@ -522,38 +1321,457 @@ http_conn::LINE_STATUS http_conn::parse_line()
     return LINE_OPEN;
 }
 
+static int hex_value(char c)
+{
+    if ( c >= '0' && c <= '9' ) return c - '0';
+    if ( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+    if ( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+    return -1;
+}
+
+// 把URL的路径部分原地规范化：解码 %XX，合并连续的 '/'，去掉 "."，".." 退回上一级。
+// 查询串原样移到规范的路径后面。返回路径的长度，解码出 '\0' 或者 ".." 越过根目录时返回-1
+static int normalize_url(char* url)
+{
+    char* w = url + 1;          // 输出不会比输入长，原地写，url[0] 是 '/'
+    const char* r = url + 1;
+    char* seg = w;              // 当前这一段在输出中的起点
+    for ( ;; ) {
+        char c = *r;
+        bool end = ( c == '\0' || c == '?' );
+        if ( c == '%' ) {
+            int hi = hex_value( r[ 1 ] );
+            int lo = hi < 0 ? -1 : hex_value( r[ 2 ] );
+            if ( lo < 0 ) {
+                return -1;
+            }
+            c = (char)( hi << 4 | lo );
+            if ( c == '\0' ) {
+                return -1;
+            }
+            r += 3;
+        } else if ( !end ) {
+            ++r;
+        }
+        if ( !end && c != '/' ) {
+            *w++ = c;
+            continue;
+        }
+
+        // 一段结束（解码出的 '/' 也算分隔符，不会藏住 ".."）
+        size_t n = w - seg;
+        if ( n == 1 && seg[ 0 ] == '.' ) {
+            w = seg;
+        } else if ( n == 2 && seg[ 0 ] == '.' && seg[ 1 ] == '.' ) {
+            if ( seg == url + 1 ) {
+                return -1;
+            }
+            w = seg - 1;
+            while ( w[ -1 ] != '/' ) {
+                --w;
+            }
+        } else if ( n > 0 && !end ) {
+            *w++ = '/';
+        }
+        if ( end ) {
+            break;
+        }
+        seg = w;
+    }
+
+    int len = w - url;
+    if ( w != r ) {
+        memmove( w, r, strlen( r ) + 1 );   // 查询串和结尾的 '\0'
+    }
+    return len;
+}
+
+// 以只读方式打开根目录下的文件。openat2 的 RESOLVE_BENEATH 保证符号链接也不能把路径带出根目录；
+// 内核不支持时退回 openat，路径已经规范化过，不含 ".."
+static int open_beneath(int dirfd, const char* path)
+{
+    static std::atomic<bool> s_no_openat2( false );
+    int flags = O_RDONLY | O_CLOEXEC | O_NONBLOCK;      // O_NONBLOCK：打开 FIFO 时不阻塞
+    if ( !s_no_openat2.load( std::memory_order_relaxed ) ) {
+        struct open_how how;
+        memset( &how, 0, sizeof( how ) );
+        how.flags = flags;
+        how.resolve = RESOLVE_BENEATH;
+        int fd = syscall( SYS_openat2, dirfd, path, &how, sizeof( how ) );
+        if ( fd >= 0 || errno != ENOSYS ) {
+            return fd;
+        }
+        s_no_openat2.store( true, std::memory_order_relaxed );
+    }
+    return openat( dirfd, path, flags );
+}
+
+// 打开根目录下的目录（O_PATH），路径中任何一段都不能是符号链接，用于上传时创建文件。
+// 内核不支持 openat2 时逐段用 O_NOFOLLOW 打开，路径已经规范化过，不含 "." 和 ".."
+static int open_dir_beneath(int dirfd, const char* path)
+{
+    int flags = O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+    struct open_how how;
+    memset( &how, 0, sizeof( how ) );
+    how.flags = flags;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+    int fd = syscall( SYS_openat2, dirfd, path, &how, sizeof( how ) );
+    if ( fd >= 0 || errno != ENOSYS ) {
+        return fd;
+    }
+
+    fd = openat( dirfd, ".", flags );
+    char seg[ NAME_MAX + 1 ];
+    while ( fd >= 0 && *path ) {
+        const char* end = strchrnul( path, '/' );
+        size_t n = end - path;
+        if ( n > NAME_MAX ) {
+            close( fd );
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy( seg, path, n );
+        seg[ n ] = '\0';
+        int next = openat( fd, seg, flags );
+        close( fd );
+        fd = next;
+        path = *end ? end + 1 : end;
+    }
+    return fd;
+}
+
 // 当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性，
 // 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其
 // 映射到内存地址m_file_address处，并告诉调用者获取文件成功
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    // "/run/media/root/study/C++work/webserver/resources"
-    strcpy( m_real_file, doc_root );
-    int len = strlen( doc_root );
-    strncpy( m_real_file + len, m_url, FILENAME_LEN - len - 1 );    //拼接成真实文件
-    // 获取m_real_file文件的相关的状态信息，-1失败，0成功
-    if ( stat( m_real_file, &m_file_stat ) < 0 ) {
+    // 导出分阶段跟踪的数据，只对本机开放
+    if ( trace_enabled() && strcmp( m_url, TRACE_URL ) == 0 ) {
+        if ( m_address.sin_addr.s_addr != htonl( INADDR_LOOPBACK ) ) {
+            return NO_RESOURCE;
+        }
+        if ( !trace_dump( g_trace_file ) ) {
+            return INTERNAL_ERROR;
+        }
+        int fd = open( g_trace_file, O_RDONLY | O_CLOEXEC );
+        return fd < 0 ? INTERNAL_ERROR : map_file( fd );
+    }
+
+    // 解码、去掉 . 和 ..，之后的查找都用规范的路径，越过根目录的请求直接拒绝
+    int path_len = normalize_url( m_url );
+    if ( path_len < 0 ) {
+        return BAD_REQUEST;
+    }
+    m_path_len = path_len;
+
+    // 匹配转发规则的请求交给后端处理。规范化之后再匹配，%XX 和 .. 绕不过规则，也不会误入规则
+    if ( m_proxy_pool && m_proxy_pool->match( m_url, path_len ) ) {
+        return PROXY_REQUEST;
+    }
+
+    // PUT 的请求体已经由处理器写入文件（路径由处理器自己规范化），不需要再返回文件内容
+    if ( m_method == PUT ) {
+        if ( m_neg_cache ) {
+            m_neg_cache->invalidate();      // 新文件可能在缓存中记为不存在
+        }
+        return CREATED_REQUEST;
+    }
+
+    // 先查资源包，命中就直接从内存发送，不访问文件系统
+    m_asset = m_asset_pack.find( m_url, path_len );
+    if ( m_asset ) {
+        const char* inm = get_header( HDR_IF_NONE_MATCH );
+        if ( inm && memmem( inm, strlen( inm ), m_asset_pack.at( m_asset->etag_off ), m_asset->etag_len ) ) {
+            return NOT_MODIFIED;
+        }
+        return ASSET_REQUEST;
+    }
+
+    // 最近确认不存在的路径直接返回404，不访问文件系统
+    uint32_t epoch = 0;
+    if ( m_neg_cache ) {
+        if ( m_neg_cache->lookup( m_url, path_len ) ) {
+            return NO_RESOURCE;
+        }
+        epoch = m_neg_cache->epoch();   // 在查找文件之前取
+    }
+
+    // 相对根目录打开，路径不含查询串，暂时在 '?' 处截断
+    char saved = m_url[ path_len ];
+    m_url[ path_len ] = '\0';
+    int fd = open_beneath( m_root_fd, path_len > 1 ? m_url + 1 : "." );
+    m_url[ path_len ] = saved;
+    if ( fd < 0 ) {
+        if ( errno == ENOENT || errno == ENOTDIR ) {
+            if ( m_neg_cache ) {
+                m_neg_cache->record( m_url, path_len, epoch );
+            }
+            return NO_RESOURCE;
+        }
+        // 没有权限，或者经过符号链接跳出了根目录
+        return ( errno == EACCES || errno == EPERM || errno == EXDEV || errno == ELOOP ) ? FORBIDDEN_REQUEST : NO_RESOURCE;
+    }
+
+    HTTP_CODE ret = map_file( fd );
+    if ( ret == FILE_REQUEST ) {
+        // 记下文件大小，下次同一路径的请求入队时就能分类
+        size_hint_record( m_url, path_len, m_file_stat.st_size );
+    }
+    return ret;
+}
+
+http_conn::HTTP_CODE http_conn::map_file(int fd)
+{
+    // 获取文件的相关的状态信息，-1失败，0成功
+    if ( fstat( fd, &m_file_stat ) < 0 ) {
+        close( fd );
         return NO_RESOURCE;
     }
 
     // 判断访问权限（有没有读的权限
     if ( ! ( m_file_stat.st_mode & S_IROTH ) ) {
+        close( fd );
         return FORBIDDEN_REQUEST;
     }
 
     // 判断是否是目录
     if ( S_ISDIR( m_file_stat.st_mode ) ) {
+        close( fd );
         return BAD_REQUEST;
     }
+    if ( !S_ISREG( m_file_stat.st_mode ) ) {
+        close( fd );
+        return FORBIDDEN_REQUEST;
+    }
 
-    // 以只读方式打开文件
-    int fd = open( m_real_file, O_RDONLY );
-    // 创建内存映射
-    m_file_address = ( char* )mmap( 0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
-    close( fd );
+    // 创建内存映射，空文件不用映射
+    if ( m_file_stat.st_size > 0 ) {
+        m_file_address = ( char* )mmap( 0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( m_file_address == MAP_FAILED ) {
+            m_file_address = 0;
+            close( fd );
+            return INTERNAL_ERROR;
+        }
+    }
+    m_ready_end = m_file_address;
+    if ( m_io_pool ) {
+        m_file_fd = fd;                 // 发送时还要用
+    } else {
+        close( fd );
+    }
     return FILE_REQUEST;
 }
 
+bool http_conn::file_window_ready()
+{
+    char* p = (char*)m_iv[ 1 ].iov_base;
+    if ( p < m_ready_end ) {
+        return true;
+    }
+    size_t len = m_iv[ 1 ].iov_len < io_pool::WINDOW ? m_iv[ 1 ].iov_len : io_pool::WINDOW;
+    off_t off = p - m_file_address;
+    m_ready_end = p + len;          // 冷数据读完回来后不再检查这个窗口
+    if ( m_io_pool->resident( m_file_fd, off, p, len ) ) {
+        return true;
+    }
+    // 提交失败就直接发送，退回到同步缺页
+    return !m_io_pool->submit( m_file_fd, off, len, this, generation() );
+}
+
+void http_conn::on_io_done(void *owner, unsigned generation)
+{
+    http_conn* c = (http_conn*)owner;
+    if ( c->m_co ) {            // 协程在等这次读取，发送期间不会结束，owner 一直有效
+        c->m_co->reactor()->wake( c->m_co );
+        return;
+    }
+    // 读取期间连接已经关闭（或者fd被新连接复用）就不用管了
+    if ( c->generation() == generation && c->m_sockfd != -1 ) {
+        modfd( m_epollfd, c->m_sockfd, EPOLLOUT );
+    }
+}
+
+bool http_conn::peek_path(const char *&path, int &len) const
+{
+    if ( m_checked_state != CHECK_STATE_REQUESTLINE ) {
+        // 请求行已经解析过了
+        if ( !m_url ) {
+            return false;
+        }
+        path = m_url;
+        len = strcspn( m_url, "?" );
+        return true;
+    }
+    // 还没解析，直接在读缓冲区中找：方法 空格 路径[?查询串] 空格
+    const char* p = m_read_buf + m_start_line;
+    const char* end = m_read_buf + m_read_idx;
+    p = (const char*)memchr( p, ' ', end - p );
+    if ( !p ) {
+        return false;
+    }
+    ++p;
+    if ( end - p >= 7 && strncasecmp( p, "http://", 7 ) == 0 ) {
+        p = (const char*)memchr( p + 7, '/', end - p - 7 );
+        if ( !p ) {
+            return false;
+        }
+    }
+    const char* e = p;
+    while ( e < end && *e != ' ' && *e != '?' && *e != '\r' && *e != '\n' ) {
+        ++e;
+    }
+    if ( e == end ) {
+        return false;
+    }
+    path = p;
+    len = e - p;
+    return true;
+}
+
+int http_conn::priority() const
+{
+    if ( m_h2 || !m_read_buf ) {
+        return CLASS_NORMAL;
+    }
+    // 正在接收请求体（上传），每次都要处理一大块数据
+    if ( m_checked_state == CHECK_STATE_CONTENT ) {
+        return CLASS_BULK;
+    }
+    // 同一个连接上一个响应很大，多半还在接着下载大文件
+    if ( m_last_size && class_of_size( m_last_size ) == CLASS_BULK ) {
+        return CLASS_BULK;
+    }
+    const char* raw;
+    int len;
+    if ( !peek_path( raw, len ) ) {
+        return CLASS_NORMAL;
+    }
+    // 资源包和大小记录都以规范化后的路径为键，还没解析的请求行先规范化一份拷贝
+    char path[ 256 ];
+    if ( len <= 0 || len >= (int)sizeof( path ) || raw[ 0 ] != '/' ) {
+        return CLASS_NORMAL;
+    }
+    memcpy( path, raw, len );
+    path[ len ] = '\0';
+    len = normalize_url( path );
+    if ( len < 0 ) {
+        return CLASS_NORMAL;
+    }
+    if ( bulk_prefix_match( path, len ) ) {
+        return CLASS_BULK;
+    }
+    const asset_entry* a = m_asset_pack.find( path, len );
+    if ( a ) {
+        return class_of_size( a->body_len );
+    }
+    uint64_t size;
+    if ( size_hint_lookup( path, len, size ) ) {
+        return class_of_size( size );
+    }
+    return CLASS_NORMAL;
+}
+
+void http_conn::log_access(long bytes, unsigned flags)
+{
+    if ( !access_log_enabled() ) {
+        return;
+    }
+    if ( m_ssl ) {
+        flags |= ACCESS_TLS;
+    }
+    access_log_append( m_address, m_method, m_url, m_status, bytes, trace_now() - m_request_start, flags );
+}
+
+// 生成发给后端的请求：连接管理相关的头部由我们自己决定，其余请求头原样转发
+// 把规范化的路径写进转发的请求行，不能直接出现在路径中的字节编码成 %XX
+static void append_encoded_path(std::string& out, const char* path, int len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for ( int i = 0; i < len; ++i ) {
+        unsigned char c = (unsigned char)path[ i ];
+        if ( isalnum( c ) || strchr( "/-._~!$&'()*+,;=:@", c ) ) {
+            out.push_back( (char)c );
+        } else {
+            out.push_back( '%' );
+            out.push_back( hex[ c >> 4 ] );
+            out.push_back( hex[ c & 15 ] );
+        }
+    }
+}
+
+bool http_conn::start_proxy()
+{
+    static const char* methods[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT" };
+
+    proxy_route* route = m_proxy_pool->match( m_url, m_path_len );
+    if ( !route ) {
+        return false;
+    }
+    proxy_session* s = new proxy_session( this, m_sockfd, ( m_ssl && !tls_ktls_send( m_ssl ) ) ? m_ssl : NULL,
+                                          route, m_linger, m_method == HEAD );
+    std::string& req = s->request();
+    // m_url 已经规范化，路径中解码出的字符要重新编码，查询串原样转发
+    req.append( methods[ m_method ] ).append( " " );
+    append_encoded_path( req, m_url, m_path_len );
+    req.append( m_url + m_path_len ).append( " HTTP/1.1\r\n" );
+
+    for ( int i = 0; i < m_headers.count(); ++i ) {
+        const header_table::entry& e = m_headers.at( i );
+        const char* name = m_read_buf + e.name.off;
+        if ( e.id == HDR_CONNECTION || e.id == HDR_CONTENT_LENGTH || e.id == HDR_TRANSFER_ENCODING
+             || e.id == HDR_EXPECT || e.id == HDR_UPGRADE
+             || ( e.id == HDR_UNKNOWN && ( ( e.name.len == 10 && strncasecmp( name, "Keep-Alive", 10 ) == 0 )
+                                          || ( e.name.len == 16 && strncasecmp( name, "Proxy-Connection", 16 ) == 0 ) ) ) ) {
+            continue;
+        }
+        req.append( name, e.name.len ).append( ": " ).append( m_read_buf + e.value.off, e.value.len ).append( "\r\n" );
+    }
+
+    char line[64];
+    if ( !m_headers.get( HDR_HOST ) ) {       // HTTP/1.0 的请求可能没有 Host
+        char host[16] = "";
+        inet_ntop( AF_INET, &route->addr.sin_addr, host, sizeof(host) );
+        snprintf( line, sizeof(line), "Host: %s:%d\r\n", host, ntohs( route->addr.sin_port ) );
+        req.append( line );
+    }
+    char ip[16] = "";
+    inet_ntop( AF_INET, &m_address.sin_addr, ip, sizeof(ip) );
+    req.append( "X-Forwarded-For: " ).append( ip ).append( "\r\n" );
+
+    // 请求体已经缓存在池化的块中
+    chunk_buffer_handler* body = dynamic_cast<chunk_buffer_handler*>( m_body_handler );
+    if ( body ) {
+        snprintf( line, sizeof(line), "Content-Length: %ld\r\n", body->size() );
+        req.append( line );
+    }
+    req.append( "Connection: keep-alive\r\n\r\n" );
+    for ( body_chunk* c = body ? body->chunks() : NULL; c; c = c->next ) {
+        req.append( c->data, c->len );
+    }
+
+    m_proxy = s;
+    m_proxy_pool->submit( s );
+    return true;
+}
+
+void http_conn::proxy_done(bool keep_alive, int status, long bytes)
+{
+    m_proxy = NULL;
+    m_status = status;
+    log_access( bytes, ACCESS_PROXY | ( keep_alive ? ACCESS_KEEP_ALIVE : 0 ) );
+    if ( keep_alive ) {
+        init();
+        release_buffers();
+        modfd( m_epollfd, m_sockfd, EPOLLIN );
+    } else {
+        close_conn();
+        if ( timer ) {
+            m_timer_lst.del_timer( timer );     // 移除其对应的定时器
+            timer = NULL;
+        }
+    }
+}
+
 // 对内存映射区执行munmap操作 释放
 void http_conn::unmap()
 {
@@ -562,6 +1780,11 @@ void http_conn::unmap()
         munmap( m_file_address, m_file_stat.st_size );
         m_file_address = 0;
     }
+    if( m_file_fd != -1 )
+    {
+        close( m_file_fd );
+        m_file_fd = -1;
+    }
 }
 
 // 往写缓冲中写入待发送的数据
@@ -634,11 +1857,24 @@ bool http_conn::add_blank_line()
     return add_response( "%s", "\r\n" );
 }
 
-//发送时间
+//发送时间，每个线程缓存当前这一秒格式化好的Date行
 bool http_conn::add_date(time_t t)
 {
-    char timebuf[50];
-    strftime(timebuf, 80, "%Y-%m-%d %H:%M:%S", localtime(&t));
-    EMlog(LOGLEVEL_DEBUG,"<<<<<<< Date: %s\r\n", timebuf );
-    return add_response("Date: %s\r\n", timebuf);
+    static thread_local time_t cached_sec = -1;
+    static thread_local char cached_line[64];
+    static thread_local int cached_len = 0;
+    if ( t != cached_sec ) {
+        struct tm tm_now;
+        char timebuf[50];
+        strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm_now));
+        cached_len = snprintf(cached_line, sizeof(cached_line), "Date: %s\r\n", timebuf);
+        cached_sec = t;
+    }
+    EMlog(LOGLEVEL_DEBUG,"<<<<<<< %s", cached_line );
+    if ( m_write_idx + cached_len >= WRITE_BUFFER_SIZE ) {
+        return false;
+    }
+    memcpy( m_write_buf + m_write_idx, cached_line, cached_len );
+    m_write_idx += cached_len;
+    return true;
 }
@@ -16,21 +16,39 @@
 #include <errno.h>
 #include <sys/uio.h>
 #include <string.h>
+#include <atomic>
 
 #include "locker.h"
 #include "noactive/lst_timer.h"
 #include "log.h"
+#include "body/body_handler.h"
+#include "header/header_table.h"
+#include "socket/socket_profile.h"
+#include "asset/asset_pack.h"
+#include "proxy/proxy.h"
+#include "tls/tls_context.h"
+#include "h2/h2_session.h"
+#include "trace/req_trace.h"
+#include "accesslog/access_log.h"
+#include "sched/request_class.h"
+#include "diskio/io_pool.h"
+#include "negcache/neg_cache.h"
+#include "ratelimit/rate_limiter.h"
+#include "memorypool/mem_pool.h"
 
 class sort_timer_lst;
 class util_timer;
+class co_task;
+class co_conn;
 
 #define COUT_OPEN 1
 const bool ET = true;
-#define TIMESLOT 5      // 定时器周期：秒
 
 // http 连接的用户数据类
 class http_conn
 {
+    friend class h2_session;
+    friend co_task co_serve_http(co_conn* conn);
 public:
     // 共享对象，没有线程竞争资源，所以不需要互斥
     static int m_epollfd;               // 所有socket上的事件都被注册到同一个epoll内核事件中，所以设置成静态的
@@ -38,6 +56,15 @@ public:
     static int m_request_count;           // 接收到的请求次数
 
     static sort_timer_lst m_timer_lst;  // 定时器链表
+
+    static const char* m_doc_root;      // 网站根目录
+    static asset_pack m_asset_pack;     // 静态资源包，命中时不访问文件系统
+    static proxy_pool* m_proxy_pool;    // 反向代理的转发规则和后端连接池
+    static tls_context* m_tls;          // 启用 TLS 时所有连接共用的上下文，为NULL时是明文
+    static io_pool* m_io_pool;          // 冷文件交给它读进页缓存，为NULL时直接从映射发送
+    static neg_cache* m_neg_cache;      // 最近确认不存在的路径，为NULL时每次都 stat
+    static int m_root_fd;               // 启动时打开的网站根目录，请求的文件都相对它解析
+    static rate_limiter* m_limiter;     // 按客户端地址限速，为NULL时不限制
     util_timer* timer;                  // 定时器
 
 public:
@@ -45,8 +72,15 @@ public:
     static const int READ_BUFFER_SIZE=2048;     //读缓冲区的大小
     static const int WRITE_BUFFER_SIZE=1024;    //写缓冲区的大小
 
+    // 处理请求时才需要的缓冲区，空闲的长连接把它还给内存池，连接占用的内存只和正在处理的请求数有关
+    struct buffers : public pool_allocated<buffers>
+    {
+        char read_buf[ READ_BUFFER_SIZE ];
+        char write_buf[ WRITE_BUFFER_SIZE ];
+    };
+
    //这个后面还是封装到另一个类里去
-    // HTTP请求方法，这里只支持GET
+    // HTTP请求方法，这里支持GET、POST、PUT
     enum METHOD {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT};
 
     /*
@@ -67,13 +101,27 @@ public:
         FILE_REQUEST        :   文件请求,获取文件成功
         INTERNAL_ERROR      :   表示服务器内部错误
         CLOSED_CONNECTION   :   表示客户端已经关闭连接了
+        CREATED_REQUEST     :   PUT上传的请求体已经完整写入
+        ASSET_REQUEST       :   请求的文件在资源包中
+        NOT_MODIFIED        :   请求的文件在资源包中，且和客户端缓存的ETag一致
+        PROXY_REQUEST       :   请求需要转发给后端
+        TOO_MANY_REQUESTS   :   客户端超过了速率限制
     */
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, CREATED_REQUEST,
+                     ASSET_REQUEST, NOT_MODIFIED, PROXY_REQUEST, TOO_MANY_REQUESTS };
 
     // 从状态机的三种可能状态，即行的读取状态，分别表示
     // 1.读取到一个完整的行 2.行出错 3.行数据尚且不完整
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
 
+    // chunked 请求体的解析状态：分块大小行、分块数据、分块数据后的\r\n、结尾的trailer
+    enum CHUNK_STATE { CHUNK_SIZE = 0, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER };
+
+    // 请求体处理器的创建钩子，返回NULL表示拒绝该请求体（403）
+    typedef body_handler* (*body_hook)(METHOD method, const char* url, long content_length);
+    static body_hook m_body_hook;
+    static const long MAX_BUFFERED_BODY = 8 * 1024 * 1024;  // 缓存型请求体的最大长度
+
 public:
     http_conn();
     ~http_conn();
@@ -81,19 +129,68 @@ public:
     //处理客户端的请求，解析请求，响应
     void process();
 
-    //初始化新接收的连接
-    void init(int sockfd,const sockaddr_in & addr);
+    //初始化新接收的连接，启用 TLS 时创建 SSL 失败返回false，由调用者关闭连接
+    bool init(int sockfd,const sockaddr_in & addr);
     //关闭连接
     void close_conn();
 
     //非阻塞的读
     bool read();
+    //read 发现这个请求超过了速率限制，429 已经准备好，不用交给线程池
+    bool limited() const { return m_limited; }
+    //还没有连接对象的 socket 上直接发出预先生成的响应（比如新连接超过速率限制时的 429），不等待
+    static void send_canned(int fd, HTTP_CODE code);
     //非阻塞的写
     bool write();
 
+    //连接的代数，每次关闭连接加一，线程池用它识别排队期间已经关闭的连接
+    unsigned generation() const { return m_generation.load( std::memory_order_acquire ); }
+    //工作线程开始处理任务，任务排队期间连接已经关闭（代数变了）时返回false，任务丢弃
+    bool enter(unsigned generation);
+    //工作线程处理完任务
+    void leave() { m_in_process.store( false, std::memory_order_release ); }
+    //定时器到期（主线程）：作废排队中的任务，工作线程正在处理这个连接时返回false，这时不能释放连接的资源
+    bool expire();
+    //交给线程池前（主线程）判断这次处理的类别，REQUEST_CLASS
+    int priority() const;
+    //冷文件读进页缓存之后（主线程）的回调，owner是连接
+    static void on_io_done(void* owner, unsigned generation);
+
+    //进入 phase 阶段（TIMER_PHASE），按这个阶段和当前的负载重新设置超时时间
+    void arm_timer(int phase);
+    //有数据收发（发送响应、转发），按空闲阶段推迟超时时间
+    void refresh_timer();
+    //反向代理转发结束（主线程调用），keep_alive为false时关闭连接。status和bytes是发给客户端的响应
+    void proxy_done(bool keep_alive, int status, long bytes);
+
+    //查询当前请求的请求头，返回的值以\0结尾，指向读缓冲区，没有该请求头返回NULL
+    const char* get_header(HEADER_ID id) const;
+    const char* get_header(const char* name) const;
+
 private:
     //初始化连接其余的信息(请求状态等
     void init();
+    //从内存池取得缓冲区
+    void attach_buffers();
+    //缓冲区还给内存池，连接进入空闲状态
+    void release_buffers();
+    //从socket（或者TLS）读数据到读缓冲区，直到没有数据或者缓冲区满
+    bool recv_buf();
+    //继续TLS握手，完成或者需要等待时返回true并重新注册事件，失败返回false
+    bool do_handshake();
+    //工作线程中要关闭连接：定时器链表只能由主线程访问，标记之后注册EPOLLOUT，由主线程关闭连接并删除定时器
+    void defer_close();
+    //写socket（或者TLS），返回值和writev一致
+    ssize_t sock_writev(const struct iovec* iv, int count);
+
+    // HTTP/2：处理收到的数据并发送响应
+    void process_h2();
+    // 请求带有 Upgrade: h2c 时切换到 HTTP/2，返回是否已经切换
+    bool upgrade_h2c();
+    // 作为 HTTP/2 的一个流：没有socket和定时器，请求由 h2_session 还原成 HTTP/1.1 的格式，addr 是所在连接的客户端地址
+    void init_stream(const sockaddr_in& addr);
+    // 解析流的请求并生成响应（m_iv），失败返回false
+    bool process_stream(const std::string& request);
     //解析http请求（主状态机
     HTTP_CODE process_read();
     // 填充HTTP应答
@@ -107,12 +204,32 @@ private:
     //解析http请求头
     HTTP_CODE parse_request_headers(char * text);
     //解析http请求体
-    HTTP_CODE parse_request_content(char * text);
+    HTTP_CODE parse_request_content();
+    //开始接收请求体
+    HTTP_CODE begin_body();
+    //请求体接收完毕
+    HTTP_CODE end_body();
+    //把请求体直接从socket splice到处理器的fd
+    HTTP_CODE splice_body(int fd);
+    //把读缓冲区中未解析的请求体数据前移，腾出空间继续接收
+    void compact_read_buf();
+    //释放请求体处理器和splice管道
+    void release_body();
 
     //解析具体的某一行
     LINE_STATUS parse_line();
 
     HTTP_CODE do_request();
+    //响应发完，写一条访问日志
+    void log_access(long bytes, unsigned flags);
+    //把打开的文件映射到内存，fd 之后由连接负责关闭
+    HTTP_CODE map_file(int fd);
+    //当前请求的路径（不含查询串），请求行还没收完返回false
+    bool peek_path(const char*& path, int& len) const;
+    //从文件映射接下来要发送的窗口是否在页缓存中，不在时交给I/O线程读取并返回false
+    bool file_window_ready();
+    //把请求交给反向代理，成功后响应由主线程转发
+    bool start_proxy();
 
     //获取一行数据
     char * get_line(){
@@ -136,12 +253,16 @@ private:
 
 private:
     int m_sockfd;                           //该http连接的socket
+    std::atomic<unsigned> m_generation;     //连接的代数
+    std::atomic<bool> m_in_process;         //有工作线程正在处理这个连接
+    bool m_close_pending;                   //工作线程要求关闭连接，等主线程在EPOLLOUT时关闭
     sockaddr_in m_address;                  //通信的socket地址
 
-    char m_read_buf[READ_BUFFER_SIZE];      //读缓冲区
+    buffers* m_buffers;                     //读写缓冲区，空闲时为NULL
+    char* m_read_buf;                       //读缓冲区
     int m_read_idx;                         //标识读缓冲区中以及读入的客户端数据的最后一个字节的下一个位置
 
-    char m_write_buf[ WRITE_BUFFER_SIZE ];  // 写缓冲区
+    char* m_write_buf;                      // 写缓冲区
     int m_write_idx;                        // 写缓冲区中待发送的字节数
 
     int m_checked_idx;                      //当前正在分析的字符在读缓冲区的位置
@@ -151,23 +272,53 @@ private:
 
     //请求行信息的封装
     char * m_url;                           //请求目标文件的文件名
+    int m_path_len;                         // 规范化之后 m_url 中路径部分的长度，后面是查询串
     char * m_version;                       //协议版本，只支持HTTP1.1
     METHOD m_method;                        //请求方法
     //请求头信息的封装
     char * m_host;                          //主机名
     bool m_linger;                          //判断http请求是否要保持连接
-    int m_content_length;                   // HTTP请求体的消息总长度
+    header_table m_headers;                 //全部请求头，指向读缓冲区
+    long m_content_length;                  // HTTP请求体的消息总长度
+    bool m_has_content_length;              // 请求中出现过 Content-Length
+    bool m_chunked;                         // 请求体是否为 Transfer-Encoding: chunked
+    bool m_expect_continue;                 // 客户端是否在等待 100 Continue
+
+    // 请求体的流式接收
+    body_handler* m_body_handler;           // 请求体处理器
+    long m_body_received;                   // 已经交给处理器的请求体字节数
+    int m_body_start;                       // 请求体在读缓冲区中的起始位置，之前是请求行和请求头
+    CHUNK_STATE m_chunk_state;              // chunked 解析状态
+    long m_chunk_left;                      // 当前分块剩余的字节数
+    int m_splice_pipe[2];                   // splice 用的中转管道
 
-    char m_real_file[ FILENAME_LEN ];       // 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录
     struct stat m_file_stat;                // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
     char* m_file_address;                   // 客户请求体的目标文件被mmap到内存中的起始位置
+    int m_file_fd;                          // 映射的文件，发送期间保持打开，用于确认页缓存和交给I/O线程读取
+    char* m_ready_end;                      // 映射中确认在页缓存中的部分的结尾
+    co_conn* m_co;                          // 由协程处理时所在的连接，冷数据读完后唤醒它的协程；否则为NULL
+
+    const asset_entry* m_asset;             // 命中的资源包中的文件
+    proxy_session* m_proxy;                 // 正在转发的反向代理请求
 
     // 我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量。
-    struct iovec m_iv[2];                   //两块内存：一块write_buf,另一块file_address（请求体的
+    struct iovec m_iv[3];                   //一般两块内存：一块write_buf,另一块file_address（请求体的；资源包命中时是预生成的响应头、write_buf、文件内容
     int m_iv_count;
 
     int bytes_have_send = 0;                // 已经发送的字节
     int bytes_to_send;        // 将要发送的字节 （m_write_idx）写缓冲区中待发送的字节数
+    bool m_corked;                          // 是否打开了TCP_CORK
+    bool m_limited;                         // 当前请求超过了速率限制
+
+    h2_session* m_h2;                       // 切换到 HTTP/2 后的会话，HTTP/1.1 时为NULL
+
+    SSL* m_ssl;                             // TLS 连接，明文连接为NULL
+    bool m_tls_ready;                       // TLS 握手是否已经完成
+
+    req_trace m_trace;                      // 当前请求的分阶段跟踪
+    uint64_t m_request_start;               // 开始接收当前请求的时间，记录访问日志时才设置
+    int m_status;                           // 响应的状态码
+    uint64_t m_last_size;                   // 这个连接上一个响应的响应体大小，用于给后续请求分类
 };
 
 #endif // HTTP_CONN_H
@@ -1,11 +1,150 @@
 #include "locker.h"
 
-locker::locker()
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#if LOCK_STATS
+uint64_t lock_clock_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void atomic_max(std::atomic<uint64_t>& m, uint64_t v)
+{
+    uint64_t cur = m.load( std::memory_order_relaxed );
+    while( v > cur && !m.compare_exchange_weak( cur, v, std::memory_order_relaxed ) ) {
+    }
+}
+
+void lock_stats::on_wait(uint64_t ns)
+{
+    acquired.fetch_add( 1, std::memory_order_relaxed );
+    if( ns == 0 ) {     // 没有等待
+        wait_hist[0].fetch_add( 1, std::memory_order_relaxed );
+        return;
+    }
+    contended.fetch_add( 1, std::memory_order_relaxed );
+    wait_ns.fetch_add( ns, std::memory_order_relaxed );
+    atomic_max( max_wait_ns, ns );
+    uint64_t us = ns / 1000;
+    int b = us == 0 ? 0 : 64 - __builtin_clzll( us );
+    wait_hist[ std::min( b, BUCKETS - 1 ) ].fetch_add( 1, std::memory_order_relaxed );
+}
+
+void lock_stats::on_hold(uint64_t ns)
+{
+    hold_ns.fetch_add( ns, std::memory_order_relaxed );
+    atomic_max( max_hold_ns, ns );
+}
+
+// 注册表本身不能用 locker，否则会递归。锁在静态初始化时就可能被构造，所以放在函数里
+static pthread_mutex_t s_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<lock_stats*>& stats_registry()
+{
+    static std::vector<lock_stats*>* registry = new std::vector<lock_stats*>();     // 不释放，退出时别的静态对象析构还会用到
+    return *registry;
+}
+
+lock_stats* lock_stats_get(const char* name)
+{
+    if( !name ) {
+        name = "unnamed";
+    }
+    pthread_mutex_lock( &s_stats_mutex );
+    std::vector<lock_stats*>& registry = stats_registry();
+    lock_stats* st = NULL;
+    for( size_t i = 0; i < registry.size(); ++i ) {
+        if( strcmp( registry[i]->name, name ) == 0 ) {
+            st = registry[i];
+            break;
+        }
+    }
+    if( !st ) {
+        st = new lock_stats();      // 值初始化，计数都为0
+        st->name = name;
+        registry.push_back( st );
+    }
+    pthread_mutex_unlock( &s_stats_mutex );
+    return st;
+}
+
+void lock_stats_report(std::string& out)
+{
+    pthread_mutex_lock( &s_stats_mutex );
+    std::vector<lock_stats*> list = stats_registry();
+    pthread_mutex_unlock( &s_stats_mutex );
+    // 等待总时间最长的排在前面
+    std::sort( list.begin(), list.end(), [](const lock_stats* a, const lock_stats* b) {
+        return a->wait_ns.load( std::memory_order_relaxed ) > b->wait_ns.load( std::memory_order_relaxed );
+    } );
+
+    char line[512];
+    for( size_t i = 0; i < list.size(); ++i ) {
+        const lock_stats* st = list[i];
+        uint64_t acquired = st->acquired.load( std::memory_order_relaxed );
+        if( acquired == 0 ) {
+            continue;
+        }
+        uint64_t contended = st->contended.load( std::memory_order_relaxed );
+        uint64_t wait = st->wait_ns.load( std::memory_order_relaxed );
+        uint64_t hold = st->hold_ns.load( std::memory_order_relaxed );
+        snprintf( line, sizeof( line ),
+                  "lock %s: acquired %llu, contended %llu (%.2f%%), wait total %.3fms avg %.1fus max %.1fus",
+                  st->name, (unsigned long long)acquired, (unsigned long long)contended, 100.0 * contended / acquired,
+                  wait / 1e6, contended ? wait / 1e3 / contended : 0.0, st->max_wait_ns.load( std::memory_order_relaxed ) / 1e3 );
+        out += line;
+        if( hold ) {    // 信号量和条件变量没有持有时间
+            snprintf( line, sizeof( line ), ", hold avg %.2fus max %.1fus",
+                      hold / 1e3 / acquired, st->max_hold_ns.load( std::memory_order_relaxed ) / 1e3 );
+            out += line;
+        }
+        out += "\n";
+        if( contended == 0 ) {
+            continue;
+        }
+        // 等待时间分布，只列出非0的档
+        out += "    wait:";
+        for( int b = 0; b < lock_stats::BUCKETS; ++b ) {
+            uint64_t n = st->wait_hist[b].load( std::memory_order_relaxed );
+            if( n == 0 ) {
+                continue;
+            }
+            if( b == 0 ) {
+                snprintf( line, sizeof( line ), " <1us:%llu", (unsigned long long)n );
+            } else if( b == lock_stats::BUCKETS - 1 ) {
+                snprintf( line, sizeof( line ), " >=%lluus:%llu", 1ull << ( b - 1 ), (unsigned long long)n );
+            } else {
+                snprintf( line, sizeof( line ), " <%lluus:%llu", 1ull << b, (unsigned long long)n );
+            }
+            out += line;
+        }
+        out += "\n";
+    }
+}
+#else
+void lock_stats_report(std::string& out)
+{
+    out += "lock stats not compiled in (build with LOCK_STATS=1)\n";
+}
+#endif
+
+locker::locker(const char* name)
 {
     if(pthread_mutex_init(&m_mutex,NULL)!=0){
         //抛出异常
         throw std::exception();
     }
+#if LOCK_STATS
+    m_stats = lock_stats_get( name );
+    m_locked_at = 0;
+#else
+    (void)name;
+#endif
 }
 
 locker::~locker()
@@ -15,11 +154,31 @@ locker::~locker()
 
 bool locker::lock()
 {
+#if LOCK_STATS
+    // 先试一次，取不到才算竞争，计时等待
+    uint64_t wait = 0;
+    if( pthread_mutex_trylock( &m_mutex ) != 0 ) {
+        uint64_t start = lock_clock_ns();
+        if( pthread_mutex_lock( &m_mutex ) != 0 ) {
+            return false;
+        }
+        m_locked_at = lock_clock_ns();
+        wait = std::max<uint64_t>( m_locked_at - start, 1 );
+    } else {
+        m_locked_at = lock_clock_ns();
+    }
+    m_stats->on_wait( wait );
+    return true;
+#else
     return pthread_mutex_lock(&m_mutex)==0;
+#endif
 }
 
 bool locker::unlock()
 {
+#if LOCK_STATS
+    m_stats->on_hold( lock_clock_ns() - m_locked_at );
+#endif
     return pthread_mutex_unlock(&m_mutex)==0;
 }
 
@@ -28,11 +187,16 @@ pthread_mutex_t *locker::get()
     return &m_mutex;
 }
 
-cond::cond()
+cond::cond(const char* name)
 {
     if(pthread_cond_init(&m_cond,NULL)!=0){
         throw std::exception();
     }   
+#if LOCK_STATS
+    m_stats = lock_stats_get( name );
+#else
+    (void)name;
+#endif
 }
 
 cond::~cond()
@@ -45,7 +209,14 @@ bool cond::wait(pthread_mutex_t *mutex)
 //    int ret = 0;
 //    ret = pthread_cond_wait(&m_cond, m_mutex);
 //    return ret == 0;
+#if LOCK_STATS
+    uint64_t start = lock_clock_ns();
+    bool ok = pthread_cond_wait(&m_cond,mutex)==0;
+    m_stats->on_wait( std::max<uint64_t>( lock_clock_ns() - start, 1 ) );
+    return ok;
+#else
     return pthread_cond_wait(&m_cond,mutex)==0;
+#endif
 }
 
 bool cond::timedwait(pthread_mutex_t *mutex, timespec t)
@@ -53,7 +224,16 @@ bool cond::timedwait(pthread_mutex_t *mutex, timespec t)
 //    int ret = 0;
 //    ret = pthread_cond_timedwait(&m_cond, m_mutex, &t);
 //    return ret == 0;
+#if LOCK_STATS
+    uint64_t start = lock_clock_ns();
+    bool ok = pthread_cond_timedwait(&m_cond,mutex,&t)==0;
+    if( ok ) {
+        m_stats->on_wait( std::max<uint64_t>( lock_clock_ns() - start, 1 ) );
+    }
+    return ok;
+#else
     return pthread_cond_timedwait(&m_cond,mutex,&t)==0;
+#endif
 }
 
 bool cond::signal()
@@ -66,18 +246,16 @@ bool cond::broadcast()
     return pthread_cond_broadcast(&m_cond)==0;
 }
 
-sem::sem()
-{
-    if( sem_init( &m_sem, 0, 0 ) != 0 ) {
-        throw std::exception();
-    }
-}
-
-sem::sem(int num)
+sem::sem(int num, const char* name)
 {
     if( sem_init( &m_sem, 0, num ) != 0 ) {
         throw std::exception();
     }
+#if LOCK_STATS
+    m_stats = lock_stats_get( name );
+#else
+    (void)name;
+#endif
 }
 
 sem::~sem()
@@ -87,7 +265,50 @@ sem::~sem()
 
 bool sem::wait()
 {
+#if LOCK_STATS
+    // 信号量的等待时间是消费者空等的时间，不是锁竞争
+    if( sem_trywait( &m_sem ) == 0 ) {
+        m_stats->on_wait( 0 );
+        return true;
+    }
+    uint64_t start = lock_clock_ns();
+    if( sem_wait( &m_sem ) != 0 ) {
+        return false;
+    }
+    m_stats->on_wait( std::max<uint64_t>( lock_clock_ns() - start, 1 ) );
+    return true;
+#else
     return sem_wait( &m_sem ) == 0;
+#endif
+}
+
+bool sem::timedwait(int ms)
+{
+#if LOCK_STATS
+    if( sem_trywait( &m_sem ) == 0 ) {
+        m_stats->on_wait( 0 );
+        return true;
+    }
+    uint64_t start = lock_clock_ns();
+#endif
+    struct timespec t;
+    clock_gettime( CLOCK_REALTIME, &t );
+    t.tv_sec += ms / 1000;
+    t.tv_nsec += ( ms % 1000 ) * 1000000L;
+    if( t.tv_nsec >= 1000000000L ) {
+        t.tv_sec += 1;
+        t.tv_nsec -= 1000000000L;
+    }
+#if LOCK_STATS
+    // 超时不算一次取得
+    if( sem_timedwait( &m_sem, &t ) != 0 ) {
+        return false;
+    }
+    m_stats->on_wait( std::max<uint64_t>( lock_clock_ns() - start, 1 ) );
+    return true;
+#else
+    return sem_timedwait( &m_sem, &t ) == 0;
+#endif
 }
 
 bool sem::post()
@@ -2,32 +2,74 @@
 #define LOCKER_H
 
 #include <exception>
+#include <string>
+#include <stdint.h>
 #include <pthread.h>
 #include <semaphore.h>
 
 // 线程同步机制封装类
 
+// 打开后统计每个命名锁的取得次数、竞争次数、等待时间分布和持有时间，
+// 可以用 qmake "DEFINES+=LOCK_STATS=1" 打开。关闭时锁的实现和原来完全一样
+#ifndef LOCK_STATS
+#define LOCK_STATS 0
+#endif
+
+#if LOCK_STATS
+#include <atomic>
+
+// 一个名字的统计，同名的锁（比如每种类型一个的内存池锁）记在一起
+struct lock_stats
+{
+    static const int BUCKETS = 18;          // 等待时间分布：<1us, <2us, <4us ... >=65536us
+
+    const char* name;
+    std::atomic<uint64_t> acquired;         // 取得锁（或者等到信号量）的次数
+    std::atomic<uint64_t> contended;        // 其中没能立即取得、需要等待的次数
+    std::atomic<uint64_t> wait_ns;
+    std::atomic<uint64_t> max_wait_ns;
+    std::atomic<uint64_t> hold_ns;          // 互斥锁才有持有时间
+    std::atomic<uint64_t> max_hold_ns;
+    std::atomic<uint64_t> wait_hist[ BUCKETS ];
+
+    void on_wait(uint64_t ns);
+    void on_hold(uint64_t ns);
+};
+
+// 按名字取统计，名字是字符串常量，不会被复制
+lock_stats* lock_stats_get(const char* name);
+uint64_t lock_clock_ns();
+#endif
+
+// 所有锁的统计，每个锁一行。没有打开 LOCK_STATS 时只有一行说明
+void lock_stats_report(std::string& out);
+
 // 互斥锁类
 class locker
 {
 public:
-    locker();
+    explicit locker(const char* name = NULL);
     ~locker();
     //上锁
     bool lock();
     //解锁
     bool unlock() ;
 
+    // 直接用底层的互斥量（比如交给条件变量）不会被统计
     pthread_mutex_t *get();
 
 private:
     pthread_mutex_t m_mutex;
+#if LOCK_STATS
+    lock_stats* m_stats;
+    uint64_t m_locked_at;       // 取得锁的时间，只由持有锁的线程读写
+#endif
 };
 
 // 条件变量类
 class cond {
 public:
-    cond();
+    explicit cond(const char* name = NULL);
     ~cond();
 
     bool wait(pthread_mutex_t *m_mutex);
@@ -39,21 +81,28 @@ public:
 
 private:
     pthread_cond_t m_cond;
+#if LOCK_STATS
+    lock_stats* m_stats;        // 每次 wait 都算一次竞争
+#endif
 };
 
 
 // 信号量类
 class sem {
 public:
-    sem();
-    sem(int num);
+    explicit sem(int num = 0, const char* name = NULL);
     ~sem() ;
 
     // 等待信号量（消费）
     bool wait();
+    // 最多等待 ms 毫秒，超时返回false
+    bool timedwait(int ms);
     // 增加信号量（生产）
     bool post();
 private:
     sem_t m_sem;
+#if LOCK_STATS
+    lock_stats* m_stats;
+#endif
 };
 #endif // LOCKER_H
@@ -1,5 +1,9 @@
 #include "log.h"
 
+std::atomic<int> g_log_level( LOG_LEVEL );
+// 代替 stdio 内部的锁，打开 LOCK_STATS 后能看到日志输出上的竞争
+static locker s_log_lock( "log" );
+
 char *EM_logLevelGet(const int level)  // 得到当前输入等级level的字符串
 {
     if(level == LOGLEVEL_DEBUG){
@@ -18,13 +22,21 @@ char *EM_logLevelGet(const int level)  // 得到当前输入等级level的字符
 void EM_log(const int level, const char *fun, const int line, const char *fmt,...)     // 日志输出函数
 {
 #ifdef OPEN_LOG     // 判断开关
+    if(level < g_log_level.load(std::memory_order_relaxed)){   // 低于当前日志等级的不用格式化
+        return;
+    }
     va_list arg;
     va_start(arg, fmt);
     char buf[1024];     // 创建缓存字符数组
     vsnprintf(buf, sizeof(buf), fmt, arg);          // 赋值 ftm 格式的 arg 到 buf
     va_end(arg);
-    if(level >= LOG_LEVEL){                         // 判断当前日志等级，与程序日志等级状态对比
-        printf("[%s]\t[%s %d]: %s \n", EM_logLevelGet(level), fun, line, buf);
+    char out[1200];     // 先整行格式化好，持锁时只做一次写入
+    int n = snprintf(out, sizeof(out), "[%s]\t[%s %d]: %s \n", EM_logLevelGet(level), fun, line, buf);
+    if(n > (int)sizeof(out) - 1){
+        n = sizeof(out) - 1;
     }
+    s_log_lock.lock();
+    fwrite_unlocked(out, 1, n, stdout);
+    s_log_lock.unlock();
 #endif
 }
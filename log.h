@@ -3,13 +3,14 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <atomic>
 
 #include "locker.h"
 #include "noactive/lst_timer.h"
 #include "http_conn.h"
 
 #define OPEN_LOG 1                  // 声明是否打开日志输出
-#define LOG_LEVEL LOGLEVEL_DEBUG     // 声明当前程序的日志等级状态，只输出等级等于或高于该值的内容
+#define LOG_LEVEL LOGLEVEL_DEBUG     // 默认的日志等级，只输出等级等于或高于该值的内容
 #define LOG_SAVE 0                  // 可补充日志保存功能
 
 typedef enum{                       // 日志等级，越往下等级越高
@@ -19,6 +20,9 @@ typedef enum{                       // 日志等级，越往下等级越高
     LOGLEVEL_ERROR,
 }E_LOGLEVEL;
 
+// 当前的日志等级，运行中可以修改
+extern std::atomic<int> g_log_level;
+
 char *EM_logLevelGet(const int level);
 
 void EM_log(const int level, const char* fun, const int line, const char *fmt, ...);
@@ -12,15 +12,22 @@
 #include <sys/epoll.h>
 #include <signal.h>
 #include <assert.h>     //断言函数
+#include <vector>
 
 #include "locker.h"
 #include "threadpool.h"
 #include "http_conn.h"
 #include "noactive/lst_timer.h"
 #include "log.h"
-
-#define MAX_FD 65535   //最大的文件描述符个数
-#define MAX_EVENT_NUMBER 10000  //一次监听的最大数量
+#include "memorypool/mem_pool.h"
+#include "proxy/proxy.h"
+#include "tls/tls_context.h"
+#include "trace/req_trace.h"
+#include "coro/co_http.h"
+#include "socket/busy_poll.h"
+#include "accesslog/access_log.h"
+#include "admin/server_config.h"
+#include "admin/admin_server.h"
 
 static int pipefd[2];           // 管道文件描述符 0为读，1为写
 
@@ -32,6 +39,8 @@ extern void removefd(int epollfd,int fd);
 extern void modfd(int epollfd,int fd,int ev);
 // 文件描述符设置非阻塞操作
 extern void setnonblocking(int fd);
+// PUT上传的目录，不打进资源包
+extern const char* upload_prefix;
 
 
 //添加信号捕捉
@@ -58,14 +67,115 @@ void sig_to_pipe(int sig){
 
 int main(int argc,char* argv[])
 {
-    if(argc<=1){    // 形参个数，第一个为执行命令的名称
+    // 离线生成资源包：--build-pack doc_root pack_file
+    if(argc==4 && strcmp(argv[1],"--build-pack")==0){
+        if(!http_conn::m_asset_pack.build(argv[2],upload_prefix)||!http_conn::m_asset_pack.save(argv[3])){
+            EMlog(LOGLEVEL_ERROR,"build asset pack %s from %s failed.\n", argv[3], argv[2]);
+            exit(-1);
+        }
+        return 0;
+    }
+
+    // 反向代理的转发规则：-r /api=127.0.0.1:8080，可以指定多个
+    // TLS 的证书和私钥：-c cert.pem -k key.pem
+    // 分阶段跟踪：-t N 每N个请求跟踪一个，-T file 导出的文件
+    // 协程处理连接：-C，连接的读写和请求处理都在主线程中由协程完成
+    // 忙等模式：-B us，epoll_wait 阻塞前最多自旋的微秒数，同时打开 socket 和 epoll 的忙等
+    // 二进制访问日志：-L file，用 tools/access_log_dump 查看
+    // 配置文件：-f file，命令行指定的端口号和网站根目录优先
+    std::vector<const char*> routes;
+    const char* cert_file=NULL;
+    const char* key_file=NULL;
+    bool use_coroutine=false;
+    const char* access_log_file=NULL;
+    const char* config_file=NULL;
+    int opt;
+    while((opt=getopt(argc,argv,"r:c:k:t:T:CB:L:f:"))!=-1){
+        if(opt=='r'){
+            routes.push_back(optarg);
+        }else if(opt=='c'){
+            cert_file=optarg;
+        }else if(opt=='k'){
+            key_file=optarg;
+        }else if(opt=='t'){
+            g_trace_sample=atoi(optarg);
+        }else if(opt=='T'){
+            g_trace_file=optarg;
+        }else if(opt=='C'){
+            use_coroutine=true;
+        }else if(opt=='B'){
+            g_socket_profile.busy_poll=atoi(optarg);
+            g_socket_profile.prefer_busy_poll=g_socket_profile.busy_poll>0;
+        }else if(opt=='L'){
+            access_log_file=optarg;
+        }else if(opt=='f'){
+            config_file=optarg;
+        }else{
+            argc=0;         // 参数有误，输出用法
+            break;
+        }
+    }
+    argc-=optind;           // 剩下的是位置参数
+    argv+=optind-1;
+
+    if(config_file && !config_load(config_file,true)){
+        exit(-1);
+    }
+    g_log_level.store(g_config.log_level);
+
+    if(argc<1 && !g_config.port){    // 形参个数，配置文件中有端口号时可以省略
 //        printf("按照如下格式运行：%s port_number\n",basename(argv[0]));
-        EMlog(LOGLEVEL_ERROR,"run as: %s port_number\n", basename(argv[0]));      // argv[0] 可能是带路径的，用basename转换
+        EMlog(LOGLEVEL_ERROR,"run as: webserver [-f config] [-r prefix=ip:port]... [-c cert.pem -k key.pem] [-t N [-T trace.json]] [-C] [-B spin_us] [-L access.log] port_number [doc_root] [asset_pack]\n");
+        EMlog(LOGLEVEL_ERROR,"   or: webserver --build-pack doc_root asset_pack\n");
         exit(-1);
     }
 
     //获取端口号
-    int port=atoi(argv[1]);
+    int port=argc>=1 ? atoi(argv[1]) : g_config.port;
+
+    //网站根目录
+    if(argc>1){
+        g_config.doc_root=argv[2];
+    }
+    if(!g_config.doc_root.empty()){
+        http_conn::m_doc_root=g_config.doc_root.c_str();
+    }
+    // 根目录只打开一次，请求的文件都相对它查找，不再每次拼接、逐级解析完整路径
+    http_conn::m_root_fd=open(http_conn::m_doc_root,O_PATH|O_DIRECTORY|O_CLOEXEC);
+    if(http_conn::m_root_fd<0){
+        EMlog(LOGLEVEL_ERROR,"cannot open doc root %s: %s\n", http_conn::m_doc_root, strerror(errno));
+        exit(-1);
+    }
+
+    //静态资源包：指定了资源包文件就整体mmap进来，否则启动时从网站根目录生成
+    bool pack_ok = (argc>2) ? http_conn::m_asset_pack.load(argv[3])
+                            : http_conn::m_asset_pack.build(http_conn::m_doc_root,upload_prefix);
+    if(!pack_ok){
+        EMlog(LOGLEVEL_WARN,"asset pack unavailable, serving from %s only.\n", http_conn::m_doc_root);
+    }
+
+    // 指定了证书就在监听端口上启用TLS
+    tls_context tls;
+    if(cert_file||key_file){
+        if(!cert_file||!key_file){
+            EMlog(LOGLEVEL_ERROR,"TLS needs both -c cert.pem and -k key.pem.\n");
+            exit(-1);
+        }
+        if(use_coroutine){
+            EMlog(LOGLEVEL_ERROR,"TLS is not supported with coroutine handlers (-C).\n");
+            exit(-1);
+        }
+        if(!tls.init(cert_file,key_file)){
+            exit(-1);
+        }
+        tls.set_session_cache_size(g_config.tls_session_cache);
+        http_conn::m_tls=&tls;
+    }
+
+    // 访问日志文件最多保留的记录数，写满后覆盖最旧的
+    if(access_log_file&&!access_log_open(access_log_file,1<<18)){
+        exit(-1);
+    }
 
     //对SIGPIE信号进行处理
     addsig(SIGPIPE,SIG_IGN);
@@ -85,14 +195,18 @@ int main(int argc,char* argv[])
     int ret = bind(listenfd,(struct sockaddr*)&address,sizeof(address));
     assert( ret != -1 );    // ...判断是否成功
 
+    // 监听socket的调优参数（TCP_DEFER_ACCEPT、TCP_FASTOPEN等）
+    apply_listen_profile(listenfd,g_socket_profile);
+
     //监听
-    ret=listen(listenfd,8);
+    ret=listen(listenfd,g_socket_profile.backlog);
     assert( ret != -1 );    // ...判断是否成功
 
     //创建epoll对象，事件数组，添加（IO多路复用，同时检测多个事件）
-    epoll_event events[MAX_EVENT_NUMBER];   // 结构体数组，接收检测后的数据
+    std::vector<epoll_event> events(g_config.max_events);   // 结构体数组，接收检测后的数据
     int epollfd=epoll_create(5);    // 参数 5 无意义， > 0 即可
     assert( epollfd != -1 );
+    busy_poller poller(epollfd,g_socket_profile.busy_poll,g_socket_profile.prefer_busy_poll);
 
     //将监听的文件描述符添加到epoll对象中
     addfd(epollfd,listenfd,false,false); // 监听文件描述符不需要 ONESHOT & ET
@@ -106,29 +220,182 @@ int main(int argc,char* argv[])
     // 设置信号处理函数
     addsig(SIGALRM, sig_to_pipe);   // 定时器信号
     addsig(SIGTERM, sig_to_pipe);   // SIGTERM 关闭服务器
+    addsig(SIGUSR1, sig_to_pipe);   // SIGUSR1 导出分阶段跟踪的数据
+    addsig(SIGHUP, sig_to_pipe);    // SIGHUP 重新加载配置文件
     bool stop_server = false;       // 关闭服务器标志位
 
 
 
     //创建一个数组用于保存所有的客户端信息(在http_conn类里，更好的办法是分开来
-    http_conn * users=new http_conn[MAX_FD];
+    const int max_fd=g_config.max_fd;
+    http_conn * users=new http_conn[max_fd];
     http_conn::m_epollfd=epollfd;   // 静态成员，类共享
 
+    // 反向代理：后端连接和客户端连接在同一个epoll中
+    proxy_pool* proxy=new proxy_pool(epollfd,max_fd);
+    proxy->set_max_idle(g_config.proxy_idle);
+    for(size_t i=0;i<routes.size();++i){
+        if(!proxy->add_route(routes[i])){
+            EMlog(LOGLEVEL_ERROR,"bad proxy route %s, expect prefix=ip:port\n", routes[i]);
+            exit(-1);
+        }
+    }
+    if(!proxy->empty()){
+        http_conn::m_proxy_pool=proxy;
+    }
+
+    // 冷文件的磁盘读取交给 I/O 线程，主线程不在缺页上等磁盘
+    io_pool* io=NULL;
+    if(g_config.io_threads>0){
+        try{
+            io=new io_pool(epollfd,g_config.io_threads,http_conn::on_io_done);
+        }catch(...){
+            EMlog(LOGLEVEL_WARN,"cannot start io pool, files are sent from the mapping directly.\n");
+        }
+        http_conn::m_io_pool=io;
+    }
+
+    // 不存在的路径缓存，按根目录下目录的变化作废
+    neg_cache* neg=NULL;
+    if(g_config.neg_cache>0){
+        try{
+            neg=new neg_cache(epollfd,http_conn::m_doc_root,g_config.neg_cache);
+        }catch(...){
+            EMlog(LOGLEVEL_WARN,"negative cache unavailable, every missing path is looked up.\n");
+        }
+        http_conn::m_neg_cache=neg;
+    }
+
+    // 按客户端地址限速，新连接在 accept 时检查，请求在读到新请求时检查
+    rate_limiter* limiter=NULL;
+    if(g_config.rate_entries>0){
+        limiter=new rate_limiter(g_config.rate_entries);
+        limiter->set_limit(rate_limiter::KIND_IP,g_config.ip_rate,g_config.ip_burst);
+        limiter->set_limit(rate_limiter::KIND_NET,g_config.net_rate,g_config.net_burst);
+        http_conn::m_limiter=limiter;
+    }
+
+    // 协程处理连接时，连接的事件和超时都由 co_reactor 处理
+    co_reactor* co=NULL;
+    if(use_coroutine){
+        try{
+            co=new co_reactor(epollfd,max_fd);
+        }catch(...){
+            exit(-1);
+        }
+    }
+
     //创建线程池，初始化线程池
     //任务：http连接的任务
     threadpool<http_conn> * pool=NULL;
     try{
-        pool=new threadpool<http_conn>();
+        pool=new threadpool<http_conn>(g_config.min_threads,g_config.max_threads,g_config.max_queue);
     }catch(...){
+        EMlog(LOGLEVEL_ERROR,"cannot start thread pool, min_threads %d max_threads %d.\n", g_config.min_threads, g_config.max_threads);
+        exit(-1);
+    }
+    pool->set_grow_threshold(g_config.grow_queue,g_config.grow_wait_ms);
+    pool->set_idle_timeout(g_config.idle_retire*1000);
+    pool->set_weight(CLASS_SMALL,g_config.weight_small);
+    pool->set_weight(CLASS_NORMAL,g_config.weight_normal);
+    pool->set_weight(CLASS_BULK,g_config.weight_bulk);
+    bulk_prefix_add(g_config.bulk_prefix.c_str());
+
+    // 能在运行中修改的参数，修改后转给各个模块
+    config_hook pool_limits=[pool](int){
+        if(!pool->set_limits(g_config.min_threads,g_config.max_threads)){
+            EMlog(LOGLEVEL_WARN,"thread pool: min_threads %d > max_threads %d, not applied.\n", g_config.min_threads, g_config.max_threads);
+        }
+    };
+    config_watch("min_threads",pool_limits);
+    config_watch("max_threads",pool_limits);
+    config_hook pool_grow=[pool](int){ pool->set_grow_threshold(g_config.grow_queue,g_config.grow_wait_ms); };
+    config_watch("grow_queue",pool_grow);
+    config_watch("grow_wait_ms",pool_grow);
+    config_watch("idle_retire",[pool](int v){ pool->set_idle_timeout(v*1000); });
+    config_watch("weight_small",[pool](int v){ pool->set_weight(CLASS_SMALL,v); });
+    config_watch("weight_normal",[pool](int v){ pool->set_weight(CLASS_NORMAL,v); });
+    config_watch("weight_bulk",[pool](int v){ pool->set_weight(CLASS_BULK,v); });
+    config_watch("max_queue",[pool](int v){ pool->set_max_requests(v); });
+    config_watch("log_level",[](int v){ g_log_level.store(v); });
+    config_watch("tls_session_cache",[&tls](int v){ tls.set_session_cache_size(v); });
+    config_watch("proxy_idle",[proxy](int v){ proxy->set_max_idle(v); });
+    if(limiter){
+        config_hook ip_limit=[limiter](int){ limiter->set_limit(rate_limiter::KIND_IP,g_config.ip_rate,g_config.ip_burst); };
+        config_hook net_limit=[limiter](int){ limiter->set_limit(rate_limiter::KIND_NET,g_config.net_rate,g_config.net_burst); };
+        config_watch("ip_rate",ip_limit);
+        config_watch("ip_burst",ip_limit);
+        config_watch("net_rate",net_limit);
+        config_watch("net_burst",net_limit);
+    }
+
+    // 管理 socket：查看和修改运行参数，输出内部状态
+    admin_server admin(epollfd);
+    admin.add_command("stats","stats",[&](const std::vector<std::string>&, std::string& out){
+        char line[256];
+        snprintf(line,sizeof(line),"connections: %d (coroutine %d), requests: %d\n",
+                 http_conn::m_user_count, co?co->count():0, http_conn::m_request_count);
+        out+=line;
+        snprintf(line,sizeof(line),"thread pool: %d threads (%d idle, %d..%d), %zu queued, %ld dropped, %ld grown, %ld retired\n",
+                 pool->thread_number(), pool->idle_threads(), g_config.min_threads, g_config.max_threads,
+                 pool->queue_size(), pool->cancelled(), pool->grown(), pool->retired());
+        out+=line;
+        snprintf(line,sizeof(line),"timeouts: scale %d%%",timeout_scale(http_conn::m_user_count)/10);
+        out+=line;
+        for(int p=0;p<PHASE_COUNT;++p){
+            snprintf(line,sizeof(line),", %s %ds (%ld expired)",timer_phase_name(p),
+                     phase_timeout(p,http_conn::m_user_count),http_conn::m_timer_lst.expired(p));
+            out+=line;
+        }
+        snprintf(line,sizeof(line),", %ld deferred while processing\n",http_conn::m_timer_lst.deferred());
+        out+=line;
+        for(int c=0;c<CLASS_COUNT;++c){
+            snprintf(line,sizeof(line),"  class %s: weight %d, %zu queued, %ld dispatched\n",
+                     request_class_name(c), c==CLASS_SMALL?g_config.weight_small:c==CLASS_NORMAL?g_config.weight_normal:g_config.weight_bulk,
+                     pool->queue_size(c), pool->dispatched(c));
+            out+=line;
+        }
+        mem_pool_stats st[64];
+        int n=mem_pool_snapshot(st,64);
+        for(int i=0;i<n;++i){
+            snprintf(line,sizeof(line),"mem pool %s: obj size %zu, slabs %ld, in use %ld / %ld\n",
+                     st[i].name, st[i].obj_size, st[i].slabs, st[i].in_use, st[i].capacity);
+            out+=line;
+        }
+        if(io){
+            snprintf(line,sizeof(line),"io pool: %ld windows checked, %ld cold, %ld bytes read, %ld cached by RWF_NOWAIT\n",
+                     io->checks(),io->cold(),io->bytes_read(),io->probe_hits());
+            out+=line;
+        }
+        if(limiter){
+            snprintf(line,sizeof(line),"rate limit: ip %d/s burst %d, /24 %d/s burst %d, %ld limited, %ld evicted\n",
+                     g_config.ip_rate,g_config.ip_burst,g_config.net_rate,g_config.net_burst,limiter->limited(),limiter->evicted());
+            out+=line;
+        }
+        if(neg){
+            snprintf(line,sizeof(line),"negative cache: %ld hits, %ld recorded, %ld invalidations, %zu directories watched%s\n",
+                     neg->hits(),neg->recorded(),neg->invalidations(),neg->watches(),neg->enabled()?"":" (disabled)");
+            out+=line;
+        }
+        if(access_log_enabled()){
+            snprintf(line,sizeof(line),"access log: %llu records\n",(unsigned long long)g_access_log->next);
+            out+=line;
+        }
+    });
+    // 各个锁的竞争情况，需要用 LOCK_STATS=1 编译
+    admin.add_command("locks","locks",[](const std::vector<std::string>&, std::string& out){
+        lock_stats_report(out);
+    });
+    if(!g_config.admin_socket.empty() && !admin.open(g_config.admin_socket.c_str())){
         exit(-1);
     }
 
     bool timeout = false;   // 定时器周期已到
-    alarm(TIMESLOT);        // 定时产生SIGALRM信号
+    alarm(g_config.timer_slot);     // 定时产生SIGALRM信号
 
     while(!stop_server){
         // 检测事件
-        int num=epoll_wait(epollfd,events,MAX_EVENT_NUMBER,-1); // 阻塞，返回事件数量
+        int num=poller.wait(events.data(),events.size()); // 阻塞（或者先自旋），返回事件数量
         if(num<0 && errno!= EINTR){
 //            printf("epoll failure!\n");
             EMlog(LOGLEVEL_ERROR,"EPOLL failed.\n");
@@ -144,8 +411,12 @@ int main(int argc,char* argv[])
                 struct sockaddr_in client_address;
                 socklen_t client_addrlen=sizeof(client_address);
                 int connfd=accept(listenfd,(struct sockaddr*)&client_address,&client_addrlen);
+                if(connfd<0){
+                    continue;
+                }
 
-                if( http_conn::m_user_count >= MAX_FD ){
+                int conns=http_conn::m_user_count+(co?co->count():0);
+                if( connfd >= max_fd || conns >= g_config.max_conns ){
                     //目前连接数满了
 
                     //给客户端写一个信息:服务器内部正忙
@@ -153,9 +424,23 @@ int main(int argc,char* argv[])
                     close(connfd);
                     continue;
                 }
+                if(limiter && limiter->enabled() && !limiter->allow(client_address.sin_addr.s_addr)){
+                    // 这个地址新建连接太快，回一个 429 就关闭，不占用连接
+                    http_conn::send_canned(connfd,http_conn::TOO_MANY_REQUESTS);
+                    close(connfd);
+                    continue;
+                }
+
+                if(co){
+                    co->start(connfd,client_address,co_serve_http);
+                    continue;
+                }
 
                 //将新的客户的数据初始化，放到数组中
-                users[connfd].init(connfd,client_address);
+                if(!users[connfd].init(connfd,client_address)){
+                    close(connfd);      // TLS 会话创建失败
+                    continue;
+                }
                 // conn_fd 作为索引
                 // 当listen_fd也注册了ONESHOT事件时(addfd)，
                 // 接受了新的连接后需要重置socket上EPOLLONESHOT事件，确保下次可读时，EPOLLIN 事件被触发
@@ -180,9 +465,37 @@ int main(int argc,char* argv[])
                             break;
                         case SIGTERM:
                             stop_server = true;
+                            break;
+                        case SIGUSR1:
+                            trace_dump(g_trace_file);
+                            break;
+                        case SIGHUP:
+                            config_reload();
+                            break;
                         }
                     }
                 }
+            }else if(sockfd == proxy->wakeup_fd()){
+                // 工作线程提交了转发请求
+                proxy->on_wakeup();
+            }else if(io && sockfd == io->wakeup_fd()){
+                // 冷文件读进页缓存了，继续发送
+                io->on_wakeup();
+            }else if(neg && sockfd == neg->notify_fd()){
+                // 根目录下有目录变化
+                neg->on_notify();
+            }else if(proxy->owns(sockfd)){
+                // 后端连接上的事件
+                proxy->handle_event(sockfd);
+            }else if(co && sockfd == co->timer_fd()){
+                // 协程等待超时
+                co->on_timer();
+            }else if(co && co->owns(sockfd)){
+                // 恢复等待这个连接的协程
+                co->handle_event(sockfd, events[i].events);
+            }else if(admin.owns(sockfd)){
+                // 管理命令
+                admin.handle_event(sockfd, events[i].events);
             }else if(events[i].events& (EPOLLRDHUP|EPOLLHUP|EPOLLERR)){
                 //对方异常断开或者错误等事件
                 EMlog(LOGLEVEL_DEBUG,"-------EPOLLRDHUP | EPOLLHUP | EPOLLERR--------\n");
@@ -194,8 +507,14 @@ int main(int argc,char* argv[])
                 //有读的事件发生
                 EMlog(LOGLEVEL_DEBUG,"-------EPOLLIN-------\n\n");
                 if(users[sockfd].read()){
-                    //一次把所有数据读出来
-                    pool->append(users+sockfd);
+                    //一次把所有数据读出来，线程池队列满了就关闭连接
+                    if(users[sockfd].limited()){
+                        // 超过速率限制，429 已经准备好，等 EPOLLOUT 时发出
+                    }else if(!pool->append(users+sockfd)){
+                        EMlog(LOGLEVEL_WARN,"thread pool queue full, closing fd %d\n", sockfd);
+                        users[sockfd].close_conn();
+                        http_conn::m_timer_lst.del_timer(users[sockfd].timer);
+                    }
                 }else{
                     //读失败或者没读到数据
                     users[sockfd].close_conn();
@@ -216,19 +535,49 @@ int main(int argc,char* argv[])
             // 定时处理任务，实际上就是调用tick()函数
             http_conn::m_timer_lst.tick();
             // 因为一次 alarm 调用只会引起一次SIGALARM 信号，所以我们要重新定时，以不断触发 SIGALARM信号。
-            alarm(TIMESLOT);
+            alarm(g_config.timer_slot);
             timeout = false;    // 重置timeout
         }
     }
 
+    mem_pool_report();      // 输出内存池占用情况
+    tls.report();           // 输出TLS会话复用情况
+    poller.report();        // 输出忙等的命中情况
+    if(io){
+        io->report();       // 输出冷文件的读取情况
+    }
+    if(neg){
+        neg->report();      // 输出不存在的路径缓存的命中情况
+    }
+    EMlog(LOGLEVEL_INFO,"thread pool: %ld queued tasks dropped for closed connections, %ld threads grown, %ld retired.\n", pool->cancelled(), pool->grown(), pool->retired());
+
     close(epollfd);
     close(listenfd);
 
     close(pipefd[1]);
     close(pipefd[0]);
-
+    close(http_conn::m_root_fd);
+
+    delete pool;            // 等工作线程处理完手上的请求并退出，之后才能释放连接
+    delete io;
+#if LOCK_STATS
+    {
+        // 工作线程都退出了，这时的锁统计是完整的
+        std::string locks;
+        lock_stats_report(locks);
+        size_t start=0,end;
+        while((end=locks.find('\n',start))!=std::string::npos){    // 一行一条日志，避免超出日志的缓冲区
+            EMlog(LOGLEVEL_INFO,"%s\n",locks.substr(start,end-start).c_str());
+            start=end+1;
+        }
+    }
+#endif
+    delete neg;
+    delete limiter;
     delete[] users;
-    delete pool;
+    delete proxy;
+    delete co;
+    access_log_close();
 
     return 0;
 }
@@ -0,0 +1,50 @@
+#include "mem_pool.h"
+
+#include <cxxabi.h>
+
+#include "log.h"
+
+static const int MAX_POOLS = 32;
+static mem_pool_stats_fn pools[MAX_POOLS];
+static int pool_count = 0;
+static locker pools_lock( "mem pool registry" );
+
+void mem_pool_register(mem_pool_stats_fn fn)
+{
+    pools_lock.lock();
+    if( pool_count < MAX_POOLS ) {
+        pools[pool_count++] = fn;
+    }
+    pools_lock.unlock();
+}
+
+void mem_pool_report()
+{
+    pools_lock.lock();
+    for( int i = 0; i < pool_count; ++i ) {
+        mem_pool_stats st;
+        pools[i]( &st );
+        EMlog(LOGLEVEL_INFO, "mem pool %s: obj size %zu, slabs %ld, in use %ld / %ld\n",
+              st.name, st.obj_size, st.slabs, st.in_use, st.capacity);
+    }
+    pools_lock.unlock();
+}
+
+int mem_pool_snapshot(mem_pool_stats *out, int max)
+{
+    pools_lock.lock();
+    int n = pool_count < max ? pool_count : max;
+    for( int i = 0; i < n; ++i ) {
+        pools[i]( &out[i] );
+    }
+    pools_lock.unlock();
+    return n;
+}
+
+const char *mem_pool_type_name(const char *mangled)
+{
+    // 每种类型只解析一次，结果不释放
+    int status = 0;
+    char* name = abi::__cxa_demangle( mangled, NULL, NULL, &status );
+    return status == 0 ? name : mangled;
+}
@@ -0,0 +1,214 @@
+/*
+    内存池
+    定长对象按 slab 批量申请，释放后放回空闲链表复用，稳定运行时不再调用 malloc/free。
+    每个线程有自己的小缓存，大部分申请和释放不需要加锁，缓存过多或不够时才批量和全局空闲链表交换。
+*/
+
+#ifndef MEM_POOL_H
+#define MEM_POOL_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+#include <typeinfo>
+
+#include "locker.h"
+
+// 内存池的占用情况
+struct mem_pool_stats
+{
+    const char* name;       // 对象类型名
+    size_t obj_size;        // 对象大小
+    long slabs;             // 已申请的 slab 数
+    long capacity;          // 全部 slab 能容纳的对象数
+    long in_use;            // 正在使用的对象数
+};
+
+typedef void (*mem_pool_stats_fn)(mem_pool_stats* st);
+
+// 内存池第一次申请 slab 时注册自己，用于统一输出占用情况
+void mem_pool_register(mem_pool_stats_fn fn);
+// 输出所有内存池的占用情况
+void mem_pool_report();
+// 取得所有内存池的占用情况，最多 max 个，返回个数
+int mem_pool_snapshot(mem_pool_stats* out, int max);
+// 取得对象类型的可读名字
+const char* mem_pool_type_name(const char* mangled);
+
+// T 类型对象的内存池，所有 T 共享一个
+template<typename T>
+class mem_pool
+{
+public:
+    static const int SLAB_BYTES = 64 * 1024;    // 每次向系统申请的大小
+    static const int CACHE_BATCH = 32;          // 线程缓存和全局空闲链表之间一次交换的对象数
+
+    // 申请一个对象的内存（未构造）
+    static void* alloc();
+    // 归还一个对象的内存（已析构）
+    static void free(void* p);
+    // 占用情况
+    static void stats(mem_pool_stats* st);
+
+private:
+    union node
+    {
+        node* next;
+        alignas(T) char obj[ sizeof(T) ];
+    };
+
+    static const int OBJS_PER_SLAB = SLAB_BYTES / sizeof(node) > 16 ? SLAB_BYTES / sizeof(node) : 16;
+
+    // 线程缓存，线程退出时把缓存的对象还给全局空闲链表
+    struct thread_cache
+    {
+        node* head = NULL;
+        int count = 0;
+        ~thread_cache() { flush( *this, count ); }
+    };
+
+    // 从全局空闲链表取一批对象到线程缓存，不够就申请新的 slab
+    static void refill(thread_cache& c);
+    // 把线程缓存中的 n 个对象还给全局空闲链表
+    static void flush(thread_cache& c, int n);
+
+private:
+    static thread_local thread_cache t_cache;
+    static node* m_free_list;           // 全局空闲链表
+    static long m_slabs;                // 已申请的 slab 数
+    static locker m_lock;               // 保护全局空闲链表
+    static std::atomic<long> m_in_use;  // 正在使用的对象数
+};
+
+template<typename T>
+thread_local typename mem_pool<T>::thread_cache mem_pool<T>::t_cache;
+template<typename T>
+typename mem_pool<T>::node* mem_pool<T>::m_free_list = NULL;
+template<typename T>
+long mem_pool<T>::m_slabs = 0;
+template<typename T>
+locker mem_pool<T>::m_lock( "mem pool" );
+template<typename T>
+std::atomic<long> mem_pool<T>::m_in_use( 0 );
+
+template<typename T>
+void *mem_pool<T>::alloc()
+{
+    thread_cache& c = t_cache;
+    if( !c.head ) {
+        refill( c );
+    }
+    node* n = c.head;
+    c.head = n->next;
+    --c.count;
+    m_in_use.fetch_add( 1, std::memory_order_relaxed );
+    return n;
+}
+
+template<typename T>
+void mem_pool<T>::free(void *p)
+{
+    if( !p ) {
+        return;
+    }
+    thread_cache& c = t_cache;
+    node* n = (node*)p;
+    n->next = c.head;
+    c.head = n;
+    ++c.count;
+    m_in_use.fetch_sub( 1, std::memory_order_relaxed );
+
+    // 一个线程只释放不申请（比如主线程申请、工作线程释放）时，缓存不能无限增长
+    if( c.count >= 2 * CACHE_BATCH ) {
+        flush( c, CACHE_BATCH );
+    }
+}
+
+template<typename T>
+void mem_pool<T>::refill(thread_cache &c)
+{
+    m_lock.lock();
+    if( !m_free_list ) {
+        // 申请一个新的 slab，切成对象挂到全局空闲链表上。slab 不会还给系统
+        node* slab = (node*)malloc( sizeof(node) * OBJS_PER_SLAB );
+        if( !slab ) {
+            m_lock.unlock();
+            throw std::bad_alloc();
+        }
+        for( int i = 0; i < OBJS_PER_SLAB - 1; ++i ) {
+            slab[i].next = &slab[i + 1];
+        }
+        slab[OBJS_PER_SLAB - 1].next = NULL;
+        m_free_list = slab;
+        if( m_slabs++ == 0 ) {
+            mem_pool_register( stats );
+        }
+    }
+
+    for( int i = 0; i < CACHE_BATCH && m_free_list; ++i ) {
+        node* n = m_free_list;
+        m_free_list = n->next;
+        n->next = c.head;
+        c.head = n;
+        ++c.count;
+    }
+    m_lock.unlock();
+}
+
+template<typename T>
+void mem_pool<T>::flush(thread_cache &c, int n)
+{
+    if( n <= 0 ) {
+        return;
+    }
+    // 先在线程内摘下 n 个，再一次性挂到全局链表上
+    node* first = c.head;
+    node* last = first;
+    for( int i = 1; i < n; ++i ) {
+        last = last->next;
+    }
+    c.head = last->next;
+    c.count -= n;
+
+    m_lock.lock();
+    last->next = m_free_list;
+    m_free_list = first;
+    m_lock.unlock();
+}
+
+template<typename T>
+void mem_pool<T>::stats(mem_pool_stats *st)
+{
+    static const char* name = mem_pool_type_name( typeid(T).name() );
+    st->name = name;
+    st->obj_size = sizeof(T);
+    m_lock.lock();
+    st->slabs = m_slabs;
+    m_lock.unlock();
+    st->capacity = st->slabs * OBJS_PER_SLAB;
+    st->in_use = m_in_use.load( std::memory_order_relaxed );
+}
+
+// 继承它的类用 new/delete 时自动从内存池中分配
+// 用法：class foo : public pool_allocated<foo>
+template<typename T>
+class pool_allocated
+{
+public:
+    static void* operator new(size_t size)
+    {
+        // 派生类大小不同，不能用 T 的内存池
+        return size == sizeof(T) ? mem_pool<T>::alloc() : ::operator new( size );
+    }
+    static void operator delete(void* p, size_t size)
+    {
+        if( size == sizeof(T) ) {
+            mem_pool<T>::free( p );
+        } else {
+            ::operator delete( p );
+        }
+    }
+};
+
+#endif // MEM_POOL_H
@@ -0,0 +1,6 @@
+
+HEADERS += \
+    $$PWD/mem_pool.h
+
+SOURCES += \
+    $$PWD/mem_pool.cpp
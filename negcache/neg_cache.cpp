@@ -0,0 +1,197 @@
+#include "neg_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <exception>
+
+#include "log.h"
+
+//添加文件描述符到epoll中
+extern void addfd(int epollfd,int fd,bool one_shot,bool et);
+//删除文件描述符
+extern void removefd(int epollfd,int fd);
+
+// 代数占每一项的低 24 位，其余是哈希的高位
+static const uint64_t EPOCH_MASK = ( 1ull << 24 ) - 1;
+// 监视的目录层数上限，防止符号链接成环
+static const int MAX_DEPTH = 32;
+static const uint32_t WATCH_MASK = IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_MOVE_SELF | IN_ONLYDIR;
+
+// FNV-1a
+static uint64_t path_hash(const char* s, int len)
+{
+    uint64_t h = 14695981039346656037ull;
+    for( int i = 0; i < len; ++i ) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+neg_cache::neg_cache(int epollfd, const char *doc_root, int entries)
+    : m_epollfd(epollfd), m_root(doc_root), m_epoch(1), m_enabled(true), m_hits(0), m_recorded(0), m_invalidations(0)
+{
+    size_t n = 1024;
+    while( n < (size_t)entries && n < ( 1u << 24 ) ) {
+        n <<= 1;
+    }
+    m_table = std::vector<std::atomic<uint64_t>>( n );
+    m_mask = n - 1;
+
+    m_inotify = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+    if( m_inotify < 0 ) {
+        EMlog(LOGLEVEL_WARN, "negative cache: inotify_init1 failed: %s\n", strerror(errno));
+        throw std::exception();
+    }
+    watch_tree( m_root, 0 );
+    if( !enabled() ) {
+        close( m_inotify );
+        throw std::exception();
+    }
+    addfd( m_epollfd, m_inotify, false, false );
+}
+
+neg_cache::~neg_cache()
+{
+    removefd( m_epollfd, m_inotify );
+}
+
+void neg_cache::record(const char *path, int len, uint32_t epoch)
+{
+    uint64_t h = path_hash( path, len );
+    m_table[ h & m_mask ].store( ( h & ~EPOCH_MASK ) | ( epoch & EPOCH_MASK ), std::memory_order_relaxed );
+    m_recorded.fetch_add( 1, std::memory_order_relaxed );
+}
+
+bool neg_cache::lookup(const char *path, int len)
+{
+    if( !enabled() ) {
+        return false;
+    }
+    uint64_t h = path_hash( path, len );
+    uint64_t v = m_table[ h & m_mask ].load( std::memory_order_relaxed );
+    uint64_t want = ( h & ~EPOCH_MASK ) | ( epoch() & EPOCH_MASK );
+    if( v != want ) {
+        return false;
+    }
+    m_hits.fetch_add( 1, std::memory_order_relaxed );
+    return true;
+}
+
+void neg_cache::invalidate()
+{
+    uint32_t e = m_epoch.fetch_add( 1, std::memory_order_acq_rel ) + 1;
+    if( ( e & EPOCH_MASK ) == 0 ) {
+        // 代数绕回，清掉旧记录，避免很早以前的记录重新生效。空项是0，代数跳过0
+        for( size_t i = 0; i < m_table.size(); ++i ) {
+            m_table[i].store( 0, std::memory_order_relaxed );
+        }
+        m_epoch.fetch_add( 1, std::memory_order_acq_rel );
+    }
+    m_invalidations.fetch_add( 1, std::memory_order_relaxed );
+}
+
+void neg_cache::on_notify()
+{
+    alignas( struct inotify_event ) char buf[ 16 * ( sizeof( struct inotify_event ) + NAME_MAX + 1 ) ];
+    bool changed = false;
+    bool moved = false;
+    ssize_t n;
+    while( ( n = read( m_inotify, buf, sizeof( buf ) ) ) > 0 ) {
+        for( char* p = buf; p < buf + n; ) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            p += sizeof( struct inotify_event ) + ev->len;
+
+            if( ev->mask & IN_Q_OVERFLOW ) {
+                // 丢了事件，不知道哪些目录变了
+                changed = moved = true;
+                continue;
+            }
+            if( ev->mask & IN_IGNORED ) {
+                m_dirs.erase( ev->wd );
+                continue;
+            }
+            if( ev->mask & ( IN_CREATE | IN_MOVED_TO ) ) {
+                changed = true;
+            }
+            if( ( ev->mask & IN_MOVE_SELF ) || ( ( ev->mask & IN_MOVED_FROM ) && ( ev->mask & IN_ISDIR ) ) ) {
+                moved = true;
+            } else if( ( ev->mask & ( IN_CREATE | IN_MOVED_TO ) ) && ( ev->mask & IN_ISDIR ) && ev->len > 0 ) {
+                // 新目录也要监视，它下面可能已经有文件了
+                std::map<int, std::string>::iterator it = m_dirs.find( ev->wd );
+                if( it != m_dirs.end() ) {
+                    watch_tree( it->second + "/" + ev->name, 0 );
+                }
+            }
+        }
+    }
+    if( moved ) {
+        rewatch();
+    }
+    if( changed || moved ) {
+        invalidate();
+    }
+}
+
+void neg_cache::watch_tree(const std::string &dir, int depth)
+{
+    if( depth > MAX_DEPTH ) {
+        return;
+    }
+    int wd = inotify_add_watch( m_inotify, dir.c_str(), WATCH_MASK );
+    if( wd < 0 ) {
+        if( errno == ENOENT || errno == ENOTDIR ) {
+            return;         // 刚创建就被删掉了
+        }
+        EMlog(LOGLEVEL_WARN, "negative cache: cannot watch %s: %s, disabled\n", dir.c_str(), strerror(errno));
+        m_enabled.store( false, std::memory_order_relaxed );
+        return;
+    }
+    // 同一个目录（比如被多个符号链接指向）只返回同一个监视描述符，已经监视过的不再进入
+    if( !m_dirs.insert( std::make_pair( wd, dir ) ).second ) {
+        return;
+    }
+
+    DIR* d = opendir( dir.c_str() );
+    if( !d ) {
+        return;
+    }
+    struct dirent* ent;
+    while( ( ent = readdir( d ) ) != NULL ) {
+        if( strcmp( ent->d_name, "." ) == 0 || strcmp( ent->d_name, ".." ) == 0 ) {
+            continue;
+        }
+        std::string path = dir + "/" + ent->d_name;
+        bool is_dir = ent->d_type == DT_DIR;
+        if( ent->d_type == DT_LNK || ent->d_type == DT_UNKNOWN ) {
+            // stat 会跟随符号链接，指向的目录也要监视
+            struct stat st;
+            is_dir = stat( path.c_str(), &st ) == 0 && S_ISDIR( st.st_mode );
+        }
+        if( is_dir ) {
+            watch_tree( path, depth + 1 );
+        }
+    }
+    closedir( d );
+}
+
+void neg_cache::rewatch()
+{
+    for( std::map<int, std::string>::iterator it = m_dirs.begin(); it != m_dirs.end(); ++it ) {
+        inotify_rm_watch( m_inotify, it->first );
+    }
+    m_dirs.clear();
+    watch_tree( m_root, 0 );
+    EMlog(LOGLEVEL_INFO, "negative cache: directories moved, %zu watched again\n", m_dirs.size());
+}
+
+void neg_cache::report() const
+{
+    EMlog(LOGLEVEL_INFO, "negative cache: %ld hits, %ld recorded, %ld invalidations, %zu directories watched%s\n",
+          hits(), recorded(), invalidations(), m_dirs.size(), enabled() ? "" : " (disabled)");
+}
@@ -0,0 +1,69 @@
+/*
+    不存在的路径的缓存
+    扫描器会发来大量不存在的路径，每个都要 stat 一遍（逐级查找目录）才能返回404。
+    工作线程 stat 得到 ENOENT/ENOTDIR 后把路径记下来，同一路径再来时直接返回预先生成的404，不访问文件系统。
+    表是按路径哈希的直接映射表，大小固定，冲突时覆盖。每一项带着记录时的代数：
+        网站根目录下的每个目录都用 inotify 监视，有文件或目录被创建、移入时代数加一，之前的记录全部作废；
+        工作线程在 stat 之前取代数，stat 期间目录有变化的话记下的就是作废的代数，不会把刚创建的文件当成不存在。
+    PUT 上传的文件由工作线程自己作废，不等主线程处理 inotify 事件。
+    监视失败（比如超过 max_user_watches）时整个缓存停用。
+*/
+
+#ifndef NEG_CACHE_H
+#define NEG_CACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+class neg_cache
+{
+public:
+    // entries 向上取整到2的幂
+    neg_cache(int epollfd, const char* doc_root, int entries);
+    ~neg_cache();
+
+    // 工作线程调用：stat 之前取代数，确认不存在后用它记录
+    uint32_t epoch() const { return m_epoch.load( std::memory_order_acquire ); }
+    void record(const char* path, int len, uint32_t epoch);
+    // 路径最近确认过不存在
+    bool lookup(const char* path, int len);
+    // 之前的记录全部作废，任何线程都可以调用
+    void invalidate();
+
+    int notify_fd() const { return m_inotify; }
+    // 主线程调用：处理目录的变化
+    void on_notify();
+
+    bool enabled() const { return m_enabled.load( std::memory_order_relaxed ); }
+    long hits() const { return m_hits.load( std::memory_order_relaxed ); }
+    long recorded() const { return m_recorded.load( std::memory_order_relaxed ); }
+    long invalidations() const { return m_invalidations.load( std::memory_order_relaxed ); }
+    size_t watches() const { return m_dirs.size(); }
+    void report() const;
+
+private:
+    // 监视 dir 和它下面的所有目录，失败时停用缓存
+    void watch_tree(const std::string& dir, int depth);
+    // 目录被移动后原来记下的路径不对了，全部重新监视
+    void rewatch();
+
+private:
+    int m_epollfd;
+    int m_inotify;
+    std::string m_root;
+    std::map<int, std::string> m_dirs;      // 监视描述符 -> 目录，只在主线程中使用
+
+    std::vector<std::atomic<uint64_t>> m_table;     // 哈希的高位 | 代数
+    uint64_t m_mask;
+    std::atomic<uint32_t> m_epoch;
+    std::atomic<bool> m_enabled;
+
+    std::atomic<long> m_hits;
+    std::atomic<long> m_recorded;
+    std::atomic<long> m_invalidations;
+};
+
+#endif // NEG_CACHE_H
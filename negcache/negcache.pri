@@ -0,0 +1,5 @@
+HEADERS += \
+    $$PWD/neg_cache.h
+
+SOURCES += \
+    $$PWD/neg_cache.cpp
@@ -1,5 +1,39 @@
 #include "lst_timer.h"
 
+#include <algorithm>
+
+#include "admin/server_config.h"
+
+int timeout_scale(int conns)
+{
+    int capacity = g_config.max_conns < g_config.max_fd ? g_config.max_conns : g_config.max_fd;
+    long pct = capacity > 0 ? (long)conns * 100 / capacity : 0;
+    int from = g_config.timeout_shrink_pct;
+    if( pct <= from || from >= 100 ) {
+        return 1000;
+    }
+    if( pct > 100 ) {
+        pct = 100;
+    }
+    // 从 from% 时的 1000 线性降到 100% 时的 timeout_min_pct * 10
+    int low = g_config.timeout_min_pct * 10;
+    return 1000 - ( 1000 - low ) * ( pct - from ) / ( 100 - from );
+}
+
+int phase_timeout(int phase, int conns)
+{
+    int base = phase == PHASE_HEADER ? g_config.header_timeout
+             : phase == PHASE_BODY ? g_config.body_timeout : g_config.idle_timeout;
+    int t = (long)base * timeout_scale( conns ) / 1000;
+    return t > 0 ? t : 1;
+}
+
+const char *timer_phase_name(int phase)
+{
+    static const char* names[] = { "header", "body", "idle" };
+    return phase >= 0 && phase < PHASE_COUNT ? names[phase] : "?";
+}
+
 sort_timer_lst::~sort_timer_lst()
 {
     util_timer* tmp = head;
@@ -21,6 +55,12 @@ void sort_timer_lst::add_timer(util_timer *timer)
     if( !head ) {       // 添加的为第一个节点，头结点（尾节点）
         head = tail = timer;
 //        return;
+    }else if( timer->exprie >= tail->exprie ) {
+        // 新的定时器大多最晚到期，直接接在尾部，不用从头遍历
+        tail->next = timer;
+        timer->prev = tail;
+        timer->next = NULL;
+        tail = timer;
     }else if( timer->exprie < head->exprie ) {
         /* 如果目标定时器的超时时间小于当前链表中所有定时器的超时时间，则把该定时器插入链表头部,作为链表新的头节点，
            否则就需要调用重载函数 add_timer(),把它插入链表中合适的位置，以保证链表的升序特性 */
@@ -45,6 +85,13 @@ void sort_timer_lst::adjust_timer(util_timer *timer)
         return ;
     }
 
+    // 超时时间提前到前一个定时器之前，取出来从头重新插入
+    if(timer->prev && timer->exprie < timer->prev->exprie){
+        unlink( timer );
+        add_timer( timer );
+        return;
+    }
+
     util_timer* temp = timer->next;
     // 如果被调整的目标定时器处在链表的尾部，或者该定时器新的超时时间值仍然小于其下一个定时器的超时时间则不用调整
     if(!temp||(timer->exprie < temp->exprie))
@@ -111,6 +158,13 @@ void sort_timer_lst::tick()
     }
 //    printf( "timer tick\n" );
     EMlog(LOGLEVEL_DEBUG, "timer tick.\n" );
+    // 负载比上次 tick 时高，已经设置的超时时间也要缩短
+    int scale = timeout_scale( http_conn::m_user_count );
+    if( scale < m_scale ) {
+        rescale( http_conn::m_user_count );
+    }
+    m_scale = scale;
+
     time_t cur = time( NULL );  // 获取当前系统时间
     util_timer* tmp = head;
     // 从头节点开始依次处理每个定时器，直到遇到一个尚未到期的定时器
@@ -121,18 +175,23 @@ void sort_timer_lst::tick()
             break;
         }
 
+        util_timer* next = tmp->next;
+        // 工作线程正在处理这个连接，关闭会释放它正在用的缓冲区，留在链表中等下一次 tick
+        if( !tmp->user_data->expire() ) {
+            ++m_deferred;
+            tmp = next;
+            continue;
+        }
+
         // 调用定时器的回调函数，以执行定时任务,关闭连接
 //        tmp->cb_func( tmp->user_data );
+        ++m_expired[ tmp->phase ];
         tmp->user_data->close_conn();
-        // 删除定时器
-//        del_timer(tmp);
-        // 执行完定时器中的定时任务之后，就将它从链表中删除，并重置链表头节点
-        head = tmp->next;
-        if( head ) {
-            head->prev = NULL;
-        }
+        tmp->user_data->timer = NULL;
+        // 执行完定时器中的定时任务之后，就将它从链表中删除
+        unlink( tmp );
         delete tmp;
-        tmp = head;
+        tmp = next;
     }
 }
 
@@ -165,3 +224,44 @@ void sort_timer_lst::add_timer(util_timer *timer, util_timer *lst_head)
         tail = timer;
     }
 }
+
+void sort_timer_lst::unlink(util_timer *timer)
+{
+    if( timer->prev ) {
+        timer->prev->next = timer->next;
+    } else {
+        head = timer->next;
+    }
+    if( timer->next ) {
+        timer->next->prev = timer->prev;
+    } else {
+        tail = timer->prev;
+    }
+    timer->prev = timer->next = NULL;
+}
+
+void sort_timer_lst::rescale(int conns)
+{
+    int timeouts[ PHASE_COUNT ];
+    for( int i = 0; i < PHASE_COUNT; ++i ) {
+        timeouts[i] = phase_timeout( i, conns );
+    }
+    std::vector<util_timer*> timers;
+    for( util_timer* t = head; t; t = t->next ) {
+        time_t e = t->start + timeouts[ t->phase ];
+        if( e < t->exprie ) {
+            t->exprie = e;
+        }
+        timers.push_back( t );
+    }
+    std::stable_sort( timers.begin(), timers.end(),
+                      []( const util_timer* a, const util_timer* b ) { return a->exprie < b->exprie; } );
+    // 按新的顺序重新串起来
+    for( size_t i = 0; i < timers.size(); ++i ) {
+        timers[i]->prev = i > 0 ? timers[i - 1] : NULL;
+        timers[i]->next = i + 1 < timers.size() ? timers[i + 1] : NULL;
+    }
+    head = timers.empty() ? NULL : timers.front();
+    tail = timers.empty() ? NULL : timers.back();
+    EMlog(LOGLEVEL_INFO, "timers rescaled to %d%% for %d connections\n", timeout_scale( conns ) / 10, conns);
+}
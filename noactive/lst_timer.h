@@ -1,6 +1,12 @@
 /*
     定时去检测非活跃的连接
     升序的双链表保存定时器
+    连接按所处的阶段使用不同的超时时间：
+        等请求头：从建立连接或者请求的第一个字节开始计时，中途收到数据也不推迟，慢速发送请求头的连接到期就关闭；
+        收请求体：每次收到数据推迟；
+        空闲：发送响应、长连接等下一个请求，每次有数据收发推迟。
+    连接数占上限的比例越高，超时时间越短，空闲的长连接更早让出位置给新客户端；负载降下来后新设置的超时时间随之恢复。
+    负载升高时 tick 把已经设置的超时时间也按新的比例缩短。
 */
 
 #ifndef LST_TIMER_H
@@ -9,8 +15,10 @@
 #include <stdio.h>
 #include <time.h>
 #include <arpa/inet.h>
+#include <vector>
 
 #include "http_conn.h"
+#include "memorypool/mem_pool.h"
 
 //#define BUF_SIZE 64
 
@@ -18,6 +26,16 @@
 
 class http_conn;    //前向声明
 
+// 连接的超时阶段
+enum TIMER_PHASE { PHASE_HEADER = 0, PHASE_BODY, PHASE_IDLE, PHASE_COUNT };
+
+// 超时时间的缩放比例（千分比）：连接数占上限的比例超过 timeout_shrink_pct 后线性缩小，满载时为 timeout_min_pct
+int timeout_scale(int conns);
+// 阶段的超时时间（秒），已经按连接数缩放，至少1秒
+int phase_timeout(int phase, int conns);
+// 阶段名，用于输出统计
+const char* timer_phase_name(int phase);
+
 //用户数据结构（将用户数据结构写在http里,不声明在这
 //struct client_data{
 //    sockaddr_in address;    //客户端socket地址
@@ -26,14 +44,16 @@ class http_conn;    //前向声明
 //    util_timer* timer;       //定时器
 //};
 
-//定时器类
-class util_timer
+//定时器类，每个连接一个，从内存池分配
+class util_timer : public pool_allocated<util_timer>
 {
 public:
-    util_timer():prev(NULL),next(NULL){}
+    util_timer():phase(PHASE_HEADER),start(0),prev(NULL),next(NULL){}
 
 public:
     time_t exprie;      //任务超时时间，这里使用绝对时间
+    int phase;          //TIMER_PHASE
+    time_t start;       //这个阶段开始计时的时间，负载升高时按它重新计算超时时间
 //    void (*cb_func)(http_conn*);  // 任务回调函数，回调函数处理的客户数据，由定时器的执行者传递给回调函数
     http_conn* user_data;
     util_timer* prev;    // 指向前一个定时器
@@ -43,21 +63,30 @@ public:
 // 定时器链表，它是一个升序、双向链表，且带有头节点和尾节点。
 class sort_timer_lst {
 public:
-    sort_timer_lst() : head( NULL ), tail( NULL ) {}
+    sort_timer_lst() : head( NULL ), tail( NULL ), m_scale( 1000 ), m_expired(), m_deferred( 0 ) {}
     // 链表被销毁时，删除其中所有的定时器
     ~sort_timer_lst();
 
     // 将目标定时器timer添加到链表中
     void add_timer( util_timer* timer );
-    /* 当某个定时任务发生变化时，调整对应的定时器在链表中的位置。这个函数只考虑被调整的定时器的
-    超时时间延长的情况，即该定时器需要往链表的尾部移动。*/
+    /* 当某个定时任务发生变化时，调整对应的定时器在链表中的位置。超时时间延长时往链表的尾部移动，
+    缩短时（负载升高）从头重新插入。*/
     void adjust_timer(util_timer* timer);
     // 将目标定时器 timer 从链表中删除
     void del_timer( util_timer* timer );
     /* SIGALARM 信号每次被触发就在其信号处理函数中执行一次 tick() 函数，以处理链表上到期任务。*/
     void tick();
 
+    long expired(int phase) const { return m_expired[phase]; }
+    // 到期时连接正在被工作线程处理、推迟到下一次 tick 的次数
+    long deferred() const { return m_deferred; }
+
 private:
+    // 从链表中取出，不删除
+    void unlink(util_timer* timer);
+    // 按当前的负载重新计算所有定时器的超时时间，只会缩短，然后重新排序
+    void rescale(int conns);
+
     /* 一个重载的辅助函数，它被公有的 add_timer 函数和 adjust_timer 函数调用
     该函数表示将目标定时器 timer 添加到节点 lst_head 之后的部分链表中 */
     void add_timer(util_timer* timer, util_timer* lst_head);
@@ -65,6 +94,9 @@ private:
 private:
     util_timer* head;   // 头结点
     util_timer* tail;   // 尾结点
+    int m_scale;        // 上次 tick 时的缩放比例
+    long m_expired[ PHASE_COUNT ];  // 各阶段超时关闭的连接数
+    long m_deferred;
 };
 
 #endif // LST_TIMER_H
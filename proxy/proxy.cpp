@@ -0,0 +1,653 @@
+#include "proxy.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "http_conn.h"
+
+//添加文件描述符到epoll中
+extern void addfd(int epollfd,int fd,bool one_shot,bool et);
+//修改文件描述符
+extern void modfd(int epollfd,int fd,int ev);
+
+// 后端连不上或者响应有误时返回给客户端的内容
+static const char* bad_gateway_form = "The upstream server did not respond properly.\n";
+
+// chunked 扫描状态：分块大小行、分块数据、分块数据后的\r\n、trailer
+enum { CHUNK_SIZE_LINE = 0, CHUNK_BODY, CHUNK_BODY_END, CHUNK_TRAILER };
+
+proxy_session::proxy_session(http_conn *conn, int client_fd, SSL *client_ssl, proxy_route *route, bool client_keep_alive, bool head_only)
+    : m_conn(conn), m_client_fd(client_fd), m_client_ssl(client_ssl), m_route(route), m_client_keep_alive(client_keep_alive),
+      m_aborted(false), m_head_only(head_only), m_state(PENDING), m_upstream_fd(-1), m_reused(false), m_upstream_reusable(false),
+      m_request_sent(0), m_head_len(0), m_out_sent(0), m_body_mode(BODY_LENGTH), m_body_left(0),
+      m_pipe_bytes(0), m_chunk_state(CHUNK_SIZE_LINE), m_chunk_left(0), m_chunk_line_empty(true), m_chunk_done(false),
+      m_status(0), m_client_bytes(0)
+{
+    m_pipe[0] = m_pipe[1] = -1;
+}
+
+proxy_session::~proxy_session()
+{
+    if( m_pipe[0] != -1 ) {
+        close( m_pipe[0] );
+        close( m_pipe[1] );
+    }
+}
+
+// 只识别分块边界，数据原样转发给客户端
+size_t proxy_session::scan_chunked(const char *p, size_t n)
+{
+    size_t i = 0;
+    while( i < n && !m_chunk_done ) {
+        switch( m_chunk_state ) {
+            case CHUNK_SIZE_LINE:
+            {
+                char c = p[i++];
+                if( c == '\n' ) {
+                    m_chunk_state = m_chunk_left > 0 ? CHUNK_BODY : CHUNK_TRAILER;
+                    m_chunk_line_empty = true;
+                } else if( m_chunk_line_empty && isxdigit( (unsigned char)c ) ) {
+                    m_chunk_left = m_chunk_left * 16 + ( isdigit( (unsigned char)c ) ? c - '0' : ( c | 0x20 ) - 'a' + 10 );
+                } else {
+                    m_chunk_line_empty = false;     // 分块扩展，忽略到行尾
+                }
+                break;
+            }
+            case CHUNK_BODY:
+            {
+                size_t k = n - i;
+                if( (long)k > m_chunk_left ) {
+                    k = m_chunk_left;
+                }
+                i += k;
+                m_chunk_left -= k;
+                if( m_chunk_left == 0 ) {
+                    m_chunk_state = CHUNK_BODY_END;
+                }
+                break;
+            }
+            case CHUNK_BODY_END:
+            {
+                if( p[i++] == '\n' ) {
+                    m_chunk_state = CHUNK_SIZE_LINE;
+                    m_chunk_line_empty = true;
+                }
+                break;
+            }
+            case CHUNK_TRAILER:
+            {
+                char c = p[i++];
+                if( c == '\n' ) {
+                    if( m_chunk_line_empty ) {
+                        m_chunk_done = true;        // 空行，响应体结束
+                    }
+                    m_chunk_line_empty = true;
+                } else if( c != '\r' ) {
+                    m_chunk_line_empty = false;
+                }
+                break;
+            }
+        }
+    }
+    return i;
+}
+
+proxy_pool::proxy_pool(int epollfd, int max_fd)
+    : m_epollfd(epollfd), m_max_fd(max_fd), m_max_idle(MAX_IDLE_PER_ROUTE), m_sessions(max_fd, (proxy_session*)NULL), m_idle_route(max_fd, (proxy_route*)NULL), m_pending_lock("proxy pending")
+{
+    m_wakefd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if( m_wakefd < 0 ) {
+        throw std::exception();
+    }
+    addfd( m_epollfd, m_wakefd, false, false );
+}
+
+proxy_pool::~proxy_pool()
+{
+    for( size_t i = 0; i < m_routes.size(); ++i ) {
+        for( size_t j = 0; j < m_routes[i]->idle.size(); ++j ) {
+            close( m_routes[i]->idle[j] );
+        }
+        delete m_routes[i];
+    }
+    close( m_wakefd );
+}
+
+bool proxy_pool::add_route(const char *spec)
+{
+    // /api=127.0.0.1:8080
+    const char* eq = strchr( spec, '=' );
+    const char* colon = eq ? strrchr( eq, ':' ) : NULL;
+    if( !eq || !colon || spec[0] != '/' ) {
+        return false;
+    }
+    std::string ip( eq + 1, colon - eq - 1 );
+    proxy_route* r = new proxy_route;
+    r->prefix.assign( spec, eq - spec );
+    memset( &r->addr, 0, sizeof(r->addr) );
+    r->addr.sin_family = AF_INET;
+    r->addr.sin_port = htons( atoi( colon + 1 ) );
+    if( inet_pton( AF_INET, ip.c_str(), &r->addr.sin_addr ) != 1 ) {
+        delete r;
+        return false;
+    }
+    m_routes.push_back( r );
+    EMlog(LOGLEVEL_INFO, "proxy route %s -> %s:%d\n", r->prefix.c_str(), ip.c_str(), ntohs(r->addr.sin_port));
+    return true;
+}
+
+proxy_route *proxy_pool::match(const char *path, size_t len)
+{
+    // 最长前缀匹配。前缀之后必须是路径结尾或者 '/'（前缀本身以 '/' 结尾也行），
+    // 这样 /api 匹配 /api、/api/x，不匹配 /apix
+    proxy_route* best = NULL;
+    for( size_t i = 0; i < m_routes.size(); ++i ) {
+        proxy_route* r = m_routes[i];
+        size_t n = r->prefix.size();
+        if( len < n || strncmp( path, r->prefix.c_str(), n ) != 0 ) {
+            continue;
+        }
+        if( len > n && path[ n ] != '/' && r->prefix[ n - 1 ] != '/' ) {
+            continue;
+        }
+        if( !best || n > best->prefix.size() ) {
+            best = r;
+        }
+    }
+    return best;
+}
+
+void proxy_pool::submit(proxy_session *s)
+{
+    m_pending_lock.lock();
+    m_pending.push_back( s );
+    m_pending_lock.unlock();
+
+    uint64_t one = 1;
+    if( write( m_wakefd, &one, sizeof(one) ) < 0 ) {
+        EMlog(LOGLEVEL_WARN, "proxy wakeup failed: %s\n", strerror(errno));
+    }
+}
+
+void proxy_pool::on_wakeup()
+{
+    uint64_t cnt;
+    if( read( m_wakefd, &cnt, sizeof(cnt) ) < 0 && errno != EAGAIN ) {
+        EMlog(LOGLEVEL_WARN, "proxy wakeup read failed: %s\n", strerror(errno));
+    }
+
+    std::list<proxy_session*> pending;
+    m_pending_lock.lock();
+    pending.swap( m_pending );
+    m_pending_lock.unlock();
+
+    for( std::list<proxy_session*>::iterator it = pending.begin(); it != pending.end(); ++it ) {
+        proxy_session* s = *it;
+        if( s->m_aborted ) {        // 排队期间客户端已经关闭
+            delete s;
+            continue;
+        }
+        start( s );
+    }
+}
+
+void proxy_pool::start(proxy_session *s)
+{
+    if( !acquire( s, true ) ) {
+        fail( s );
+    }
+}
+
+bool proxy_pool::acquire(proxy_session *s, bool allow_reuse)
+{
+    proxy_route* r = s->m_route;
+    if( allow_reuse && !r->idle.empty() ) {
+        // 复用连接池中的长连接，它已经在 epoll 中了
+        int fd = r->idle.back();
+        r->idle.pop_back();
+        m_idle_route[fd] = NULL;
+        m_sessions[fd] = s;
+        s->m_upstream_fd = fd;
+        s->m_reused = true;
+        s->m_state = proxy_session::SENDING;
+        watch_upstream( s, EPOLLOUT );
+        return true;
+    }
+
+    int fd = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if( fd < 0 ) {
+        return false;
+    }
+    if( fd >= m_max_fd ) {
+        close( fd );
+        return false;
+    }
+    int on = 1;
+    setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+
+    // 非阻塞 connect，连接结果由 EPOLLOUT 通知
+    if( connect( fd, (struct sockaddr*)&r->addr, sizeof(r->addr) ) < 0 && errno != EINPROGRESS ) {
+        close( fd );
+        return false;
+    }
+    m_sessions[fd] = s;
+    s->m_upstream_fd = fd;
+    s->m_reused = false;
+    s->m_state = proxy_session::CONNECTING;
+
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = EPOLLOUT | EPOLLRDHUP | EPOLLONESHOT;
+    epoll_ctl( m_epollfd, EPOLL_CTL_ADD, fd, &event );
+    return true;
+}
+
+void proxy_pool::release_upstream(proxy_session *s, bool reuse)
+{
+    int fd = s->m_upstream_fd;
+    if( fd == -1 ) {
+        return;
+    }
+    m_sessions[fd] = NULL;
+    s->m_upstream_fd = -1;
+
+    proxy_route* r = s->m_route;
+    if( reuse && (int)r->idle.size() < m_max_idle ) {
+        // 放回连接池。空闲期间出现任何事件（后端关闭连接）都说明它不能再用了
+        r->idle.push_back( fd );
+        m_idle_route[fd] = r;
+        modfd( m_epollfd, fd, EPOLLIN );
+    } else {
+        epoll_ctl( m_epollfd, EPOLL_CTL_DEL, fd, 0 );
+        close( fd );
+    }
+}
+
+void proxy_pool::handle_event(int fd)
+{
+    proxy_route* r = m_idle_route[fd];
+    if( r ) {
+        // 空闲连接上有事件：后端关闭了连接或者发来了多余的数据，关闭它
+        for( size_t i = 0; i < r->idle.size(); ++i ) {
+            if( r->idle[i] == fd ) {
+                r->idle[i] = r->idle.back();
+                r->idle.pop_back();
+                break;
+            }
+        }
+        m_idle_route[fd] = NULL;
+        epoll_ctl( m_epollfd, EPOLL_CTL_DEL, fd, 0 );
+        close( fd );
+        return;
+    }
+
+    proxy_session* s = m_sessions[fd];
+    if( !s ) {
+        return;
+    }
+    s->m_conn->refresh_timer();
+
+    switch( s->m_state ) {
+        case proxy_session::CONNECTING:
+        {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if( getsockopt( fd, SOL_SOCKET, SO_ERROR, &err, &len ) < 0 || err != 0 ) {
+                EMlog(LOGLEVEL_WARN, "proxy connect to %s failed: %s\n", s->m_route->prefix.c_str(), strerror(err));
+                fail( s );
+                return;
+            }
+            s->m_state = proxy_session::SENDING;
+            do_send( s );
+            break;
+        }
+        case proxy_session::SENDING:
+            do_send( s );
+            break;
+        case proxy_session::READING_HEAD:
+            do_read_head( s );
+            break;
+        case proxy_session::RELAYING:
+            do_relay( s );
+            break;
+        default:
+            break;
+    }
+}
+
+void proxy_pool::on_client_writable(proxy_session *s)
+{
+    if( s->m_state == proxy_session::RELAYING ) {
+        do_relay( s );
+    }
+}
+
+void proxy_pool::abort(proxy_session *s)
+{
+    if( s->m_state == proxy_session::PENDING ) {
+        s->m_aborted = true;        // 还在等待队列中，由 on_wakeup 释放
+        return;
+    }
+    release_upstream( s, false );
+    delete s;
+}
+
+void proxy_pool::do_send(proxy_session *s)
+{
+    while( s->m_request_sent < s->m_request.size() ) {
+        ssize_t n = send( s->m_upstream_fd, s->m_request.data() + s->m_request_sent,
+                          s->m_request.size() - s->m_request_sent, MSG_NOSIGNAL );
+        if( n < 0 ) {
+            if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                watch_upstream( s, EPOLLOUT );
+                return;
+            }
+            if( !retry( s ) ) {
+                fail( s );
+            }
+            return;
+        }
+        s->m_request_sent += n;
+    }
+    s->m_state = proxy_session::READING_HEAD;
+    s->m_head_len = 0;
+    watch_upstream( s, EPOLLIN );
+}
+
+void proxy_pool::do_read_head(proxy_session *s)
+{
+    while( true ) {
+        if( s->m_head_len == proxy_session::HEAD_BUF_SIZE ) {
+            fail( s );              // 响应头太长
+            return;
+        }
+        ssize_t n = recv( s->m_upstream_fd, s->m_head + s->m_head_len, proxy_session::HEAD_BUF_SIZE - s->m_head_len, 0 );
+        if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+            watch_upstream( s, EPOLLIN );
+            return;
+        }
+        if( n <= 0 ) {
+            // 复用的长连接可能已经被后端关闭，一个字节都没收到就换新连接重试
+            if( s->m_head_len != 0 || !retry( s ) ) {
+                fail( s );
+            }
+            return;
+        }
+
+        int from = s->m_head_len > 3 ? s->m_head_len - 3 : 0;
+        s->m_head_len += n;
+        char* end = (char*)memmem( s->m_head + from, s->m_head_len - from, "\r\n\r\n", 4 );
+        if( end ) {
+            if( !parse_head( s, end + 4 - s->m_head ) ) {
+                fail( s );
+                return;
+            }
+            s->m_state = proxy_session::RELAYING;
+            do_relay( s );
+            return;
+        }
+    }
+}
+
+// 解析后端响应头，确定响应体长度，并改写 Connection 头部后放入 m_out
+bool proxy_pool::parse_head(proxy_session *s, int head_end)
+{
+    char* head = s->m_head;
+    // HTTP/1.1 200 OK
+    if( strncmp( head, "HTTP/1.", 7 ) != 0 || head_end < 12 ) {
+        return false;
+    }
+    int status = atoi( head + 9 );
+    s->m_status = status;
+    bool upstream_close = ( head[7] == '0' );   // HTTP/1.0 默认不保持连接
+    long length = -1;
+    bool chunked = false;
+
+    std::string& out = s->m_out;
+    out.clear();
+    s->m_out_sent = 0;
+
+    char* p = (char*)memmem( head, head_end, "\r\n", 2 ) + 2;
+    out.append( head, p - head );               // 状态行
+    while( p < head + head_end - 2 ) {
+        char* e = (char*)memmem( p, head + head_end - p, "\r\n", 2 );
+        int len = e - p;
+        if( strncasecmp( p, "Content-Length:", 15 ) == 0 ) {
+            length = atol( p + 15 );
+        } else if( strncasecmp( p, "Transfer-Encoding:", 18 ) == 0 ) {
+            chunked = memmem( p, len, "chunked", 7 ) != NULL;
+        } else if( strncasecmp( p, "Connection:", 11 ) == 0 ) {
+            upstream_close = upstream_close || memmem( p, len, "close", 5 ) != NULL;
+            p = e + 2;
+            continue;                           // 连接管理的头部不转发，由我们自己决定
+        } else if( strncasecmp( p, "Keep-Alive:", 11 ) == 0 ) {
+            p = e + 2;
+            continue;
+        }
+        out.append( p, len + 2 );
+        p = e + 2;
+    }
+
+    if( s->m_head_only || ( status >= 100 && status < 200 ) || status == 204 || status == 304 ) {
+        s->m_body_mode = proxy_session::BODY_LENGTH;
+        length = 0;
+    } else if( chunked ) {
+        s->m_body_mode = proxy_session::BODY_CHUNKED;
+    } else if( length >= 0 ) {
+        s->m_body_mode = proxy_session::BODY_LENGTH;
+    } else {
+        // 没有长度信息，以后端关闭连接为结束，客户端也只能关闭连接
+        s->m_body_mode = proxy_session::BODY_UNTIL_CLOSE;
+        upstream_close = true;
+        s->m_client_keep_alive = false;
+    }
+    s->m_upstream_reusable = !upstream_close;
+    out.append( s->m_client_keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n" );
+
+    // 和响应头一起读到的响应体
+    const char* rest = head + head_end;
+    long rest_len = s->m_head_len - head_end;
+    if( s->m_body_mode == proxy_session::BODY_LENGTH ) {
+        long take = rest_len < length ? rest_len : length;
+        out.append( rest, take );
+        s->m_body_left = length - take;
+        if( take < rest_len ) {
+            s->m_upstream_reusable = false;     // 后端多发了数据
+        }
+    } else if( s->m_body_mode == proxy_session::BODY_CHUNKED ) {
+        size_t used = s->scan_chunked( rest, rest_len );
+        out.append( rest, used );
+        if( (long)used < rest_len ) {
+            s->m_upstream_reusable = false;
+        }
+    } else {
+        out.append( rest, rest_len );
+    }
+    return true;
+}
+
+ssize_t proxy_pool::client_send(proxy_session *s, const char *buf, size_t len)
+{
+    ssize_t n = s->m_client_ssl ? tls_send( s->m_client_ssl, buf, len )
+                                : send( s->m_client_fd, buf, len, MSG_NOSIGNAL );
+    if( n > 0 ) {
+        s->m_client_bytes += n;
+    }
+    return n;
+}
+
+bool proxy_pool::flush_out(proxy_session *s, bool &error)
+{
+    error = false;
+    while( s->m_out_sent < s->m_out.size() ) {
+        ssize_t n = client_send( s, s->m_out.data() + s->m_out_sent, s->m_out.size() - s->m_out_sent );
+        if( n < 0 ) {
+            error = !( errno == EAGAIN || errno == EWOULDBLOCK );
+            return false;
+        }
+        s->m_out_sent += n;
+    }
+    s->m_out.clear();
+    s->m_out_sent = 0;
+    return true;
+}
+
+void proxy_pool::do_relay(proxy_session *s)
+{
+    bool error = false;
+    while( true ) {
+        // 先把缓冲的响应头和数据发给客户端
+        if( !flush_out( s, error ) ) {
+            if( error ) {
+                finish( s, false );
+            } else {
+                watch_client( s );
+            }
+            return;
+        }
+
+        if( s->m_body_mode == proxy_session::BODY_CHUNKED || s->m_client_ssl ) {
+            // chunked 响应需要扫描分块边界才知道结尾，TLS 客户端需要 OpenSSL 加密，都经过用户态转发
+            if( s->m_body_mode == proxy_session::BODY_CHUNKED ? s->m_chunk_done
+                : ( s->m_body_mode == proxy_session::BODY_LENGTH && s->m_body_left == 0 ) ) {
+                finish( s, true );
+                return;
+            }
+            char buf[ proxy_session::RELAY_BUF_SIZE ];
+            size_t want = sizeof(buf);
+            if( s->m_body_mode == proxy_session::BODY_LENGTH && s->m_body_left < (long)want ) {
+                want = s->m_body_left;
+            }
+            ssize_t n = recv( s->m_upstream_fd, buf, want, 0 );
+            if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+                watch_upstream( s, EPOLLIN );
+                return;
+            }
+            if( n <= 0 ) {
+                finish( s, n == 0 && s->m_body_mode == proxy_session::BODY_UNTIL_CLOSE );
+                return;
+            }
+            size_t used = n;
+            if( s->m_body_mode == proxy_session::BODY_CHUNKED ) {
+                used = s->scan_chunked( buf, n );
+                if( (ssize_t)used < n ) {
+                    s->m_upstream_reusable = false;
+                }
+            } else if( s->m_body_mode == proxy_session::BODY_LENGTH ) {
+                s->m_body_left -= n;
+            }
+            s->m_out.append( buf, used );
+            continue;
+        }
+
+        // 管道中的数据发给客户端
+        if( s->m_pipe_bytes > 0 ) {
+            ssize_t n = splice( s->m_pipe[0], NULL, s->m_client_fd, NULL, s->m_pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+            if( n < 0 ) {
+                if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                    watch_client( s );
+                } else {
+                    finish( s, false );
+                }
+                return;
+            }
+            s->m_pipe_bytes -= n;
+            s->m_client_bytes += n;
+            continue;
+        }
+
+        if( s->m_body_mode == proxy_session::BODY_LENGTH && s->m_body_left == 0 ) {
+            finish( s, true );
+            return;
+        }
+
+        // 后端数据 splice 到管道，不经过用户态
+        if( s->m_pipe[0] == -1 && pipe2( s->m_pipe, O_NONBLOCK | O_CLOEXEC ) < 0 ) {
+            s->m_pipe[0] = s->m_pipe[1] = -1;
+            finish( s, false );
+            return;
+        }
+        long want = 64 * 1024;
+        if( s->m_body_mode == proxy_session::BODY_LENGTH && s->m_body_left < want ) {
+            want = s->m_body_left;
+        }
+        ssize_t n = splice( s->m_upstream_fd, NULL, s->m_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+        if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+            watch_upstream( s, EPOLLIN );
+            return;
+        }
+        if( n <= 0 ) {
+            // 没有长度信息的响应以后端关闭为结束，其余情况是后端中途断开
+            finish( s, n == 0 && s->m_body_mode == proxy_session::BODY_UNTIL_CLOSE );
+            return;
+        }
+        s->m_pipe_bytes += n;
+        if( s->m_body_mode == proxy_session::BODY_LENGTH ) {
+            s->m_body_left -= n;
+        }
+    }
+}
+
+// 请求重复执行也没有副作用的方法
+static bool idempotent_request(const std::string& request)
+{
+    return request.compare( 0, 4, "GET " ) == 0 || request.compare( 0, 5, "HEAD " ) == 0
+           || request.compare( 0, 8, "OPTIONS " ) == 0;
+}
+
+bool proxy_pool::retry(proxy_session *s)
+{
+    // 请求已经有一部分发给了后端时，后端可能已经执行过了，非幂等的请求（POST、PUT 等）不能再发一次
+    if( !s->m_reused || ( s->m_request_sent != 0 && !idempotent_request( s->m_request ) ) ) {
+        return false;
+    }
+    release_upstream( s, false );
+    s->m_request_sent = 0;
+    s->m_head_len = 0;
+    return acquire( s, false );
+}
+
+void proxy_pool::fail(proxy_session *s)
+{
+    // 还没有给客户端发送任何内容，回复 502
+    s->m_status = 502;
+    char resp[256];
+    int len = snprintf( resp, sizeof(resp),
+                        "HTTP/1.1 502 Bad Gateway\r\nContent-Length: %d\r\nContent-Type:text/html\r\nConnection: close\r\n\r\n%s",
+                        (int)strlen( bad_gateway_form ), bad_gateway_form );
+    if( client_send( s, resp, len ) < 0 ) {
+        EMlog(LOGLEVEL_WARN, "proxy send 502 to fd %d failed: %s\n", s->m_client_fd, strerror(errno));
+    }
+    finish( s, false );
+}
+
+void proxy_pool::finish(proxy_session *s, bool ok)
+{
+    // 响应完整转发，后端连接才能放回连接池
+    release_upstream( s, ok && s->m_upstream_reusable );
+    http_conn* conn = s->m_conn;
+    bool keep_alive = ok && s->m_client_keep_alive;
+    int status = s->m_status;
+    long bytes = s->m_client_bytes;
+    delete s;
+    conn->proxy_done( keep_alive, status, bytes );
+}
+
+void proxy_pool::watch_upstream(proxy_session *s, unsigned events)
+{
+    modfd( m_epollfd, s->m_upstream_fd, events );
+}
+
+void proxy_pool::watch_client(proxy_session *s)
+{
+    modfd( m_epollfd, s->m_client_fd, EPOLLOUT );
+}
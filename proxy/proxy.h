@@ -0,0 +1,165 @@
+/*
+    反向代理
+    URL 前缀匹配的请求转发给配置的后端，后端连接保持长连接放在连接池中复用。
+    连接后端、收发数据都在主线程的 epoll 循环中非阻塞完成，响应体用 splice 从后端 socket 搬到客户端 socket。
+*/
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <netinet/in.h>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "locker.h"
+#include "tls/tls_context.h"
+#include "memorypool/mem_pool.h"
+
+class http_conn;
+class proxy_pool;
+
+// 一条转发规则：URL 前缀 -> 后端地址，以及到该后端的空闲长连接
+struct proxy_route
+{
+    std::string prefix;
+    sockaddr_in addr;
+    std::vector<int> idle;      // 空闲的后端连接
+};
+
+// 一个正在转发的请求
+class proxy_session : public pool_allocated<proxy_session>
+{
+    friend class proxy_pool;
+public:
+    // 转发的各个阶段
+    enum STATE { PENDING = 0, CONNECTING, SENDING, READING_HEAD, RELAYING };
+    // 响应体的长度确定方式
+    enum BODY_MODE { BODY_LENGTH = 0, BODY_CHUNKED, BODY_UNTIL_CLOSE };
+
+    // client_ssl 为客户端需要经过 OpenSSL 加密发送时的 SSL 对象，明文或者 kTLS 时为NULL
+    proxy_session(http_conn* conn, int client_fd, SSL* client_ssl, proxy_route* route, bool client_keep_alive, bool head_only);
+    ~proxy_session();
+
+    // 发给后端的请求，由工作线程在提交前填好
+    std::string& request() { return m_request; }
+
+private:
+    // 扫描 chunked 响应体，返回本次消费的字节数，扫描到结尾后 m_chunk_done 置位
+    size_t scan_chunked(const char* p, size_t n);
+
+private:
+    static const int HEAD_BUF_SIZE = 8192;      // 后端响应头的最大长度
+    static const int RELAY_BUF_SIZE = 16384;    // chunked 转发时的缓冲区
+
+    http_conn* m_conn;          // 发起请求的客户端连接
+    int m_client_fd;
+    SSL* m_client_ssl;          // 不为NULL时响应体不能splice，经过用户态加密发送
+    proxy_route* m_route;
+    bool m_client_keep_alive;   // 客户端是否要保持连接
+    bool m_aborted;             // 还在等待队列中时客户端连接被关闭
+    bool m_head_only;           // HEAD 请求，响应没有响应体
+
+    STATE m_state;
+    int m_upstream_fd;
+    bool m_reused;              // 后端连接是否来自连接池，失败时可以换新连接重试一次
+    bool m_upstream_reusable;   // 响应结束后后端连接能否放回连接池
+
+    std::string m_request;      // 发给后端的请求
+    size_t m_request_sent;
+
+    char m_head[HEAD_BUF_SIZE]; // 后端响应头
+    int m_head_len;
+
+    std::string m_out;          // 待发给客户端的数据：改写后的响应头、chunked 转发的数据
+    size_t m_out_sent;
+
+    BODY_MODE m_body_mode;
+    long m_body_left;           // BODY_LENGTH 时后端还没读出的字节数
+    int m_pipe[2];              // splice 中转管道
+    long m_pipe_bytes;          // 管道中还没发给客户端的字节数
+
+    // chunked 扫描状态
+    int m_chunk_state;
+    long m_chunk_left;
+    bool m_chunk_line_empty;
+    bool m_chunk_done;
+
+    // 访问日志
+    int m_status;               // 后端响应的状态码，返回 502 时为 502
+    long m_client_bytes;        // 已经发给客户端的字节数
+};
+
+// 每个 reactor 一个，管理转发规则、后端连接池和所有转发中的请求。
+// 除 submit 外都只在 reactor 线程（主线程）中调用，不需要加锁
+class proxy_pool
+{
+public:
+    proxy_pool(int epollfd, int max_fd);
+    ~proxy_pool();
+
+    // 添加转发规则，spec 格式：/api=127.0.0.1:8080
+    bool add_route(const char* spec);
+    // 查找规范化之后的路径（不含查询串）对应的转发规则，前缀只在段边界匹配，没有返回NULL
+    proxy_route* match(const char* path, size_t len);
+    bool empty() const { return m_routes.empty(); }
+
+    // 工作线程提交一个转发请求，唤醒 reactor 处理
+    void submit(proxy_session* s);
+    // reactor 被唤醒，开始处理提交的请求
+    void on_wakeup();
+    int wakeup_fd() const { return m_wakefd; }
+
+    // fd 是否是后端连接
+    bool owns(int fd) const { return fd >= 0 && fd < m_max_fd && ( m_sessions[fd] || m_idle_route[fd] ); }
+    // 后端连接上的 epoll 事件
+    void handle_event(int fd);
+    // 客户端连接可写
+    void on_client_writable(proxy_session* s);
+    // 客户端连接被关闭（超时或者对方断开），放弃转发
+    void abort(proxy_session* s);
+
+    // 每个后端最多保留的空闲连接数，调小后多出的空闲连接不主动关闭，用完后不再放回
+    static const int MAX_IDLE_PER_ROUTE = 32;
+    void set_max_idle(int n) { m_max_idle = n; }
+
+private:
+    void start(proxy_session* s);
+    // 取一个到后端的连接：优先用连接池中的，没有就发起非阻塞 connect
+    bool acquire(proxy_session* s, bool allow_reuse);
+    // 响应结束，后端连接放回连接池或者关闭
+    void release_upstream(proxy_session* s, bool reuse);
+
+    void do_send(proxy_session* s);
+    void do_read_head(proxy_session* s);
+    bool parse_head(proxy_session* s, int head_end);
+    void do_relay(proxy_session* s);
+    // 发给客户端，TLS 连接经过 OpenSSL 加密
+    ssize_t client_send(proxy_session* s, const char* buf, size_t len);
+    // 发送 m_out 中的数据，全部发完返回true，客户端暂时不可写返回false
+    bool flush_out(proxy_session* s, bool& error);
+
+    // 后端出错：还没给客户端发送任何数据时返回 502
+    void fail(proxy_session* s);
+    // 转发结束，通知客户端连接并释放会话
+    void finish(proxy_session* s, bool ok);
+    // 复用的连接失效，换一个新连接重试
+    bool retry(proxy_session* s);
+
+    void watch_upstream(proxy_session* s, unsigned events);
+    void watch_client(proxy_session* s);
+
+private:
+    int m_epollfd;
+    int m_max_fd;
+    int m_wakefd;                           // eventfd，工作线程提交请求后唤醒 reactor
+    int m_max_idle;                         // 每个后端最多保留的空闲连接数
+    std::vector<proxy_route*> m_routes;
+    std::vector<proxy_session*> m_sessions; // 后端 fd -> 正在使用它的会话
+    std::vector<proxy_route*> m_idle_route; // 空闲后端 fd -> 所属规则
+
+    std::list<proxy_session*> m_pending;    // 工作线程提交、还没开始的请求
+    locker m_pending_lock;
+};
+
+#endif // PROXY_H
@@ -0,0 +1,5 @@
+HEADERS += \
+    $$PWD/proxy.h
+
+SOURCES += \
+    $$PWD/proxy.cpp
@@ -0,0 +1,124 @@
+#include "rate_limiter.h"
+
+#include <arpa/inet.h>
+#include <time.h>
+
+static const int WAYS = 4;          // 每组的项数，16 字节一项，一组一个缓存行
+static const uint64_t TOKEN = 1000; // 一个令牌
+
+// 单调时钟，毫秒，只用低 32 位的差值
+static uint32_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC_COARSE, &ts );
+    return (uint32_t)( (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 );
+}
+
+rate_limiter::rate_limiter(int entries)
+    : m_limited(0), m_evicted(0)
+{
+    size_t n = 1024;
+    while( n < (size_t)entries && n < ( 1u << 24 ) ) {
+        n <<= 1;
+    }
+    m_slots = std::vector<slot>( n );
+    m_mask = n / WAYS - 1;
+    for( int i = 0; i < KIND_COUNT; ++i ) {
+        m_rate[i] = 0;
+        m_burst[i] = 0;
+    }
+}
+
+void rate_limiter::set_limit(int kind, int rate, int burst)
+{
+    m_rate[ kind ].store( rate, std::memory_order_relaxed );
+    m_burst[ kind ].store( burst > 0 ? burst : 1, std::memory_order_relaxed );
+}
+
+bool rate_limiter::allow(uint32_t addr)
+{
+    uint32_t ip = ntohl( addr );
+    uint32_t now = now_ms();
+    // 网段的桶只在这个 IP 自己有令牌时才扣
+    if( !take( KIND_IP, ip, now ) || !take( KIND_NET, ip & 0xffffff00u, now ) ) {
+        m_limited.fetch_add( 1, std::memory_order_relaxed );
+        return false;
+    }
+    return true;
+}
+
+bool rate_limiter::take(int kind, uint32_t key, uint32_t now)
+{
+    uint64_t rate = m_rate[ kind ].load( std::memory_order_relaxed );
+    if( rate == 0 ) {
+        return true;
+    }
+    uint64_t full = (uint64_t)m_burst[ kind ].load( std::memory_order_relaxed ) * TOKEN;
+    if( full > 0xffffffffull ) {
+        full = 0xffffffffull;
+    }
+    slot* s = find( (uint64_t)( kind + 1 ) << 32 | key, now, full );
+    if( !s ) {
+        return true;        // 组内一直在被别的线程改写，不限制这一次
+    }
+
+    // 按经过的时间补充令牌（每秒 rate 个，即每毫秒 rate 个千分之一），再取一个
+    uint64_t st = s->state.load( std::memory_order_relaxed );
+    for( ;; ) {
+        uint64_t tokens = (uint32_t)st + (uint64_t)(uint32_t)( now - (uint32_t)( st >> 32 ) ) * rate;
+        if( tokens > full ) {
+            tokens = full;
+        }
+        bool ok = tokens >= TOKEN;
+        if( ok ) {
+            tokens -= TOKEN;
+        }
+        if( s->state.compare_exchange_weak( st, (uint64_t)now << 32 | tokens, std::memory_order_relaxed ) ) {
+            return ok;
+        }
+    }
+}
+
+rate_limiter::slot *rate_limiter::find(uint64_t key, uint32_t now, uint64_t full)
+{
+    slot* group = &m_slots[ ( ( ( key * 0x9E3779B97F4A7C15ull ) >> 32 ) & m_mask ) * WAYS ];
+    for( int attempt = 0; attempt < 4; ++attempt ) {
+        for( int i = 0; i < WAYS; ++i ) {
+            if( group[i].key.load( std::memory_order_acquire ) == key ) {
+                return &group[i];
+            }
+        }
+
+        // 没有这个地址：优先用空的项，其次是已经补满的项，都没有就挤掉最久没用的
+        slot* victim = NULL;
+        uint32_t oldest = 0;
+        bool reusable = false;
+        uint64_t victim_key = 0;
+        for( int i = 0; i < WAYS && !reusable; ++i ) {
+            uint64_t k = group[i].key.load( std::memory_order_relaxed );
+            uint64_t st = group[i].state.load( std::memory_order_relaxed );
+            uint32_t idle = now - (uint32_t)( st >> 32 );
+            if( k == 0 ) {
+                reusable = true;
+            } else {
+                int kind = (int)( k >> 32 ) - 1;
+                uint64_t rate = m_rate[ kind ].load( std::memory_order_relaxed );
+                uint64_t cap = (uint64_t)m_burst[ kind ].load( std::memory_order_relaxed ) * TOKEN;
+                reusable = rate == 0 || (uint32_t)st + (uint64_t)idle * rate >= cap;
+            }
+            if( reusable || !victim || idle > oldest ) {
+                victim = &group[i];
+                victim_key = k;
+                oldest = idle;
+            }
+        }
+        if( victim->key.compare_exchange_strong( victim_key, key, std::memory_order_acq_rel ) ) {
+            victim->state.store( (uint64_t)now << 32 | full, std::memory_order_release );
+            if( !reusable ) {
+                m_evicted.fetch_add( 1, std::memory_order_relaxed );
+            }
+            return victim;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,56 @@
+/*
+    按客户端地址限速
+    每个 IP 一个令牌桶，同一个 /24 网段再共用一个令牌桶，新连接和每个请求各取一个令牌，任一个桶空了就返回 429。
+    桶放在按地址哈希的表中，每 4 项一组（一个缓存行），只在组内查找，不加锁：
+        每一项是 键 + 状态 两个 64 位整数，状态是 上次更新的时间（毫秒）| 剩余的令牌（千分之一个），用 CAS 一次更新；
+        组内没有这个地址时占用空的项，或者已经补满的项（补满的桶和新建的一样，复用不丢信息），
+        都不行就挤掉最久没用的一项。
+    表的大小固定，不需要单独的清理。
+*/
+
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+class rate_limiter
+{
+public:
+    enum KIND { KIND_IP = 0, KIND_NET, KIND_COUNT };
+
+    // entries 向上取整到2的幂
+    explicit rate_limiter(int entries);
+
+    // 每秒补充的令牌数和桶的容量，rate 为0表示不限制这一类
+    void set_limit(int kind, int rate, int burst);
+    // 地址（网络字节序）来了一个新连接或者请求，两个桶都有令牌时返回true
+    bool allow(uint32_t addr);
+
+    long limited() const { return m_limited.load( std::memory_order_relaxed ); }
+    long evicted() const { return m_evicted.load( std::memory_order_relaxed ); }
+    bool enabled() const { return m_rate[ KIND_IP ].load( std::memory_order_relaxed ) > 0
+                               || m_rate[ KIND_NET ].load( std::memory_order_relaxed ) > 0; }
+
+private:
+    struct slot
+    {
+        std::atomic<uint64_t> key;      // 0 表示空
+        std::atomic<uint64_t> state;    // 时间（毫秒，低 32 位）<< 32 | 令牌（千分之一）
+    };
+
+    // 从 kind 类的桶中取一个令牌
+    bool take(int kind, uint32_t key, uint32_t now);
+    slot* find(uint64_t key, uint32_t now, uint64_t full);
+
+private:
+    std::vector<slot> m_slots;
+    uint64_t m_mask;                    // 组数 - 1
+    std::atomic<int> m_rate[ KIND_COUNT ];
+    std::atomic<int> m_burst[ KIND_COUNT ];
+    std::atomic<long> m_limited;
+    std::atomic<long> m_evicted;
+};
+
+#endif // RATE_LIMITER_H
@@ -0,0 +1,5 @@
+HEADERS += \
+    $$PWD/rate_limiter.h
+
+SOURCES += \
+    $$PWD/rate_limiter.cpp
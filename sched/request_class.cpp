@@ -0,0 +1,85 @@
+#include "request_class.h"
+
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "admin/server_config.h"
+
+// 每一项是 哈希的高 40 位 | 大小（KB，最多 24 位），一个 64 位整数，读写不会撕裂
+static const int SIZE_HINT_BITS = 14;
+static const uint64_t SIZE_MASK = ( 1ull << 24 ) - 1;
+static std::atomic<uint64_t> s_size_hints[ 1 << SIZE_HINT_BITS ];
+
+static std::vector<std::string> s_bulk_prefixes;
+
+const char *request_class_name(int cls)
+{
+    static const char* names[] = { "small", "normal", "bulk" };
+    return cls >= 0 && cls < CLASS_COUNT ? names[cls] : "?";
+}
+
+int class_of_size(uint64_t size)
+{
+    if( size <= (uint64_t)g_config.small_kb * 1024 ) {
+        return CLASS_SMALL;
+    }
+    return size >= (uint64_t)g_config.bulk_kb * 1024 ? CLASS_BULK : CLASS_NORMAL;
+}
+
+// FNV-1a
+static uint64_t path_hash(const char* s, int len)
+{
+    uint64_t h = 14695981039346656037ull;
+    for( int i = 0; i < len; ++i ) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+void size_hint_record(const char *path, int len, uint64_t size)
+{
+    uint64_t h = path_hash( path, len );
+    uint64_t kb = ( size + 1023 ) >> 10;
+    uint64_t v = ( h & ~SIZE_MASK ) | ( kb < SIZE_MASK ? kb : SIZE_MASK );
+    s_size_hints[ h & ( ( 1 << SIZE_HINT_BITS ) - 1 ) ].store( v, std::memory_order_relaxed );
+}
+
+bool size_hint_lookup(const char *path, int len, uint64_t &size)
+{
+    uint64_t h = path_hash( path, len );
+    uint64_t v = s_size_hints[ h & ( ( 1 << SIZE_HINT_BITS ) - 1 ) ].load( std::memory_order_relaxed );
+    if( v == 0 || ( v & ~SIZE_MASK ) != ( h & ~SIZE_MASK ) ) {
+        return false;
+    }
+    size = ( v & SIZE_MASK ) << 10;
+    return true;
+}
+
+void bulk_prefix_add(const char *prefixes)
+{
+    const char* p = prefixes;
+    while( *p ) {
+        size_t n = strcspn( p, "," );
+        if( n > 0 ) {
+            s_bulk_prefixes.push_back( std::string( p, n ) );
+        }
+        p += n;
+        if( *p == ',' ) {
+            ++p;
+        }
+    }
+}
+
+bool bulk_prefix_match(const char *path, int len)
+{
+    for( size_t i = 0; i < s_bulk_prefixes.size(); ++i ) {
+        const std::string& prefix = s_bulk_prefixes[i];
+        if( (size_t)len >= prefix.size() && memcmp( path, prefix.data(), prefix.size() ) == 0 ) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,35 @@
+/*
+    请求的优先级分类
+    线程池按类别分队列，按权重轮流取任务，大请求多的时候小请求也能按自己的份额被处理，不会整个排在大请求后面。
+    分类在主线程入队时完成，只看已经读到的请求行，不访问文件系统：
+        资源包中的文件直接知道大小；
+        磁盘上的文件用工作线程 stat 之后记下的大小（按路径哈希的直接映射表，冲突时覆盖）；
+        匹配 bulk_prefix 的路径算作大请求；
+        连接上一个响应很大的，后续的请求也算作大请求；
+        正在接收请求体（上传）的算作大请求。
+    都判断不出来的算作普通请求。
+*/
+
+#ifndef REQUEST_CLASS_H
+#define REQUEST_CLASS_H
+
+#include <stdint.h>
+
+enum REQUEST_CLASS { CLASS_SMALL = 0, CLASS_NORMAL, CLASS_BULK, CLASS_COUNT };
+
+// 类别名，用于输出统计
+const char* request_class_name(int cls);
+
+// 按响应体的大小分类，阈值是 g_config 的 small_kb 和 bulk_kb，只在主线程中调用
+int class_of_size(uint64_t size);
+
+// 记下路径对应的文件大小，工作线程 stat 之后调用
+void size_hint_record(const char* path, int len, uint64_t size);
+// 查找路径对应的文件大小（KB 精度），没有记录返回false
+bool size_hint_lookup(const char* path, int len, uint64_t& size);
+
+// 添加大文件的路径前缀，多个前缀用逗号分隔，启动时调用
+void bulk_prefix_add(const char* prefixes);
+bool bulk_prefix_match(const char* path, int len);
+
+#endif // REQUEST_CLASS_H
@@ -0,0 +1,6 @@
+
+HEADERS += \
+    $$PWD/request_class.h
+
+SOURCES += \
+    $$PWD/request_class.cpp
@@ -0,0 +1,95 @@
+#include "busy_poll.h"
+
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+// 较老的头文件没有 epoll 忙等参数的定义（Linux 6.9 加入）
+#ifndef EPIOCSPARAMS
+struct epoll_params
+{
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW( 0x8A, 0x01, struct epoll_params )
+#endif
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+busy_poller::busy_poller(int epollfd, int spin_us, bool prefer_busy_poll)
+    : m_epollfd(epollfd), m_max_spin_us(spin_us > 0 ? spin_us : 0), m_spin_us(m_max_spin_us),
+      m_waits(0), m_spin_hits(0), m_spin_misses(0), m_blocks(0), m_fast_wakeups(0), m_spin_ns(0)
+{
+    if( m_max_spin_us == 0 ) {
+        return;
+    }
+    struct epoll_params params;
+    memset( &params, 0, sizeof(params) );
+    params.busy_poll_usecs = m_max_spin_us;
+    params.busy_poll_budget = 8;            // 不需要 CAP_NET_ADMIN 的默认值
+    params.prefer_busy_poll = prefer_busy_poll;
+    if( ioctl( m_epollfd, EPIOCSPARAMS, &params ) != 0 ) {
+        EMlog(LOGLEVEL_INFO, "epoll busy poll unavailable (%s), spinning in user space only.\n", strerror(errno));
+    }
+}
+
+int busy_poller::wait(epoll_event *events, int max_events)
+{
+    ++m_waits;
+    if( m_spin_us > 0 ) {
+        uint64_t start = now_ns();
+        uint64_t deadline = start + (uint64_t)m_spin_us * 1000;
+        uint64_t now = start;
+        do {
+            int num = epoll_wait( m_epollfd, events, max_events, 0 );
+            if( num != 0 ) {
+                m_spin_ns += now_ns() - start;
+                ++m_spin_hits;
+                m_spin_us = m_max_spin_us;  // 有事件，保持满预算
+                return num;
+            }
+            now = now_ns();
+        } while( now < deadline );
+        m_spin_ns += now - start;
+        ++m_spin_misses;
+        m_spin_us /= 2;                     // 负载低，逐步退回阻塞等待
+        if( m_spin_us < MIN_SPIN_US ) {
+            m_spin_us = 0;
+        }
+    }
+
+    uint64_t start = m_max_spin_us ? now_ns() : 0;
+    int num = epoll_wait( m_epollfd, events, max_events, -1 );
+    ++m_blocks;
+    if( m_max_spin_us && num > 0 && now_ns() - start < (uint64_t)m_max_spin_us * 1000 ) {
+        // 阻塞后很快就有事件，自旋本可以等到它，加大预算
+        ++m_fast_wakeups;
+        m_spin_us = m_spin_us ? m_spin_us * 2 : m_max_spin_us / 4;
+        if( m_spin_us < MIN_SPIN_US ) {
+            m_spin_us = MIN_SPIN_US;
+        }
+        if( m_spin_us > m_max_spin_us ) {
+            m_spin_us = m_max_spin_us;
+        }
+    }
+    return num;
+}
+
+void busy_poller::report() const
+{
+    if( m_max_spin_us == 0 ) {
+        return;
+    }
+    EMlog(LOGLEVEL_INFO, "busy poll: budget %d/%d us, %ld waits, spin hits %ld, misses %ld, blocking %ld (fast wakeups %ld), spun %.1f ms\n",
+          m_spin_us, m_max_spin_us, m_waits, m_spin_hits, m_spin_misses, m_blocks, m_fast_wakeups, m_spin_ns / 1e6);
+}
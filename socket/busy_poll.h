@@ -0,0 +1,42 @@
+/*
+    事件循环的忙等模式
+    epoll_wait 阻塞后再被唤醒要经过调度，请求会多出一段唤醒延迟。开启后先用零超时的 epoll_wait
+    自旋一段时间，自旋期间没有事件才阻塞。自旋预算按负载自适应：自旋落空就减半，
+    阻塞后很快就被唤醒（说明事件密集）就加倍，低负载时退化成普通的阻塞等待，不白白占用CPU。
+    内核支持时同时打开 epoll 自己的忙等（EPIOCSPARAMS），在网卡队列上直接收包。
+*/
+
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+class busy_poller
+{
+public:
+    static const int MIN_SPIN_US = 8;       // 预算低于它就不再自旋
+
+    // spin_us 为最大自旋时间（微秒），0 表示总是阻塞等待
+    busy_poller(int epollfd, int spin_us, bool prefer_busy_poll);
+
+    // 和 epoll_wait(epollfd, events, max_events, -1) 一样
+    int wait(epoll_event* events, int max_events);
+
+    // 输出自旋命中率等统计
+    void report() const;
+
+private:
+    int m_epollfd;
+    int m_max_spin_us;
+    int m_spin_us;              // 当前的自旋预算
+
+    long m_waits;
+    long m_spin_hits;           // 自旋期间等到了事件
+    long m_spin_misses;         // 自旋落空，转为阻塞
+    long m_blocks;              // 阻塞等待的次数
+    long m_fast_wakeups;        // 阻塞后在一个自旋周期内就被唤醒
+    uint64_t m_spin_ns;         // 自旋花掉的时间
+};
+
+#endif // BUSY_POLL_H
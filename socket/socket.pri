@@ -0,0 +1,8 @@
+
+HEADERS += \
+    $$PWD/socket_profile.h \
+    $$PWD/busy_poll.h
+
+SOURCES += \
+    $$PWD/socket_profile.cpp \
+    $$PWD/busy_poll.cpp
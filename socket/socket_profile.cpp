@@ -0,0 +1,70 @@
+#include "socket_profile.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <string.h>
+
+#include "log.h"
+
+socket_profile g_socket_profile;
+
+// 设置一个整数选项，失败只打印警告，不影响连接
+static void set_int_opt(int fd, int level, int opt, int value, const char* name)
+{
+    if( setsockopt( fd, level, opt, &value, sizeof(value) ) != 0 ) {
+        EMlog(LOGLEVEL_WARN, "setsockopt %s = %d on fd %d failed: %s\n", name, value, fd, strerror(errno));
+    }
+}
+
+void apply_listen_profile(int listenfd, const socket_profile &profile)
+{
+    if( profile.rcvbuf > 0 ) {
+        set_int_opt( listenfd, SOL_SOCKET, SO_RCVBUF, profile.rcvbuf, "SO_RCVBUF" );
+    }
+    if( profile.defer_accept > 0 ) {
+        // 连接建立后客户端一直不发数据就不会唤醒 accept，空连接不占用户数和定时器
+        set_int_opt( listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, profile.defer_accept, "TCP_DEFER_ACCEPT" );
+    }
+#ifdef SO_BUSY_POLL
+    if( profile.busy_poll > 0 ) {
+        // accept 出来的连接复制监听 socket 的设置，不需要每个连接再设置一次
+        set_int_opt( listenfd, SOL_SOCKET, SO_BUSY_POLL, profile.busy_poll, "SO_BUSY_POLL" );
+    }
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+    if( profile.prefer_busy_poll ) {
+        set_int_opt( listenfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, 1, "SO_PREFER_BUSY_POLL" );
+    }
+#endif
+#ifdef TCP_FASTOPEN
+    if( profile.fastopen_qlen > 0 ) {
+        // 再次连接的客户端在 SYN 中携带请求，省掉一个 RTT
+        set_int_opt( listenfd, IPPROTO_TCP, TCP_FASTOPEN, profile.fastopen_qlen, "TCP_FASTOPEN" );
+    }
+#endif
+}
+
+void apply_conn_profile(int connfd, const socket_profile &profile)
+{
+    if( profile.nodelay ) {
+        set_int_opt( connfd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY" );
+    }
+    if( profile.sndbuf > 0 ) {
+        set_int_opt( connfd, SOL_SOCKET, SO_SNDBUF, profile.sndbuf, "SO_SNDBUF" );
+    }
+    if( profile.rcvbuf > 0 ) {
+        set_int_opt( connfd, SOL_SOCKET, SO_RCVBUF, profile.rcvbuf, "SO_RCVBUF" );
+    }
+#ifdef TCP_NOTSENT_LOWAT
+    if( profile.notsent_lowat > 0 ) {
+        set_int_opt( connfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, profile.notsent_lowat, "TCP_NOTSENT_LOWAT" );
+    }
+#endif
+}
+
+void set_cork(int fd, bool on)
+{
+    set_int_opt( fd, IPPROTO_TCP, TCP_CORK, on ? 1 : 0, "TCP_CORK" );
+}
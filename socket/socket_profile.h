@@ -0,0 +1,37 @@
+/*
+    socket 调优参数
+    监听 socket 在 listen 前后设置一次，新连接在 accept 后设置一次
+*/
+
+#ifndef SOCKET_PROFILE_H
+#define SOCKET_PROFILE_H
+
+// socket 调优参数，数值为 0 表示不设置，使用内核默认值
+struct socket_profile
+{
+    // 监听 socket
+    int backlog = 1024;             // listen 的全连接队列长度
+    int defer_accept = 5;           // TCP_DEFER_ACCEPT：收到数据才唤醒 accept，最多等待的秒数
+    int fastopen_qlen = 256;        // TCP_FASTOPEN：允许的未完成 TFO 请求数
+
+    // 连接 socket
+    bool nodelay = true;            // TCP_NODELAY：关闭 Nagle 算法，小响应立即发出
+    bool cork = true;               // 响应头和文件分多次发送时用 TCP_CORK 合并成满的报文段
+    int sndbuf = 0;                 // SO_SNDBUF
+    int rcvbuf = 0;                 // SO_RCVBUF，同时设置在监听 socket 上，保证窗口扩大选项生效
+    int notsent_lowat = 16384;      // TCP_NOTSENT_LOWAT：未发送数据低于该值才报告可写，减少无效的 EPOLLOUT
+    int busy_poll = 0;              // SO_BUSY_POLL：读不到数据时在网卡队列上忙等的微秒数，设置在监听 socket 上由新连接继承
+    bool prefer_busy_poll = false;  // SO_PREFER_BUSY_POLL：忙等期间推迟软中断，由应用自己收包
+};
+
+// 全局使用的调优参数，main 在创建监听 socket 前修改
+extern socket_profile g_socket_profile;
+
+// 监听 socket 在 bind 之后、listen 之前调用
+void apply_listen_profile(int listenfd, const socket_profile& profile);
+// 新连接 accept 之后调用
+void apply_conn_profile(int connfd, const socket_profile& profile);
+// 打开/关闭 TCP_CORK，关闭时会把攒着的数据立即发出
+void set_cork(int fd, bool on);
+
+#endif // SOCKET_PROFILE_H
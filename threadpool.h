@@ -2,23 +2,61 @@
 #define THREADPOOL_H
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
 #include <list>
+#include <vector>
 #include <cstdio>
+#include <atomic>
 
 #include "locker.h"
+#include "log.h"
 
 //由于任务的类型 采用模板的方式
 //线程池类，定义成模板类是为了代码的复用(可能在别的项目中任务又是另一种类型
-//模板参数T就是任务类
+//模板参数T就是任务类，需要提供 process()、generation()、enter()/leave() 和 priority()：
+//generation() 在连接关闭时改变，入队时记下，出队后交给 enter() 检查，不一致说明连接已经关闭（或者fd已经被新连接复用），任务直接丢弃。
+//enter() 成功后到 leave() 之间连接正在被处理，主线程的定时器不会关闭它
+//priority() 在入队时调用，返回任务的类别 [0, MAX_CLASSES)。每个类别一个队列，按权重平滑加权轮询取任务：
+//权重为 w 的类别在所有有任务的类别中分到 w/总权重 的份额，并且穿插着取，不会连续取完一个类别再轮到下一个
+//
+//线程数在[最少, 最多]之间按负载伸缩：没有空闲线程、并且队列积压到阈值或者任务排队太久时加一个线程，
+//线程空闲超过一段时间就退出，直到剩下最少线程数。新线程在空闲时也算空闲线程，一次只会加一个，不会一下子加到最多
 template<typename T>
 class threadpool
 {
 public:
-    threadpool(int thread_number=8,int max_requests=10000);
+    static const int MAX_CLASSES=4;
+
+    threadpool(int min_threads=8,int max_threads=8,int max_requests=10000);
+    //停止并等待全部线程退出，队列中剩下的任务丢弃
     ~threadpool();
 
-    //主线程往队列中添加任务
+    //主线程往队列中添加任务，队列已满时返回false
     bool append(T* request);
+    //调整线程数的范围：多于最多的线程等空闲时退出，少于最少的立即创建
+    bool set_limits(int min_threads,int max_threads);
+    //调整队列最多允许的等待处理的请求数
+    void set_max_requests(int max_requests);
+    //扩容的阈值：队列长度达到queue_depth，或者任务排队超过wait_ms毫秒
+    void set_grow_threshold(int queue_depth,int wait_ms);
+    //设置类别cls的权重，最小为1
+    void set_weight(int cls,int weight);
+    //线程空闲超过ms毫秒就退出
+    void set_idle_timeout(int ms){ m_idle_timeout_ms.store(ms,std::memory_order_relaxed); }
+
+    int thread_number();
+    int idle_threads() const { return m_idle.load(std::memory_order_relaxed); }
+    size_t queue_size();
+    size_t queue_size(int cls);
+    //类别cls已经取出的任务数
+    long dispatched(int cls) const { return m_dispatched[cls].load(std::memory_order_relaxed); }
+    //因为连接已经关闭而丢弃的任务数
+    long cancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
+    //扩容创建的线程数、空闲退出的线程数
+    long grown() const { return m_grown.load(std::memory_order_relaxed); }
+    long retired() const { return m_retired.load(std::memory_order_relaxed); }
 
 private:
     //c++的类成员函数都有一个默认参数this指针，而线程调用的时候，限制了只能有一个参数void* arg,如果不设置静态在调用的时候会出现this和arg都给worker,而导致错误
@@ -26,18 +64,72 @@ private:
     static void* worker(void* arg);
     //启动线程池，从工作队列中去数据，去做任务
     void run();
+    //通知全部线程退出并join
+    void shutdown();
+
+    //下面几个函数调用时都持有m_queuelocker，只做决定，不创建也不join线程，免得主线程和取任务的线程在锁上等
+    //预留一个线程名额，放开锁之后再用start_thread创建
+    void reserve();
+    //没有空闲线程、也没到最多线程数时预留一个线程，返回是否预留了
+    bool grow();
+    //当前线程退出：从运行中的线程移到待回收的线程
+    void retire();
+    //取出已经退出、还没有join的线程
+    void take_exited(std::vector<pthread_t>& out);
+    //按权重选一个有任务的类别，都没有任务返回-1
+    int pick_class();
+
+    //下面两个在放开m_queuelocker之后调用
+    //创建一个预留的线程，失败时归还名额。新线程自己登记到m_threads
+    bool start_thread();
+    //join已经退出的线程
+    static void reap(std::vector<pthread_t>& exited);
+
+    static uint64_t now_ns(){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+        return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+    }
 private:
-    //线程的数量
-    int m_thread_number;
+    //线程数的范围
+    int m_min_threads;
+    int m_max_threads;
 
-    //线程池数组，大小为m_thread_number
-    pthread_t* m_threads;
+    //运行中的线程
+    std::vector<pthread_t> m_threads;
+    //已经预留、还没有登记到m_threads的线程，算在线程数里
+    int m_starting;
+    //已经退出、还没有join的线程
+    std::vector<pthread_t> m_exited;
+
+    //没有在处理任务的线程数
+    std::atomic<int> m_idle;
 
     //请求队列最多允许的，等待处理的请求数量
     int m_max_requests;
 
-    //请求队列 大部分操作都是插入删除操作，用链表更快
-    std::list<T*> m_workqueue;
+    //扩容的阈值
+    int m_grow_depth;
+    uint64_t m_grow_wait_ns;
+    //空闲线程退出前等待的时间
+    std::atomic<int> m_idle_timeout_ms;
+
+    //队列中的任务：连接、入队时连接的代数和入队时间
+    struct task
+    {
+        T* request;
+        unsigned generation;
+        uint64_t enqueue_ns;
+    };
+
+    //请求队列，每个类别一个 大部分操作都是插入删除操作，用链表更快
+    std::list<task> m_workqueue[MAX_CLASSES];
+    //全部队列中的任务数
+    size_t m_queued;
+    //类别的权重和平滑加权轮询的当前值
+    int m_weight[MAX_CLASSES];
+    int m_current[MAX_CLASSES];
+    std::atomic<long> m_dispatched[MAX_CLASSES];
 
     //互斥锁
     //保护请求队列，因为线程们包括主线程共享这个请求队列，从这个队列取任务，所以要线程同步，保证线程的独占式访问
@@ -50,63 +142,286 @@ private:
     //是否结束线程
     bool m_stop;
 
+    //丢弃的任务数
+    std::atomic<long> m_cancelled;
+    std::atomic<long> m_grown;
+    std::atomic<long> m_retired;
+
 };
 
 //模板定义声明最好在一个文件里
 template<typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests)
-    :m_thread_number(thread_number),m_max_requests(max_requests),
-    m_stop(false),m_threads(nullptr)
+threadpool<T>::threadpool(int min_threads, int max_threads, int max_requests)
+    :m_min_threads(min_threads),m_max_threads(max_threads),m_starting(0),m_idle(0),m_max_requests(max_requests),
+    m_grow_depth(16),m_grow_wait_ns(10*1000000ull),m_idle_timeout_ms(30000),
+    m_queued(0),m_queuelocker("pool queue"),m_queuestat(0,"pool sem"),m_stop(false),m_cancelled(0),m_grown(0),m_retired(0)
 {
-    if(thread_number<=0||max_requests<=0){
+    if(min_threads<=0||max_threads<min_threads||max_requests<=0){
         throw std::exception();
     }
+    for(int i=0;i<MAX_CLASSES;++i){
+        m_weight[i]=1;
+        m_current[i]=0;
+        m_dispatched[i]=0;
+    }
 
-    m_threads=new pthread_t[m_thread_number];
-    if(!m_threads){
+    //先创建最少线程数个线程
+    m_queuelocker.lock();
+    for(int i=0;i<min_threads;++i){
+        reserve();
+    }
+    m_queuelocker.unlock();
+    bool ok=true;
+    for(int i=0;i<min_threads;++i){
+        ok=start_thread()&&ok;
+    }
+    if(!ok){
+        shutdown();
         throw std::exception();
     }
+}
 
-    //创建thread_number个线程，并将他们设置为线程脱离
-    for(int i=0;i<thread_number;++i){
-        printf("create the %dth thread\n",i);
+template<typename T>
+threadpool<T>::~threadpool()
+{
+    shutdown();
+}
 
-        //worker必须是静态函数
-        //静态函数不能访问非静态成员等，可以通过参数this传递参数进来，this是threadpool类型
-        if( pthread_create(m_threads+i,NULL,worker,this)!=0){
-            delete [] m_threads;
-            throw std::exception();
+template<typename T>
+void threadpool<T>::shutdown()
+{
+    std::vector<pthread_t> threads;
+    while(true){
+        m_queuelocker.lock();
+        m_stop=true;
+        //正在创建的线程还没有登记自己，等它们登记完（或者创建失败归还名额）才知道要join哪些
+        if(m_starting==0){
+            threads=m_threads;
+            threads.insert(threads.end(),m_exited.begin(),m_exited.end());
+            m_threads.clear();
+            m_exited.clear();
+            m_queuelocker.unlock();
+            break;
         }
+        m_queuelocker.unlock();
+        sched_yield();
+    }
+
+    //每个线程唤醒一次，醒来看到m_stop就退出；正在处理任务的线程处理完再退出
+    for(size_t i=0;i<threads.size();++i){
+        m_queuestat.post();
+    }
+    for(size_t i=0;i<threads.size();++i){
+        pthread_join(threads[i],NULL);
+    }
+}
 
-        if(pthread_detach(m_threads[i])){
-            delete [] m_threads;
-            throw std::exception();
+template<typename T>
+void threadpool<T>::reserve()
+{
+    ++m_starting;
+    //新线程从创建起就算空闲线程，一次只会加一个
+    m_idle.fetch_add(1,std::memory_order_relaxed);
+}
+
+template<typename T>
+bool threadpool<T>::start_thread()
+{
+    //worker必须是静态函数
+    //静态函数不能访问非静态成员等，可以通过参数this传递参数进来，this是threadpool类型
+    pthread_t tid;
+    if( pthread_create(&tid,NULL,worker,this)!=0){
+        m_queuelocker.lock();
+        --m_starting;
+        m_queuelocker.unlock();
+        m_idle.fetch_sub(1,std::memory_order_relaxed);
+        return false;
+    }
+    EMlog(LOGLEVEL_INFO,"create a worker thread\n");    // 扩容可能发生在工作线程中，经过日志锁输出
+    return true;
+}
+
+template<typename T>
+bool threadpool<T>::grow()
+{
+    if(m_stop||m_idle.load(std::memory_order_relaxed)!=0||(int)m_threads.size()+m_starting>=m_max_threads){
+        return false;
+    }
+    reserve();
+    return true;
+}
+
+template<typename T>
+void threadpool<T>::retire()
+{
+    pthread_t self=pthread_self();
+    for(size_t i=0;i<m_threads.size();++i){
+        if(pthread_equal(m_threads[i],self)){
+            m_threads[i]=m_threads.back();
+            m_threads.pop_back();
+            break;
         }
+    }
+    m_exited.push_back(self);
+    m_idle.fetch_sub(1,std::memory_order_relaxed);
+    m_retired.fetch_add(1,std::memory_order_relaxed);
+}
 
+template<typename T>
+void threadpool<T>::take_exited(std::vector<pthread_t>& out)
+{
+    if(!m_exited.empty()){
+        out.swap(m_exited);
     }
 }
 
 template<typename T>
-threadpool<T>::~threadpool()
+void threadpool<T>::reap(std::vector<pthread_t>& exited)
 {
-    delete[] m_threads;
-    m_stop=true;
+    //exited中的线程已经放开了锁，马上就会结束，join不会等很久
+    for(size_t i=0;i<exited.size();++i){
+        pthread_join(exited[i],NULL);
+    }
+    exited.clear();
+}
+
+template<typename T>
+bool threadpool<T>::set_limits(int min_threads, int max_threads)
+{
+    if(min_threads<=0||max_threads<min_threads){
+        return false;
+    }
+    m_queuelocker.lock();
+    m_min_threads=min_threads;
+    m_max_threads=max_threads;
+    int add=0;
+    while((int)m_threads.size()+m_starting<min_threads){
+        reserve();
+        ++add;
+    }
+    int extra=(int)m_threads.size()+m_starting-max_threads;
+    std::vector<pthread_t> exited;
+    take_exited(exited);
+    m_queuelocker.unlock();
+    reap(exited);
+    bool ok=true;
+    for(int i=0;i<add;++i){
+        ok=start_thread()&&ok;
+    }
+    //唤醒多出来的线程，它们醒来后先检查线程数，多了就退出
+    for(int i=0;i<extra;++i){
+        m_queuestat.post();
+    }
+    return ok;
+}
+
+template<typename T>
+void threadpool<T>::set_max_requests(int max_requests)
+{
+    m_queuelocker.lock();
+    m_max_requests=max_requests;
+    m_queuelocker.unlock();
+}
+
+template<typename T>
+void threadpool<T>::set_grow_threshold(int queue_depth, int wait_ms)
+{
+    m_queuelocker.lock();
+    m_grow_depth=queue_depth;
+    m_grow_wait_ns=(uint64_t)wait_ms*1000000ull;
+    m_queuelocker.unlock();
+}
+
+template<typename T>
+void threadpool<T>::set_weight(int cls, int weight)
+{
+    if(cls<0||cls>=MAX_CLASSES){
+        return;
+    }
+    m_queuelocker.lock();
+    m_weight[cls]=weight>1?weight:1;
+    m_queuelocker.unlock();
+}
+
+template<typename T>
+int threadpool<T>::thread_number()
+{
+    m_queuelocker.lock();
+    int n=m_threads.size()+m_starting;
+    m_queuelocker.unlock();
+    return n;
+}
+
+template<typename T>
+size_t threadpool<T>::queue_size()
+{
+    m_queuelocker.lock();
+    size_t n=m_queued;
+    m_queuelocker.unlock();
+    return n;
+}
+
+template<typename T>
+size_t threadpool<T>::queue_size(int cls)
+{
+    m_queuelocker.lock();
+    size_t n=m_workqueue[cls].size();
+    m_queuelocker.unlock();
+    return n;
+}
+
+//平滑加权轮询：每个有任务的类别当前值加上权重，取当前值最大的，被取的减去总权重
+template<typename T>
+int threadpool<T>::pick_class()
+{
+    int best=-1;
+    int total=0;
+    for(int i=0;i<MAX_CLASSES;++i){
+        if(m_workqueue[i].empty()){
+            continue;
+        }
+        m_current[i]+=m_weight[i];
+        total+=m_weight[i];
+        if(best<0||m_current[i]>m_current[best]){
+            best=i;
+        }
+    }
+    if(best>=0){
+        m_current[best]-=total;
+    }
+    return best;
 }
 
 //主线程添加请求队列
 template<typename T>
 bool threadpool<T>::append(T *request)
 {
+    //分类要查看请求内容，在加锁前做，不占用队列锁
+    int cls=request->priority();
+    if(cls<0||cls>=MAX_CLASSES){
+        cls=MAX_CLASSES-1;
+    }
+    task t={request,request->generation(),now_ns()};
+
     //主线程添加请求队列，此时其他线程不能操作队列
     m_queuelocker.lock();
-    if(m_workqueue.size() >= m_max_requests){
+    if(m_queued >= (size_t)m_max_requests){
         m_queuelocker.unlock();
+        return false;
     }
 
-    m_workqueue.push_back(request);
+    m_workqueue[cls].push_back(t);
+    ++m_queued;
+    //积压到阈值，线程不够用了
+    bool add=(int)m_queued>=m_grow_depth&&grow();
     m_queuelocker.unlock();
     m_queuestat.post(); //通知子线程来任务了
 
+    //放开锁之后再创建线程
+    if(add&&start_thread()){
+        m_grown.fetch_add(1,std::memory_order_relaxed);
+    }
+
     return true;
 }
 
@@ -114,6 +429,11 @@ template<typename T>
 void *threadpool<T>::worker(void *arg)
 {
     threadpool * pool=(threadpool *)arg;
+    //创建者放开锁之后才创建线程，由线程自己登记
+    pool->m_queuelocker.lock();
+    pool->m_threads.push_back(pthread_self());
+    --pool->m_starting;
+    pool->m_queuelocker.unlock();
     pool->run();
     return pool;
 }
@@ -122,36 +442,72 @@ void *threadpool<T>::worker(void *arg)
 template<typename T>
 void threadpool<T>::run()
 {
-    while(!m_stop){
+    while(true){
         //从工作队列中取一个，然后去做任务
 
         //如果信号量有值，不阻塞，信号量值减1
-        //如果没有值，阻塞
-        m_queuestat.wait();
+        //如果没有值，阻塞，空闲太久返回false
+        bool woken=m_queuestat.timedwait(m_idle_timeout_ms.load(std::memory_order_relaxed));
 
         //有值，上锁
         //获取任务时，要使用互斥锁，保证对资源的独占式访问
         m_queuelocker.lock();
 
+        if(m_stop){
+            m_queuelocker.unlock();
+            break;
+        }
+
+        //线程数调小了（消耗的是set_limits多发的那次通知），或者空闲太久，这个线程退出
+        int live=m_threads.size()+m_starting;
+        if(live>m_max_threads||(!woken&&live>m_min_threads)){
+            retire();
+            m_queuelocker.unlock();
+            break;
+        }
+
         //信号量表示请求数量，请求数量为0,会阻塞在wait处，
-        //所以下面这个判断可以去掉
-        if(m_workqueue.empty()){
+        //但线程数调小时多发的通知、等待超时都会走到这里
+        int cls=pick_class();
+        if(cls<0){
             m_queuelocker.unlock();
             continue;
         }
 
-        T* request=m_workqueue.front(); //获取任务
-        m_workqueue.pop_front();
+        task t=m_workqueue[cls].front(); //获取任务
+        m_workqueue[cls].pop_front();
+        --m_queued;
+        //队列取空了，之前攒下的份额作废，不会在下一次有任务时连续占用线程
+        if(m_workqueue[cls].empty()){
+            m_current[cls]=0;
+        }
+        m_dispatched[cls].fetch_add(1,std::memory_order_relaxed);
+        m_idle.fetch_sub(1,std::memory_order_relaxed);
+
+        //后面还有任务，并且这个任务排队太久，线程不够用了
+        bool add=m_queued>0&&now_ns()-t.enqueue_ns>=m_grow_wait_ns&&grow();
+        //顺便回收空闲退出的线程，不占用主线程
+        std::vector<pthread_t> exited;
+        take_exited(exited);
 
         m_queuelocker.unlock();
 
-        if(!request){
-            continue;
+        reap(exited);
+        if(add&&start_thread()){
+            m_grown.fetch_add(1,std::memory_order_relaxed);
         }
 
-        //做任务
-        //调用任务的工作 逻辑函数
-        request->process();     //执行任务，这里不用锁，并发执行
+        T* request=t.request;
+        //排队期间连接被关闭了（对方断开、超时），不再处理
+        if(request&&!request->enter(t.generation)){
+            m_cancelled.fetch_add(1,std::memory_order_relaxed);
+        }else if(request){
+            //做任务
+            //调用任务的工作 逻辑函数
+            request->process();     //执行任务，这里不用锁，并发执行
+            request->leave();
+        }
+        m_idle.fetch_add(1,std::memory_order_relaxed);
     }
 }
 
@@ -159,4 +515,3 @@ void threadpool<T>::run()
 
 
 #endif // THREADPOOL_H
-
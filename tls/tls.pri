@@ -0,0 +1,8 @@
+
+HEADERS += \
+    $$PWD/tls_context.h
+
+SOURCES += \
+    $$PWD/tls_context.cpp
+
+LIBS += -lssl -lcrypto
@@ -0,0 +1,211 @@
+#include "tls_context.h"
+
+#include <errno.h>
+#include <string.h>
+#include <openssl/err.h>
+
+#include "log.h"
+
+// 同一个会话缓存只接受本服务器发出的会话
+static const unsigned char session_id_context[] = "webserver";
+
+// 输出并清空当前线程的 OpenSSL 错误队列
+static void log_ssl_errors(const char* what)
+{
+    unsigned long e;
+    while( ( e = ERR_get_error() ) != 0 ) {
+        char buf[256];
+        ERR_error_string_n( e, buf, sizeof(buf) );
+        EMlog(LOGLEVEL_WARN, "%s: %s\n", what, buf);
+    }
+}
+
+tls_context::tls_context() : m_ctx(NULL)
+{
+}
+
+tls_context::~tls_context()
+{
+    if( m_ctx ) {
+        SSL_CTX_free( m_ctx );
+    }
+}
+
+bool tls_context::init(const char *cert_file, const char *key_file)
+{
+    m_ctx = SSL_CTX_new( TLS_server_method() );
+    if( !m_ctx ) {
+        log_ssl_errors( "SSL_CTX_new" );
+        return false;
+    }
+    SSL_CTX_set_min_proto_version( m_ctx, TLS1_2_VERSION );
+
+    if( SSL_CTX_use_certificate_chain_file( m_ctx, cert_file ) != 1
+        || SSL_CTX_use_PrivateKey_file( m_ctx, key_file, SSL_FILETYPE_PEM ) != 1
+        || SSL_CTX_check_private_key( m_ctx ) != 1 ) {
+        log_ssl_errors( "load certificate" );
+        return false;
+    }
+
+    // 写操作可以只写一部分，重试时缓冲区地址可以变化（iovec 推进后重试的是同一段数据）
+    SSL_CTX_set_mode( m_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS );
+
+    long opts = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+#ifdef SSL_OP_ENABLE_KTLS
+    opts |= SSL_OP_ENABLE_KTLS;         // 内核和 OpenSSL 都支持时，握手后由内核加解密
+#endif
+    SSL_CTX_set_options( m_ctx, opts );
+
+    // 服务端会话缓存：TLS1.2 按会话ID复用
+    SSL_CTX_set_session_cache_mode( m_ctx, SSL_SESS_CACHE_SERVER );
+    SSL_CTX_sess_set_cache_size( m_ctx, SESSION_CACHE_SIZE );
+    SSL_CTX_set_timeout( m_ctx, SESSION_TIMEOUT );
+    SSL_CTX_set_session_id_context( m_ctx, session_id_context, sizeof(session_id_context) - 1 );
+
+    // 会话票据：票据密钥由 OpenSSL 在 SSL_CTX 创建时随机生成，所有连接共用；
+    // TLS1.3 握手后发一张票据就够了，客户端每次复用时会拿到新的
+    SSL_CTX_clear_options( m_ctx, SSL_OP_NO_TICKET );
+    SSL_CTX_set_num_tickets( m_ctx, 1 );
+
+    EMlog(LOGLEVEL_INFO, "TLS enabled, certificate %s\n", cert_file);
+    return true;
+}
+
+SSL *tls_context::new_ssl(int fd)
+{
+    SSL* ssl = SSL_new( m_ctx );
+    if( !ssl ) {
+        log_ssl_errors( "SSL_new" );
+        return NULL;
+    }
+    if( SSL_set_fd( ssl, fd ) != 1 ) {
+        SSL_free( ssl );
+        return NULL;
+    }
+    SSL_set_accept_state( ssl );
+    return ssl;
+}
+
+void tls_context::set_session_cache_size(long n)
+{
+    if( m_ctx ) {
+        SSL_CTX_sess_set_cache_size( m_ctx, n );
+    }
+}
+
+void tls_context::report() const
+{
+    if( !m_ctx ) {
+        return;
+    }
+    EMlog(LOGLEVEL_INFO, "TLS handshakes: %ld, resumed: %ld, cache misses: %ld, cached sessions: %ld\n",
+          SSL_CTX_sess_accept_good( m_ctx ), SSL_CTX_sess_hits( m_ctx ),
+          SSL_CTX_sess_misses( m_ctx ), SSL_CTX_sess_number( m_ctx ));
+}
+
+// 把 SSL 的错误码转换成 errno 的形式
+static ssize_t ssl_result(SSL* ssl, int ret)
+{
+    if( ret > 0 ) {
+        return ret;
+    }
+    switch( SSL_get_error( ssl, ret ) ) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:     // 收到 close_notify
+            return 0;
+        case SSL_ERROR_SYSCALL:
+            if( errno == 0 ) {          // 对方没有发 close_notify 就断开了
+                errno = ECONNRESET;
+            }
+            ERR_clear_error();
+            return -1;
+        default:
+            log_ssl_errors( "TLS" );
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+ssize_t tls_recv(SSL *ssl, void *buf, size_t len)
+{
+    ERR_clear_error();
+    errno = 0;
+    return ssl_result( ssl, SSL_read( ssl, buf, len ) );
+}
+
+ssize_t tls_send(SSL *ssl, const void *buf, size_t len)
+{
+    if( len == 0 ) {
+        return 0;
+    }
+    ERR_clear_error();
+    errno = 0;
+    ssize_t n = ssl_result( ssl, SSL_write( ssl, buf, len ) );
+    if( n == 0 ) {          // 收到了 close_notify，再写也不会有进展
+        errno = EPIPE;
+        return -1;
+    }
+    return n;
+}
+
+ssize_t tls_writev(SSL *ssl, const iovec *iov, int iovcnt)
+{
+    // kTLS 发送时内核负责加密，直接 writev，不经过 OpenSSL 的记录缓冲区
+    if( tls_ktls_send( ssl ) ) {
+        return writev( SSL_get_wfd( ssl ), iov, iovcnt );
+    }
+    // 逐块 SSL_write，和 writev 一样返回已经写出的总字节数
+    ssize_t total = 0;
+    for( int i = 0; i < iovcnt; ++i ) {
+        if( iov[i].iov_len == 0 ) {
+            continue;
+        }
+        ssize_t n = tls_send( ssl, iov[i].iov_base, iov[i].iov_len );
+        if( n < 0 ) {
+            return total > 0 ? total : -1;
+        }
+        total += n;
+        if( (size_t)n < iov[i].iov_len ) {
+            break;
+        }
+    }
+    return total;
+}
+
+int tls_handshake(SSL *ssl, bool &want_write)
+{
+    ERR_clear_error();
+    int ret = SSL_do_handshake( ssl );
+    if( ret == 1 ) {
+        return 1;
+    }
+    int err = SSL_get_error( ssl, ret );
+    if( err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ) {
+        want_write = ( err == SSL_ERROR_WANT_WRITE );
+        return 0;
+    }
+    log_ssl_errors( "TLS handshake" );
+    return -1;
+}
+
+bool tls_ktls_send(SSL *ssl)
+{
+#ifdef BIO_get_ktls_send
+    return BIO_get_ktls_send( SSL_get_wbio( ssl ) );
+#else
+    return false;
+#endif
+}
+
+void tls_close(SSL *ssl)
+{
+    // 非阻塞 socket 上只尝试一次，不等对方的 close_notify
+    if( SSL_is_init_finished( ssl ) ) {
+        SSL_shutdown( ssl );
+    }
+    ERR_clear_error();
+    SSL_free( ssl );
+}
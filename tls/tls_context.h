@@ -0,0 +1,58 @@
+/*
+    TLS 终结
+    所有连接共用一个 SSL_CTX，会话缓存和会话票据都挂在它上面，工作线程之间共享，
+    复用会话的握手不需要再做密钥交换。
+    内核支持 kTLS 时，握手完成后的加密交给内核，发送路径仍然是普通的 writev。
+*/
+
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <openssl/ssl.h>
+
+class tls_context
+{
+public:
+    static const long SESSION_CACHE_SIZE = 20480;   // 服务端会话缓存的最大会话数
+    static const long SESSION_TIMEOUT = 300;        // 会话（包括票据）的有效期：秒
+
+    tls_context();
+    ~tls_context();
+
+    // 加载证书和私钥（PEM），失败返回false
+    bool init(const char* cert_file, const char* key_file);
+
+    // 为新连接创建 SSL 对象，处于服务端握手状态
+    SSL* new_ssl(int fd);
+
+    // 调整会话缓存的最大会话数，0 表示不限制
+    void set_session_cache_size(long n);
+
+    // 输出握手和会话复用的统计
+    void report() const;
+
+private:
+    SSL_CTX* m_ctx;
+};
+
+/*
+    下面这组函数的返回值和 recv/send/writev 一致：
+    成功返回字节数，对方正常关闭返回0，出错返回-1并设置errno，需要等待时errno为EAGAIN。
+    发送方向和 send 一样不会返回0：对方已经关闭时返回-1，errno为EPIPE
+*/
+ssize_t tls_recv(SSL* ssl, void* buf, size_t len);
+ssize_t tls_send(SSL* ssl, const void* buf, size_t len);
+ssize_t tls_writev(SSL* ssl, const struct iovec* iov, int iovcnt);
+
+// 继续非阻塞握手：完成返回1，需要等待返回0（want_write 说明等待的是可写），失败返回-1
+int tls_handshake(SSL* ssl, bool& want_write);
+
+// 握手完成后发送方向是否已经交给内核（kTLS）
+bool tls_ktls_send(SSL* ssl);
+
+// 发送 close_notify（不等待对方回复）并释放
+void tls_close(SSL* ssl);
+
+#endif // TLS_CONTEXT_H
@@ -0,0 +1,146 @@
+/*
+    把二进制访问日志转换成文本
+    用法：access_log_dump [-c] access.log
+    -c 输出 CSV，默认输出按列对齐的文本
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "accesslog/access_log.h"
+
+// 和 http_conn::METHOD 的顺序一致
+static const char* method_name(int method)
+{
+    static const char* names[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT" };
+    return method >= 0 && method < (int)( sizeof( names ) / sizeof( names[0] ) ) ? names[method] : "?";
+}
+
+static void format_flags(unsigned flags, char* buf)
+{
+    char* p = buf;
+    if ( flags & ACCESS_TLS ) *p++ = 'S';
+    if ( flags & ACCESS_PROXY ) *p++ = 'P';
+    if ( flags & ACCESS_CORO ) *p++ = 'C';
+    if ( flags & ACCESS_KEEP_ALIVE ) *p++ = 'K';
+    if ( flags & ACCESS_H2 ) *p++ = '2';
+    if ( p == buf ) *p++ = '-';
+    *p = '\0';
+}
+
+static void print_record(const access_record& r, bool csv)
+{
+    char when[ 32 ];
+    time_t sec = r.time_ns / 1000000000ull;
+    struct tm tm;
+    localtime_r( &sec, &tm );
+    size_t n = strftime( when, sizeof( when ), "%Y-%m-%d %H:%M:%S", &tm );
+    snprintf( when + n, sizeof( when ) - n, ".%06llu", (unsigned long long)( r.time_ns % 1000000000ull / 1000 ) );
+
+    char ip[ INET_ADDRSTRLEN ];
+    struct in_addr a;
+    a.s_addr = r.client_ip;
+    inet_ntop( AF_INET, &a, ip, sizeof( ip ) );
+
+    char flags[ 8 ];
+    format_flags( r.flags, flags );
+
+    // 记录里只有 URL 的前缀，截断的在后面加 ...
+    char url[ sizeof( r.url ) + 4 ];
+    size_t len = r.url_len < sizeof( r.url ) ? r.url_len : sizeof( r.url );
+    memcpy( url, r.url, len );
+    strcpy( url + len, r.url_len > sizeof( r.url ) ? "..." : "" );
+
+    if ( csv ) {
+        // 前缀里可能有逗号和引号，按 CSV 的规则加引号
+        printf( "%s,%s,%u,%s,%u,%llu,%u,%s,\"", when, ip, ntohs( r.client_port ), method_name( r.method ),
+                r.status, (unsigned long long)r.bytes, r.latency_us, flags );
+        for ( const char* p = url; *p; ++p ) {
+            if ( *p == '"' ) putchar( '"' );
+            putchar( *p );
+        }
+        printf( "\",%u,%08x\n", r.url_len, r.url_hash );
+    } else {
+        printf( "%s %15s:%-5u %-7s %3u %10llu %8uus %-4s %-23s %08x\n", when, ip, ntohs( r.client_port ),
+                method_name( r.method ), r.status, (unsigned long long)r.bytes, r.latency_us, flags, url, r.url_hash );
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool csv = false;
+    int opt;
+    while ( ( opt = getopt( argc, argv, "c" ) ) != -1 ) {
+        if ( opt == 'c' ) {
+            csv = true;
+        } else {
+            fprintf( stderr, "usage: %s [-c] access.log\n", argv[0] );
+            return 1;
+        }
+    }
+    if ( optind >= argc ) {
+        fprintf( stderr, "usage: %s [-c] access.log\n", argv[0] );
+        return 1;
+    }
+
+    const char* path = argv[optind];
+    int fd = open( path, O_RDONLY );
+    struct stat st;
+    if ( fd < 0 || fstat( fd, &st ) != 0 ) {
+        perror( path );
+        return 1;
+    }
+    if ( (size_t)st.st_size < sizeof( access_log_header ) ) {
+        fprintf( stderr, "%s: too small\n", path );
+        return 1;
+    }
+    // 服务器可能还在写，只读映射，读到的就是当时的快照
+    void* base = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( base == MAP_FAILED ) {
+        perror( "mmap" );
+        return 1;
+    }
+
+    const access_log_header* hdr = (const access_log_header*)base;
+    if ( memcmp( hdr->magic, ACCESS_LOG_MAGIC, 4 ) != 0 || hdr->version != ACCESS_LOG_VERSION
+         || hdr->record_size != sizeof( access_record ) || hdr->capacity == 0
+         || ( hdr->capacity & ( hdr->capacity - 1 ) ) != 0
+         || (size_t)st.st_size < sizeof( access_log_header ) + (size_t)hdr->capacity * sizeof( access_record ) ) {
+        fprintf( stderr, "%s: not an access log\n", path );
+        return 1;
+    }
+
+    const access_record* records = (const access_record*)( (const char*)base + sizeof( access_log_header ) );
+    uint64_t next = __atomic_load_n( &hdr->next, __ATOMIC_ACQUIRE );
+    uint64_t first = next > hdr->capacity ? next - hdr->capacity : 0;
+    uint64_t skipped = 0;
+
+    if ( csv ) {
+        printf( "time,ip,port,method,status,bytes,latency_us,flags,url,url_len,url_hash\n" );
+    }
+    for ( uint64_t i = first; i < next; ++i ) {
+        const access_record& slot = records[ i & ( hdr->capacity - 1 ) ];
+        // 先复制再检查序号，复制期间被改写的记录序号对不上
+        access_record r;
+        memcpy( &r, &slot, sizeof( r ) );
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if ( r.seq != i + 1 || __atomic_load_n( &slot.seq, __ATOMIC_RELAXED ) != i + 1 ) {
+            ++skipped;
+            continue;
+        }
+        print_record( r, csv );
+    }
+    if ( skipped ) {
+        fprintf( stderr, "%llu incomplete records skipped\n", (unsigned long long)skipped );
+    }
+    munmap( base, st.st_size );
+    return 0;
+}
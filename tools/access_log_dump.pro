@@ -0,0 +1,9 @@
+TEMPLATE = app
+CONFIG += console c++20
+CONFIG -= app_bundle
+CONFIG -= qt
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    access_log_dump.cpp
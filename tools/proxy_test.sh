@@ -0,0 +1,50 @@
+#!/bin/sh
+# 反向代理规则匹配的测试：启动 proxy_backend.py 和服务器，检查哪些 URL 被转发、转发的请求目标是什么
+# 用法：proxy_test.sh path/to/server [port]
+# 需要 python3 和 curl，全部通过时退出码为0
+
+SERVER=${1:?usage: proxy_test.sh path/to/server [port]}
+PORT=${2:-9310}
+BACKEND=$((PORT + 1))
+DIR=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(mktemp -d)
+echo "local" > "$ROOT/apix"
+echo "local" > "$ROOT/index.html"
+mkdir -p "$ROOT/upload"
+
+python3 "$DIR/proxy_backend.py" $BACKEND &
+BACKEND_PID=$!
+"$SERVER" -r /api=127.0.0.1:$BACKEND $PORT "$ROOT" "$ROOT/no-pack" >/dev/null 2>&1 &
+SERVER_PID=$!
+trap 'kill $SERVER_PID $BACKEND_PID 2>/dev/null; rm -rf "$ROOT"' EXIT
+sleep 1
+
+FAIL=0
+# check 方法 URL 期望的响应体加状态码（转发时响应体是后端收到的请求目标，否则是本地文件）
+# 第四个参数为 -s 时只比较状态码
+check() {
+    out=-
+    [ "$4" = "-s" ] && out=/dev/null
+    got=$(curl -s --path-as-is -X "$1" -d x -o $out -w '%{http_code}' "http://127.0.0.1:$PORT$2" | tr -d '\n')
+    if [ "$got" = "$3" ]; then
+        echo "ok    $1 $2"
+    else
+        echo "FAIL  $1 $2: got '$got', want '$3'"
+        FAIL=1
+    fi
+}
+
+check GET  /api                 /api200
+check GET  /api/x               /api/x200
+check GET  '/api?q=1'           '/api?q=1200'
+check GET  /apix                local200            # 不在段边界，不转发
+check GET  /api/../index.html   local200            # 规范化之后不在规则下
+check GET  /static/../api/x     /api/x200           # 规范化之后在规则下
+check GET  /%61pi/x             /api/x200
+check GET  '/api/a%20b?c=%20'   '/api/a%20b?c=%20200'
+check GET  /api%2fx             /api/x200
+check POST /api/post            /api/post200
+check PUT  /api/put             /api/put200         # PUT 也转发，不写 upload 目录
+check PUT  /apix                403 -s
+
+exit $FAIL
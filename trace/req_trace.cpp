@@ -0,0 +1,199 @@
+#include "req_trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "locker.h"
+#include "log.h"
+
+int g_trace_sample = 0;
+const char* g_trace_file = "./trace.json";
+
+// 一个被跟踪的请求
+struct trace_record
+{
+    uint64_t accept;
+    uint64_t ts[ TP_COUNT ];
+    int reactor_tid;            // 接收和发送所在的线程（提交记录的线程）
+    int worker_tid;
+    int fd;
+    int eagain;
+    char url[ 64 ];
+};
+
+// 每个线程一个环形缓冲区，写满后覆盖最旧的记录。
+// 锁只在导出时才会有竞争
+struct trace_buffer
+{
+    static const int CAPACITY = 4096;
+
+    locker lock{ "trace buffer" };
+    trace_record records[ CAPACITY ];
+    uint64_t count;             // 写入过的记录总数
+};
+
+static locker s_registry_lock( "trace registry" );
+static std::vector<trace_buffer*> s_buffers;    // 所有线程的缓冲区，线程退出后也保留，导出时还能读到
+static thread_local trace_buffer* t_buffer = NULL;
+static thread_local int t_tid = 0;
+static thread_local unsigned t_seq = 0;         // 采样计数
+
+int trace_tid()
+{
+    if ( !t_tid ) {
+        t_tid = syscall( SYS_gettid );
+    }
+    return t_tid;
+}
+
+void req_trace::begin()
+{
+    sampled = trace_enabled() && ++t_seq % g_trace_sample == 0;
+    if ( !sampled ) {
+        accept = 0;                 // accept 只算在连接的第一个请求上
+        return;
+    }
+    memset( ts, 0, sizeof( ts ) );
+    worker_tid = 0;
+    eagain = 0;
+    ts[ TP_READ_BEGIN ] = trace_now();
+}
+
+static trace_buffer* thread_buffer()
+{
+    if ( !t_buffer ) {
+        t_buffer = new trace_buffer;
+        t_buffer->count = 0;
+        s_registry_lock.lock();
+        s_buffers.push_back( t_buffer );
+        s_registry_lock.unlock();
+    }
+    return t_buffer;
+}
+
+void trace_commit(req_trace &t, int fd, const char *url)
+{
+    if ( !t.sampled ) {
+        return;
+    }
+    t.sampled = false;
+    trace_buffer* b = thread_buffer();
+    b->lock.lock();
+    trace_record& r = b->records[ b->count % trace_buffer::CAPACITY ];
+    r.accept = t.accept;
+    memcpy( r.ts, t.ts, sizeof( r.ts ) );
+    r.reactor_tid = trace_tid();
+    r.worker_tid = t.worker_tid;
+    r.fd = fd;
+    r.eagain = t.eagain;
+    snprintf( r.url, sizeof( r.url ), "%s", url ? url : "" );
+    ++b->count;
+    b->lock.unlock();
+    t.accept = 0;
+}
+
+// 写一个 JSON 字符串，转义引号、反斜杠和控制字符
+static void write_json_string(FILE* fp, const char* s)
+{
+    fputc( '"', fp );
+    for ( ; *s; ++s ) {
+        unsigned char c = *s;
+        if ( c == '"' || c == '\\' ) {
+            fputc( '\\', fp );
+            fputc( c, fp );
+        } else if ( c < 0x20 ) {
+            fprintf( fp, "\\u%04x", c );
+        } else {
+            fputc( c, fp );
+        }
+    }
+    fputc( '"', fp );
+}
+
+// 输出一个阶段（"X" 事件），起止时间点缺失时跳过
+static void write_phase(FILE* fp, bool& first, const char* name, uint64_t begin, uint64_t end,
+                        const trace_record& r, int tid)
+{
+    if ( !begin || !end || end < begin ) {
+        return;
+    }
+    fprintf( fp, "%s\n{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                 "\"pid\":%d,\"tid\":%d,\"args\":{\"thread\":%d,\"url\":",
+             first ? "" : ",", name, begin / 1000.0, ( end - begin ) / 1000.0, (int)getpid(), r.fd, tid );
+    write_json_string( fp, r.url );
+    if ( end == r.ts[ TP_WRITE_END ] ) {
+        fprintf( fp, ",\"eagain\":%d", r.eagain );
+    }
+    fputs( "}}", fp );
+    first = false;
+}
+
+// 一个请求的各个阶段放在以连接 fd 命名的一行里，一个连接同一时间只有一个请求，互不重叠
+static void write_record(FILE* fp, bool& first, const trace_record& r)
+{
+    const uint64_t* ts = r.ts;
+    // 请求没有进入 do_request（解析出错）时，解析阶段一直到响应生成完
+    uint64_t parse_end = ts[ TP_REQUEST_BEGIN ] ? ts[ TP_REQUEST_BEGIN ] : ts[ TP_PROCESS_END ];
+    uint64_t build_begin = ts[ TP_REQUEST_END ] ? ts[ TP_REQUEST_END ] : ts[ TP_PROCESS_END ];
+
+    write_phase( fp, first, "accept", r.accept, ts[ TP_READ_BEGIN ], r, r.reactor_tid );
+    write_phase( fp, first, "request", ts[ TP_READ_BEGIN ], ts[ TP_WRITE_END ], r, r.reactor_tid );
+    write_phase( fp, first, "recv", ts[ TP_READ_BEGIN ], ts[ TP_READ_END ], r, r.reactor_tid );
+    write_phase( fp, first, "queue", ts[ TP_READ_END ], ts[ TP_DEQUEUE ], r, r.worker_tid );
+    write_phase( fp, first, "process_read", ts[ TP_DEQUEUE ], parse_end, r, r.worker_tid );
+    write_phase( fp, first, "do_request", ts[ TP_REQUEST_BEGIN ], ts[ TP_REQUEST_END ], r, r.worker_tid );
+    write_phase( fp, first, "process_write", build_begin, ts[ TP_PROCESS_END ], r, r.worker_tid );
+    write_phase( fp, first, "wait_writable", ts[ TP_PROCESS_END ], ts[ TP_WRITE_BEGIN ], r, r.reactor_tid );
+    write_phase( fp, first, "write", ts[ TP_WRITE_BEGIN ], ts[ TP_WRITE_END ], r, r.reactor_tid );
+}
+
+bool trace_dump(const char *path)
+{
+    // 先在锁内把各线程的记录复制出来，写文件时不阻塞请求
+    std::vector<trace_record> records;
+    s_registry_lock.lock();
+    for ( size_t i = 0; i < s_buffers.size(); ++i ) {
+        trace_buffer* b = s_buffers[i];
+        b->lock.lock();
+        uint64_t n = b->count < (uint64_t)trace_buffer::CAPACITY ? b->count : trace_buffer::CAPACITY;
+        for ( uint64_t k = b->count - n; k < b->count; ++k ) {
+            records.push_back( b->records[ k % trace_buffer::CAPACITY ] );
+        }
+        b->lock.unlock();
+    }
+    s_registry_lock.unlock();
+
+    // 可能有别的线程正 mmap 着上一次导出的文件，写临时文件再 rename 不会影响它
+    char tmp[ 256 ];
+    snprintf( tmp, sizeof( tmp ), "%s.%d.tmp", path, trace_tid() );
+    FILE* fp = fopen( tmp, "w" );
+    if ( !fp ) {
+        EMlog(LOGLEVEL_ERROR, "trace: cannot open %s\n", tmp);
+        return false;
+    }
+    fputs( "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", fp );
+    bool first = true;
+    std::set<int> fds;
+    for ( size_t i = 0; i < records.size(); ++i ) {
+        write_record( fp, first, records[i] );
+        fds.insert( records[i].fd );
+    }
+    // 给每一行起个名字
+    for ( std::set<int>::iterator it = fds.begin(); it != fds.end(); ++it ) {
+        fprintf( fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"fd %d\"}}",
+                 first ? "" : ",", (int)getpid(), *it, *it );
+        first = false;
+    }
+    fputs( "\n]}\n", fp );
+    if ( fclose( fp ) != 0 || rename( tmp, path ) != 0 ) {
+        unlink( tmp );
+        return false;
+    }
+    EMlog(LOGLEVEL_INFO, "trace: %zu requests written to %s\n", records.size(), path);
+    return true;
+}
@@ -0,0 +1,73 @@
+/*
+    请求分阶段跟踪
+    按采样率选中的请求在每个阶段记录单调时钟时间戳：accept、接收、在线程池队列中等待、解析、do_request、
+    生成响应、等待可写、发送。请求结束时整条记录写入当前线程的环形缓冲区，收到 SIGUSR1 或者访问
+    TRACE_URL 时导出为 Chrome trace-event 格式的 JSON（chrome://tracing、Perfetto 可以直接打开）。
+    没有开启采样时每个埋点只是一次对 sampled 的判断。
+*/
+
+#ifndef REQ_TRACE_H
+#define REQ_TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+
+// 请求经过的时间点，相邻的两个时间点构成一个阶段
+enum TRACE_POINT {
+    TP_READ_BEGIN = 0,      // 开始接收请求
+    TP_READ_END,            // 接收完，放入线程池队列
+    TP_DEQUEUE,             // 工作线程取出
+    TP_REQUEST_BEGIN,       // 请求解析完，进入 do_request
+    TP_REQUEST_END,         // do_request 返回
+    TP_PROCESS_END,         // 响应生成完，注册 EPOLLOUT
+    TP_WRITE_BEGIN,         // 主线程第一次写
+    TP_WRITE_END,           // 响应发完
+    TP_COUNT
+};
+
+// 采样率：每 N 个请求跟踪一个，0 表示关闭。main 在启动时设置
+extern int g_trace_sample;
+// SIGUSR1 和 TRACE_URL 导出的文件
+extern const char* g_trace_file;
+// 导出跟踪数据的 URL，只接受本机的请求
+#define TRACE_URL "/__trace"
+
+inline bool trace_enabled() { return g_trace_sample > 0; }
+
+// 单调时钟，纳秒
+inline uint64_t trace_now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 当前线程的内核线程id
+int trace_tid();
+
+// 一个请求的跟踪状态，嵌在 http_conn 中
+struct req_trace
+{
+    bool sampled;               // 当前请求是否被选中
+    uint64_t accept;            // 连接 accept 的时间，只算在连接的第一个请求上
+    uint64_t ts[ TP_COUNT ];
+    int worker_tid;             // 处理请求的工作线程
+    int eagain;                 // 发送时 socket 写满的次数
+
+    // 连接建立，开启跟踪时记下 accept 时间
+    void on_accept() { sampled = false; accept = trace_enabled() ? trace_now() : 0; }
+    // 开始接收一个新请求，按采样率决定是否跟踪
+    void begin();
+    void mark(TRACE_POINT p) { if ( sampled ) ts[ p ] = trace_now(); }
+    // 工作线程取出请求
+    void mark_worker() { if ( sampled ) { ts[ TP_DEQUEUE ] = trace_now(); worker_tid = trace_tid(); } }
+    // 首次写
+    void mark_write() { if ( sampled && !ts[ TP_WRITE_BEGIN ] ) ts[ TP_WRITE_BEGIN ] = trace_now(); }
+};
+
+// 请求结束（响应发完），把跟踪记录写入当前线程的缓冲区
+void trace_commit(req_trace& t, int fd, const char* url);
+// 把所有线程缓冲区中的记录导出到 path，先写临时文件再 rename
+bool trace_dump(const char* path);
+
+#endif // REQ_TRACE_H
@@ -0,0 +1,6 @@
+
+HEADERS += \
+    $$PWD/req_trace.h
+
+SOURCES += \
+    $$PWD/req_trace.cpp
@@ -3,6 +3,9 @@ CONFIG += console c++20
 CONFIG -= app_bundle
 CONFIG -= qt
 
+# 统计各个锁的竞争情况，用管理命令 locks 查看
+# DEFINES += LOCK_STATS=1
+
 SOURCES += \
         http_conn.cpp \
         locker.cpp \
@@ -16,3 +19,19 @@ HEADERS += \
     threadpool.h
 
 include($$PWD/noactive/noactive.pri)
+include($$PWD/body/body.pri)
+include($$PWD/header/header.pri)
+include($$PWD/memorypool/memorypool.pri)
+include($$PWD/socket/socket.pri)
+include($$PWD/asset/asset.pri)
+include($$PWD/proxy/proxy.pri)
+include($$PWD/tls/tls.pri)
+include($$PWD/h2/h2.pri)
+include($$PWD/trace/trace.pri)
+include($$PWD/coro/coro.pri)
+include($$PWD/accesslog/accesslog.pri)
+include($$PWD/admin/admin.pri)
+include($$PWD/sched/sched.pri)
+include($$PWD/diskio/diskio.pri)
+include($$PWD/negcache/negcache.pri)
+include($$PWD/ratelimit/ratelimit.pri)